@@ -0,0 +1,66 @@
+/*
+ * Copyright 2023 The Nodepp Project Authors. All Rights Reserved.
+ *
+ * Licensed under the MIT (the "License").  You may not use
+ * this file except in compliance with the License.  You can obtain a copy
+ * in the file LICENSE in the source distribution or at
+ * https://github.com/NodeppOficial/nodepp/blob/main/LICENSE
+ */
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+/* HTTP/1.1 against h2 on loopback: one router serves a small JSON route
+   and a 1MB body, with h2c enabled, and h2load (nghttp2) is run against
+   it twice per route, once with --h1 and once with h2c prior knowledge.
+
+   g++ -o h2 bench/h2.cpp -I. -I<nodepp>/include -lssl -lcrypto
+   ./h2 [ port ] [ requests ] [ clients ] [ streams ] */
+
+#include <nodepp/nodepp.h>
+#include <express/http2.h>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace nodepp;
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+void onMain(){
+
+    auto args = process::args; ulong port = 8000; string_t n = "100000", c = "16", m = "16";
+    if( args.size() > 1 ){ port = string::to_ulong( args[1] ); }
+    if( args.size() > 2 ){ n = args[2]; } if( args.size() > 3 ){ c = args[3]; }
+    if( args.size() > 4 ){ m = args[4]; }
+
+    auto app = express::http::add(); string_t big ( CHUNK_MB(1), 'x' );
+
+    app.GET( "/json", []( express_http_t& cli ){
+        cli.header( "Content-Type", "application/json" ).send( "{\"hello\":\"world\"}" );
+    });
+
+    app.GET( "/big", [=]( express_http_t& cli ){ cli.send( big ); });
+
+    express::http2::enable( app );
+
+    app.listen( "127.0.0.1", port, [=]( socket_t ){
+        auto url = "http://127.0.0.1:" + string::to_string( port );
+        auto cmd = string::format(
+            "for p in /json /big; do"
+            " echo \"== HTTP/1.1 $p\"; h2load --h1 -n %s -c %s %s$p | grep -E 'finished|requests:|time for'; "
+            " echo \"== h2 $p\"      ; h2load      -n %s -c %s -m %s %s$p | grep -E 'finished|requests:|time for'; "
+            "done", n.get(), c.get(), url.get(), n.get(), c.get(), m.get(), url.get() );
+
+        auto pid = ::fork(); if( pid == 0 ){
+            ::execlp( "sh", "sh", "-c", cmd.get(), (char*) nullptr ); ::_exit( 127 );
+        }
+
+        process::poll::add([=](){
+            int st; if( ::waitpid( pid, &st, WNOHANG ) == 0 ){ return 1; }
+            process::exit( 0 ); return -1;
+        });
+    });
+
+}
+
+/*────────────────────────────────────────────────────────────────────────────*/
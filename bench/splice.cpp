@@ -0,0 +1,69 @@
+/*
+ * Copyright 2023 The Nodepp Project Authors. All Rights Reserved.
+ *
+ * Licensed under the MIT (the "License").  You may not use
+ * this file except in compliance with the License.  You can obtain a copy
+ * in the file LICENSE in the source distribution or at
+ * https://github.com/NodeppOficial/nodepp/blob/main/LICENSE
+ */
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+/* nginx/splice.h against stream::duplex on loopback: an upstream serves a
+   large body, a pipe entry with "pool": false relays it, and curl fetches
+   it `rounds` times through the proxy. Run it once per mode and compare
+   the download speed and the CPU time the process spent:
+
+   g++ -O2 -o splice bench/splice.cpp -I. -I<nodepp>/include -lssl -lcrypto
+   ./splice on  [ MB ] [ rounds ]
+   ./splice off [ MB ] [ rounds ] */
+
+#include <nodepp/nodepp.h>
+#include <express/http.h>
+#include <nginx/http.h>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace nodepp;
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+void onMain(){
+
+    auto args = process::args; bool on = args.size() < 2 || args[1] != "off";
+    ulong size = args.size() > 2 ? string::to_ulong( args[2] ) : 256;
+    ulong runs = args.size() > 3 ? string::to_ulong( args[3] ) : 20;
+    nginx::splice::engine().set_enabled( on );
+
+    auto upstream = express::http::add(); string_t body ( CHUNK_MB( size ), 'x' );
+    upstream.GET( "/big", [=]( express_http_t& cli ){ cli.send( body ); });
+    upstream.listen( "127.0.0.1", 8001, []( socket_t ){} );
+
+    auto proxy = nginx::http::add();
+    proxy.add( "pipe", "/", object_t({ { "href", "http://127.0.0.1:8001" }, { "pool", false } }) );
+
+    proxy.listen( "127.0.0.1", 8000, [=]( socket_t ){
+        auto cmd = string::format(
+            "for i in $(seq %lu); do curl -s -o /dev/null -w '%%{speed_download}\\n' http://127.0.0.1:8000/big; done"
+            " | awk '{ s += $1 } END { printf \"%s: %%.1f MB/s average over %%d downloads\\n\", s / NR / 1048576, NR }'",
+            runs, on ? "splice" : "duplex" );
+
+        auto pid = ::fork(); if( pid == 0 ){
+            ::execlp( "sh", "sh", "-c", cmd.get(), (char*) nullptr ); ::_exit( 127 );
+        }
+
+        process::poll::add([=](){
+            int st; if( ::waitpid( pid, &st, WNOHANG ) == 0 ){ return 1; }
+            struct rusage ru; ::getrusage( RUSAGE_SELF, &ru ); auto& z = nginx::splice::engine();
+            console::log( "cpu user", ru.ru_utime.tv_sec * 1000 + ru.ru_utime.tv_usec / 1000, "ms,",
+                          "sys"     , ru.ru_stime.tv_sec * 1000 + ru.ru_stime.tv_usec / 1000, "ms" );
+            console::log( "splice flows", z.get_flows(), "bytes", z.get_bytes(), "copied", z.get_copied() );
+            process::exit( 0 ); return -1;
+        });
+    });
+
+}
+
+/*────────────────────────────────────────────────────────────────────────────*/
@@ -0,0 +1,247 @@
+/*
+ * Copyright 2023 The Nodepp Project Authors. All Rights Reserved.
+ *
+ * Licensed under the MIT (the "License").  You may not use
+ * this file except in compliance with the License.  You can obtain a copy
+ * in the file LICENSE in the source distribution or at
+ * https://github.com/NodeppOficial/nodepp/blob/main/LICENSE
+ */
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#ifndef NODEPP_EXPRESS_AIO
+#define NODEPP_EXPRESS_AIO
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#include <nodepp/nodepp.h>
+#include <nodepp/stream.h>
+#include <express/fd.h>
+
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <deque>
+#include <vector>
+#include <cstdlib>
+
+#ifdef NODEPP_EXPRESS_URING
+#include <liburing.h>
+#endif
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+/* reads files off the event loop: through io_uring when the build defines
+   NODEPP_EXPRESS_URING and the kernel accepts the ring, otherwise through a
+   small pool of pread() threads. Completions are reaped by a poll task and
+   delivered on the loop thread, so callbacks never race the server.
+   Reads past the global or per-descriptor limit wait in a queue. */
+
+namespace nodepp { class express_aio_t {
+protected:
+
+    struct REQ {
+        int      fd  =-1;           // the only fields a worker touches
+        ulong    off = 0;
+        ulong    len = 0;
+        char*    buf = nullptr;
+        long     res = 0;
+        ptr_t<express_fd_t>       ref;
+        function_t<void,string_t> cb ;
+    };
+
+    struct NODE {
+        std::mutex               mtx;
+        std::condition_variable  cv ;
+        std::deque<REQ*>         todo, done;
+        std::vector<std::thread> pool;
+        std::atomic<ulong>       ready { 0 };
+        bool                     stop = 0;
+
+        queue_t<REQ*>   pending;
+        map_t<int,ulong> per;
+        ulong inflight= 0;
+        ulong limit   = 64;         // reads in flight, all files
+        ulong file    = 4;          // reads in flight, one descriptor
+        ulong threads = 4;
+        ulong count   = 0;
+        bool  task    = 0;
+        bool  init    = 0;
+        bool  enabled = 1;
+
+#ifdef NODEPP_EXPRESS_URING
+        struct io_uring ring; bool uring = 0;
+#endif
+
+       ~NODE() noexcept {
+            { std::unique_lock<std::mutex> lock( mtx ); stop = 1; } cv.notify_all();
+            for( auto& y: pool ){ if( y.joinable() ){ y.join(); } }
+#ifdef NODEPP_EXPRESS_URING
+            if( uring ){ io_uring_queue_exit( &ring ); }
+#endif
+        }
+    };  ptr_t<NODE> obj;
+
+    /*.........................................................................*/
+
+    static void worker( NODE* node ) {
+        while( true ){ REQ* req = nullptr; {
+            std::unique_lock<std::mutex> lock( node->mtx );
+            node->cv.wait( lock, [&](){ return node->stop || !node->todo.empty(); } );
+            if( node->stop ){ return; } req = node->todo.front(); node->todo.pop_front();
+        }
+            ulong len = 0; while( len < req->len ){
+                auto c = ::pread( req->fd, req->buf + len, req->len - len, req->off + len );
+                if ( c < 0 && errno == EINTR ){ continue; } if( c <= 0 ){ break; } len += c;
+            }   req->res = len;
+
+            std::unique_lock<std::mutex> lock( node->mtx );
+            node->done.push_back( req ); node->ready++;
+        }
+    }
+
+    void start() const noexcept {
+        if( obj->init ){ return; } obj->init = 1;
+#ifdef NODEPP_EXPRESS_URING
+        if( io_uring_queue_init( obj->limit, &obj->ring, 0 ) == 0 ){ obj->uring = 1; return; }
+#endif
+        for( ulong x=0; x<obj->threads; x++ ){ obj->pool.push_back( std::thread( &worker, obj.get() ) ); }
+    }
+
+    /*.........................................................................*/
+
+    bool fits( int fd ) const noexcept {
+        if( obj->inflight >= obj->limit ){ return false; }
+        return !obj->per.has( fd ) || obj->per[fd] < obj->file;
+    }
+
+    void submit( REQ* req ) const noexcept {
+        obj->inflight++; obj->per[req->fd] = obj->per.has( req->fd ) ? obj->per[req->fd] + 1 : 1;
+#ifdef NODEPP_EXPRESS_URING
+        if( obj->uring ){ auto sqe = io_uring_get_sqe( &obj->ring );
+        if( sqe != nullptr ){
+            io_uring_prep_read( sqe, req->fd, req->buf, req->len, req->off );
+            io_uring_sqe_set_data( sqe, req ); io_uring_submit( &obj->ring ); return;
+        }}
+#endif
+        { std::unique_lock<std::mutex> lock( obj->mtx ); obj->todo.push_back( req ); }
+        if( obj->pool.empty() ){ // ring full and no pool yet
+            for( ulong x=0; x<obj->threads; x++ ){ obj->pool.push_back( std::thread( &worker, obj.get() ) ); }
+        }   obj->cv.notify_one();
+    }
+
+    void complete( REQ* req ) const noexcept {
+        obj->inflight--; obj->count++;
+        if( --obj->per[req->fd] == 0 ){ obj->per.erase( req->fd ); }
+
+        auto data = req->res > 0 ? string_t( req->buf, req->res ) : string_t();
+        auto cb   = req->cb; ::free( req->buf ); delete req;
+
+        for( ulong x=obj->pending.size(); x-->0; ){
+             auto y = obj->pending.first()->data; obj->pending.shift();
+             if( fits( y->fd ) ){ submit( y ); } else { obj->pending.push( y ); }
+        }   cb( data );
+    }
+
+    void reap() const noexcept {
+#ifdef NODEPP_EXPRESS_URING
+        if( obj->uring ){ struct io_uring_cqe* cqe;
+            while( io_uring_peek_cqe( &obj->ring, &cqe ) == 0 ){
+                auto req = (REQ*) io_uring_cqe_get_data( cqe ); req->res = cqe->res;
+                io_uring_cqe_seen( &obj->ring, cqe ); complete( req );
+            }
+        }
+#endif
+        if( obj->ready.load() == 0 ){ return; } std::deque<REQ*> list; {
+            std::unique_lock<std::mutex> lock( obj->mtx );
+            list.swap( obj->done ); obj->ready = 0;
+        }   for( auto y: list ){ complete( y ); }
+    }
+
+    void watch() const noexcept {
+        if( obj->task ){ return; } obj->task = 1; auto self = type::bind( this );
+        process::poll::add([=](){ self->reap();
+            if( self->obj->inflight==0 && self->obj->pending.empty() ){ self->obj->task=0; return -1; }
+            return 1;
+        });
+    }
+
+public:
+
+    express_aio_t() noexcept : obj( new NODE() ) {}
+
+    /*.........................................................................*/
+
+    /* takes effect before the first read */
+    void set_threads( ulong size ) const noexcept { obj->threads = max( size, 1UL ); }
+
+    void set_limit( ulong limit, ulong file ) const noexcept {
+         obj->limit = max( limit, 1UL ); obj->file = max( file, 1UL );
+    }
+
+    void set_enabled( bool value ) const noexcept { obj->enabled = value; }
+    bool is_enabled()  const noexcept { return obj->enabled; }
+
+    bool is_uring() const noexcept {
+#ifdef NODEPP_EXPRESS_URING
+        return obj->uring;
+#else
+        return false;
+#endif
+    }
+
+    ulong get_inflight() const noexcept { return obj->inflight;       }
+    ulong get_pending()  const noexcept { return obj->pending.size(); }
+    ulong get_done()     const noexcept { return obj->count;          }
+
+    /*.........................................................................*/
+
+    /* reads [off,off+len) and calls `cb` on the loop thread with the bytes
+       read; an empty string means end of file or error. */
+    void read( ptr_t<express_fd_t> fd, ulong off, ulong len, function_t<void,string_t> cb ) const noexcept {
+        start(); auto req = new REQ();
+        req->fd = fd->fd; req->off = off; req->len = len; req->ref = fd; req->cb = cb;
+        req->buf= (char*) ::malloc( max( len, 1UL ) );
+        if( fits( req->fd ) ){ submit( req ); } else { obj->pending.push( req ); }
+        watch();
+    }
+
+};}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+namespace nodepp { namespace express { namespace aio {
+
+    inline express_aio_t& engine() {
+        static express_aio_t out; return out;
+    }
+
+    /*.........................................................................*/
+
+    /* same contract as express::fd::pipe(), but the next chunk is read in
+       the background while the loop keeps serving other sockets. */
+    template< class T >
+    void pipe( ptr_t<express_fd_t> fd, const T& cli, ulong from, ulong to ) {
+        auto pos  = type::bind( from ); auto data = type::bind( string_t() );
+        auto wait = type::bind( (bool) 0 ); auto eof = type::bind( (bool) 0 );
+        auto wrt  = type::bind( _file_::write() );
+
+        process::poll::add([=](){
+            if( !cli.is_available() ){ return -1; } if( *wait ){ return 1; }
+            if( data->empty() ){ if( *pos >= to || *eof ){ return -1; } *wait = 1;
+                engine().read( fd, *pos, min( (ulong) CHUNK_SIZE, to - *pos ), [=]( string_t chunk ){
+                    *wait = 0; if( chunk.empty() ){ *eof = 1; } *data = chunk;
+                }); return 1;
+            }
+            if((*wrt)( &cli, *data )==1 ){ return 1; }
+            if(  wrt->state <= 0 ){ return -1; }
+           *pos += data->size(); *data = nullptr; return 1;
+        });
+    }
+
+}}}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#endif
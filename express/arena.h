@@ -0,0 +1,107 @@
+/*
+ * Copyright 2023 The Nodepp Project Authors. All Rights Reserved.
+ *
+ * Licensed under the MIT (the "License").  You may not use
+ * this file except in compliance with the License.  You can obtain a copy
+ * in the file LICENSE in the source distribution or at
+ * https://github.com/NodeppOficial/nodepp/blob/main/LICENSE
+ */
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#ifndef NODEPP_EXPRESS_ARENA
+#define NODEPP_EXPRESS_ARENA
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#include <nodepp/nodepp.h>
+#include <new>
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+namespace nodepp { struct express_alloc_t {
+    ulong fresh = 0;   // blocks taken from the heap
+    ulong reused= 0;   // blocks served from the free list
+    ulong freed = 0;   // blocks handed back to the heap
+    ulong pooled= 0;   // blocks waiting in the free list
+    ulong requests=0;  // requests measured
+    ulong heap  = 0;   // global allocations the thread made while they lived
+};}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+namespace nodepp { namespace _express_ {
+
+    /* global allocations made by the calling thread. Only express/heap.h
+       counts them; without it they stay at zero. */
+    inline ulong& heap_count() noexcept { static thread_local ulong out = 0; return out; }
+
+    /* fixed-size free list for per-request state: a block released when the
+       request ends is handed to the next request on the same thread instead
+       of going back to the heap. One list per type and per thread, so the
+       workers never contend for it. Only the block itself is recycled: the
+       header map, strings and arrays it holds still allocate through their
+       own containers, so this saves one allocation per request, not all of
+       them: nodepp's containers take no allocator, so they cannot be moved
+       onto a per-request arena from here. measure() records what the rest
+       costs, see express::arena::per_request(). */
+    template< class T > struct arena_t {
+
+        struct STATE {
+            void*           head = nullptr;
+            ulong           limit= 1024;
+            express_alloc_t stat ;
+           ~STATE() noexcept { while( head ){ auto y = head; head = *(void**) y; ::operator delete( y ); } }
+        };
+
+        static STATE& get() noexcept { static thread_local STATE out; return out; }
+
+        static void* alloc( size_t len ) {
+            auto& s = get(); if( len != sizeof(T) || s.head == nullptr ){
+                s.stat.fresh++; return ::operator new( len );
+            }   auto y = s.head; s.head = *(void**) y;
+                s.stat.pooled--; s.stat.reused++; return y;
+        }
+
+        static void release( void* y, size_t len ) noexcept {
+            auto& s = get(); if( len != sizeof(T) || s.stat.pooled >= s.limit ){
+                s.stat.freed++; ::operator delete( y ); return;
+            }   *(void**) y = s.head; s.head = y; s.stat.pooled++;
+        }
+
+        /* a request that came in when heap_count() was `since` has ended */
+        static void measure( ulong since ) noexcept {
+            auto& s = get(); s.stat.requests++; s.stat.heap += heap_count() - since;
+        }
+
+    };
+
+}}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+namespace nodepp { namespace express { namespace arena {
+
+    /* free list counters of the calling thread for the pooled type T. */
+    template< class T >
+    express_alloc_t stats() { return _express_::arena_t<T>::get().stat; }
+
+    template< class T >
+    void set_limit( ulong limit ) { _express_::arena_t<T>::get().limit = limit; }
+
+    /* global allocations per request on the calling thread, for the
+       request type T ( express_http_t, express_https_t ). It needs
+       express/heap.h in the program, and counts whatever the thread
+       allocated while a request lived: requests served side by side are
+       charged each other's allocations, so read it with one connection
+       at a time. */
+    template< class T >
+    ulong per_request() {
+        auto y = T::get_alloc(); return y.requests == 0 ? 0 : y.heap / y.requests;
+    }
+
+}}}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#endif
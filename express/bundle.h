@@ -0,0 +1,313 @@
+/*
+ * Copyright 2023 The Nodepp Project Authors. All Rights Reserved.
+ *
+ * Licensed under the MIT (the "License").  You may not use
+ * this file except in compliance with the License.  You can obtain a copy
+ * in the file LICENSE in the source distribution or at
+ * https://github.com/NodeppOficial/nodepp/blob/main/LICENSE
+ */
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#ifndef NODEPP_EXPRESS_BUNDLE
+#define NODEPP_EXPRESS_BUNDLE
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#include <nodepp/nodepp.h>
+#include <nodepp/stream.h>
+#include <nodepp/path.h>
+#include <nodepp/zlib.h>
+#include <nodepp/fs.h>
+#include <express/https.h>
+
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cstdlib>
+#include <cerrno>
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+/* bundle layout, native byte order:
+   [ HEAD ][ ENTRY x count, sorted by hash ][ strings ][ blobs ]
+   every offset is absolute from the start of the file. */
+
+namespace nodepp { namespace _express_ {
+
+    struct bundle_head_t {
+        char   magic[8];   // "NPBUNDL1"
+        uint32 count;
+        uint32 flags;
+    };
+
+    struct bundle_entry_t {
+        uint64 hash;
+        uint32 path_off, path_len;
+        uint32 mime_off, mime_len;
+        uint32 etag_off, etag_len;
+        uint64 data_off, data_len;
+        uint64 gzip_off, gzip_len;  // 0 when no gzip variant was stored
+    };
+
+    inline uint64 bundle_hash( const char* data, ulong len ) {
+        uint64 out = 14695981039346656037ULL;
+        for( ulong x=0; x<len; x++ ){ out ^= (uchar) data[x]; out *= 1099511628211ULL; }
+        return out;
+    }
+
+    inline int bundle_sort( const void* a, const void* b ) {
+        auto x = (const bundle_entry_t*) a; auto y = (const bundle_entry_t*) b;
+        return x->hash < y->hash ? -1 : x->hash > y->hash ? 1 : 0;
+    }
+
+    /* files below `base`, symlinks followed; `trail` holds the directories
+       on the way down, one seen again is a symlink loop and is skipped */
+    inline void bundle_walk( const string_t& base, const string_t& rel, array_t<string_t>& out, array_t<string_t>& trail ) {
+        struct stat st; if( ::stat( path::join( base, rel ).get(), &st ) != 0 ){ return; }
+        auto id = string::format( "%lu:%lu", (ulong) st.st_dev, (ulong) st.st_ino );
+        forEach( y, trail ){ if( y == id ){ return; } }
+
+        DIR* dir = ::opendir( path::join( base, rel ).get() ); if( dir==nullptr ){ return; } trail.push( id );
+        while( auto y = ::readdir( dir ) ){ string_t name = y->d_name;
+            if( name == "." || name == ".." ){ continue; }
+            auto sub = rel.empty() ? name : rel + "/" + name;
+            if( ::stat( path::join( base, sub ).get(), &st ) != 0 ){ continue; }
+              if( S_ISDIR( st.st_mode ) ){ bundle_walk( base, sub, out, trail ); }
+            elif( S_ISREG( st.st_mode ) ){ out.push( sub ); }
+        }   ::closedir( dir ); trail.pop();
+    }
+
+    inline void bundle_walk( const string_t& base, const string_t& rel, array_t<string_t>& out ) {
+        array_t<string_t> trail; bundle_walk( base, rel, out, trail );
+    }
+
+}}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+namespace nodepp { class express_bundle_t {
+protected:
+
+    struct NODE {
+        const char* data = nullptr;
+        ulong       size = 0;
+        const _express_::bundle_entry_t* list = nullptr;
+        ulong       count= 0;
+       ~NODE() noexcept { if( data ){ ::munmap( (void*) data, size ); } }
+    };  ptr_t<NODE> obj;
+
+    bool valid( uint64 off, uint64 len ) const noexcept {
+        return off <= obj->size && len <= obj->size - off;
+    }
+
+public:
+
+    express_bundle_t( const string_t& file ) : obj( new NODE() ) {
+        int fd = ::open( file.get(), O_RDONLY | O_CLOEXEC ); struct stat st;
+        if( fd < 0 || ::fstat( fd, &st ) != 0 ){ if( fd>=0 ){ ::close(fd); }
+            process::error( "bundle not found: ", file );
+        }
+
+        void* map = ::mmap( nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0 ); ::close( fd );
+        if( map == MAP_FAILED ){ process::error( "bundle couldn't be mapped: ", file ); }
+        obj->data = (const char*) map; obj->size = st.st_size;
+
+        auto head = (const _express_::bundle_head_t*) obj->data;
+        if( obj->size < sizeof(*head) || memcmp( head->magic, "NPBUNDL1", 8 ) != 0 )
+          { process::error( "invalid bundle: ", file ); }
+
+        obj->count = head->count; obj->list = (const _express_::bundle_entry_t*)( head + 1 );
+        if( !valid( sizeof(*head), obj->count * sizeof(_express_::bundle_entry_t) ) )
+          { process::error( "invalid bundle: ", file ); }
+
+        for( ulong x=0; x<obj->count; x++ ){ auto& y = obj->list[x];
+        if ( !valid( y.path_off, y.path_len ) || !valid( y.mime_off, y.mime_len ) ||
+             !valid( y.etag_off, y.etag_len ) || !valid( y.data_off, y.data_len ) ||
+             !valid( y.gzip_off, y.gzip_len ) ){ process::error( "invalid bundle: ", file ); }
+        }
+    }
+
+    express_bundle_t() noexcept : obj( new NODE() ) {}
+
+    /*.........................................................................*/
+
+    ulong size() const noexcept { return obj->count; }
+
+    /* binary search over the hash-sorted index; nullptr when missing. */
+    const _express_::bundle_entry_t* find( const string_t& name ) const noexcept {
+        auto hash = _express_::bundle_hash( name.get(), name.size() );
+        ulong lo = 0, hi = obj->count; while( lo < hi ){
+            ulong mid = ( lo + hi ) / 2;
+            if( obj->list[mid].hash < hash ){ lo = mid + 1; } else { hi = mid; }
+        }
+
+        for( ; lo<obj->count && obj->list[lo].hash==hash; lo++ ){ auto& y = obj->list[lo];
+        if ( y.path_len == name.size() && memcmp( obj->data + y.path_off, name.get(), name.size() )==0 )
+           { return &y; }
+        }  return nullptr;
+    }
+
+    const char* data( uint64 off ) const noexcept { return obj->data + off; }
+
+    string_t text( uint64 off, uint64 len ) const noexcept {
+        return string_t( (char*) obj->data + off, len );
+    }
+
+};}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+namespace nodepp { namespace express { namespace bundle {
+
+    inline bool compressible( const string_t& mime ) {
+        return regex::test( mime, "text|javascript|json|xml|svg|wasm", true );
+    }
+
+    /* packs every regular file below `dir` into `file`; text-like files get
+       a precompressed gzip variant when it is smaller than the original. */
+    inline ulong pack( const string_t& dir, const string_t& file ) {
+        array_t<string_t> list; _express_::bundle_walk( dir, nullptr, list );
+        ulong count = list.size(); if( count == 0 ){ process::error( "nothing to bundle in: ", dir ); }
+
+        ptr_t<_express_::bundle_entry_t> idx ( count, _express_::bundle_entry_t() );
+        array_t<string_t> strs, blobs; uint64 spos = 0, bpos = 0;
+
+        for( ulong x=0; x<count; x++ ){
+            file_t inp ( path::join( dir, list[x] ), "r" ); auto& y = idx[x];
+            auto  data = stream::await( inp );
+            auto  mime = path::mimetype( list[x] );
+            auto  etag = string::format( "\"%016lx\"",
+                         (ulong) _express_::bundle_hash( data.get(), data.size() ) );
+            auto  gzip = compressible( mime ) ? zlib::gzip::get( data ) : string_t();
+            if  ( gzip.size() >= data.size() ){ gzip = nullptr; }
+
+            y.hash     = _express_::bundle_hash( list[x].get(), list[x].size() );
+            y.path_off = spos; y.path_len = list[x].size(); spos += y.path_len; strs.push( list[x] );
+            y.mime_off = spos; y.mime_len = mime.size();    spos += y.mime_len; strs.push( mime );
+            y.etag_off = spos; y.etag_len = etag.size();    spos += y.etag_len; strs.push( etag );
+            y.data_off = bpos; y.data_len = data.size();    bpos += y.data_len; blobs.push( data );
+            y.gzip_off = bpos; y.gzip_len = gzip.size();    bpos += y.gzip_len; blobs.push( gzip );
+        }
+
+        uint64 base = sizeof(_express_::bundle_head_t) + count * sizeof(_express_::bundle_entry_t);
+        for( ulong x=0; x<count; x++ ){ auto& y = idx[x];
+             y.path_off += base; y.mime_off += base; y.etag_off += base;
+             y.data_off += base + spos; y.gzip_off = y.gzip_len ? y.gzip_off + base + spos : 0;
+        }
+
+        ::qsort( idx.get(), count, sizeof(_express_::bundle_entry_t), &_express_::bundle_sort );
+
+        _express_::bundle_head_t head; memcpy( head.magic, "NPBUNDL1", 8 );
+        head.count = count; head.flags = 0;
+
+        auto out = fs::writable( file );
+        out.write( string_t( (char*) &head, sizeof(head) ) );
+        out.write( string_t( (char*) idx.get(), count * sizeof(_express_::bundle_entry_t) ) );
+        forEach( item, strs  ){ out.write( item ); }
+        forEach( item, blobs ){ if( !item.empty() ){ out.write( item ); } }
+        out.close(); return count;
+    }
+
+    /*.........................................................................*/
+
+    /* writes straight from the mapping; the only copy is the kernel's. */
+    template< class T >
+    void pipe( express_bundle_t bnd, const T& cli, uint64 off, uint64 len ) {
+        auto pos = type::bind( off ); uint64 end = off + len;
+        process::poll::add([=](){
+            if( !cli.is_available() || *pos >= end ){ return -1; }
+            auto c = ::send( cli.get_fd(), bnd.data( *pos ), min( (uint64) CHUNK_SIZE, end - *pos ),
+                             MSG_DONTWAIT | MSG_NOSIGNAL );
+            if ( c < 0 ){ return ( errno==EAGAIN || errno==EWOULDBLOCK ) ? 1 : -1; }
+            *pos += c; return 1;
+        });
+    }
+
+    /* TLS sockets have to encrypt into their own buffer anyway, so they get
+       plain chunks through the regular writer. */
+    template< class T >
+    void pipe_chunks( express_bundle_t bnd, const T& cli, uint64 off, uint64 len ) {
+        auto pos = type::bind( off ); uint64 end = off + len;
+        auto wrt = type::bind( _file_::write() ); auto data = type::bind( string_t() );
+        process::poll::add([=](){
+            if( !cli.is_available() ){ return -1; }
+            if( data->empty() ){ if( *pos >= end ){ return -1; }
+               *data = bnd.text( *pos, min( (uint64) CHUNK_SIZE, end - *pos ) );
+            }
+            if((*wrt)( &cli, *data )==1 ){ return 1; }
+            if(  wrt->state <= 0 ){ return -1; }
+           *pos += data->size(); *data = nullptr; return 1;
+        });
+    }
+
+    /*.........................................................................*/
+
+    /* resolves `name` like the file() handlers do and answers from the
+       bundle; returns false when nothing matched. */
+    template< class T, class V >
+    bool serve( express_bundle_t bnd, T& cli, string_t name, V pipe ) {
+        while( !name.empty() && name[0] == '/' ){ name = name.slice(1); }
+        if( name.empty() || name[name.last()] == '/' ){ name += "index.html"; }
+
+        auto y = bnd.find( name );
+        if( y == nullptr ){ y = bnd.find( name + ".html" ); }
+        if( y == nullptr ){ y = bnd.find( "404.html" ); if( y ){ cli.status(404); } }
+        if( y == nullptr ){ return false; }
+
+        auto etag = bnd.text( y->etag_off, y->etag_len );
+        cli.header( "Content-Type",  bnd.text( y->mime_off, y->mime_len ) );
+        cli.header( "Cache-Control", "public, max-age=604800" );
+        cli.header( "ETag", etag ); cli.header( "Vary", "Accept-Encoding" );
+
+        if( cli.headers["If-None-Match"] == etag ){ cli.status(304).send(); return true; }
+
+        uint64 off = y->data_off, len = y->data_len;
+        if( y->gzip_len > 0 && regex::test( cli.headers["Accept-Encoding"], "gzip" ) ){
+            cli.header( "Content-Encoding", "gzip" ); off = y->gzip_off; len = y->gzip_len;
+        }
+
+        cli.header( "Content-Length", string::to_string( len ) ); cli.send();
+        if( cli.method != "HEAD" ){ pipe( bnd, cli, off, len ); } return true;
+    }
+
+}}}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+namespace nodepp { namespace express { namespace http {
+
+    express_tcp_t bundle( string_t file ) { express_tcp_t app; express_bundle_t bnd( file );
+
+        app.ALL([=]( express_http_t& cli ){
+            auto pth = regex::replace( cli.path, app.get_path().slice(1), "/" );
+            if( !express::bundle::serve( bnd, cli, pth, &express::bundle::pipe<express_http_t> ) )
+              { cli.status(404).send("Oops 404 Error"); }
+        });
+
+        return app;
+    }
+
+}}}
+
+namespace nodepp { namespace express { namespace https {
+
+    express_tls_t bundle( string_t file ) { express_tls_t app; express_bundle_t bnd( file );
+
+        app.ALL([=]( express_https_t& cli ){
+            auto pth = regex::replace( cli.path, app.get_path(), "/" );
+            if( !express::bundle::serve( bnd, cli, pth, &express::bundle::pipe_chunks<express_https_t> ) )
+              { cli.status(404).send("Oops 404 Error"); }
+        });
+
+        return app;
+    }
+
+}}}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#endif
@@ -0,0 +1,143 @@
+/*
+ * Copyright 2023 The Nodepp Project Authors. All Rights Reserved.
+ *
+ * Licensed under the MIT (the "License").  You may not use
+ * this file except in compliance with the License.  You can obtain a copy
+ * in the file LICENSE in the source distribution or at
+ * https://github.com/NodeppOficial/nodepp/blob/main/LICENSE
+ */
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#ifndef NODEPP_EXPRESS_DEFER
+#define NODEPP_EXPRESS_DEFER
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#include <nodepp/nodepp.h>
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+namespace nodepp { namespace express { namespace defer {
+    /* what push() does once the queue is full:
+       DROP_NEW refuses the task, DROP_OLD evicts the oldest waiting task,
+       INLINE runs it right away, slowing the caller down instead. */
+    enum POLICY { DROP_NEW = 0, DROP_OLD = 1, INLINE = 2 };
+}}}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+/* background work that must not hold a response back: audit logs, cache
+   warming, analytics. Tasks run on the loop thread from a poll task that
+   takes at most `batch` tasks or `budget` ms per pass and then yields, so
+   sockets keep being served between batches. */
+
+namespace nodepp { class express_defer_t {
+protected:
+
+    struct TASK {
+        function_t<void> cb;
+        ulong            at = 0;    // queued at, ms
+    };
+
+    struct NODE {
+        queue_t<TASK> list;
+        ulong limit  = 4096;        // waiting tasks
+        ulong batch  = 16;          // tasks per pass
+        ulong budget = 2;           // ms per pass
+        uint  policy = express::defer::DROP_NEW;
+        bool  task   = 0;
+
+        ulong queued = 0;
+        ulong done   = 0;
+        ulong dropped= 0;
+        ulong inlined= 0;
+        ulong peak   = 0;           // deepest the queue has been
+        ulong wait   = 0;           // ms spent queued, all tasks
+        ulong worst  = 0;           // longest single wait
+    };  ptr_t<NODE> obj;
+
+    /*.........................................................................*/
+
+    void invoke( TASK& y ) const noexcept {
+        auto now = process::now(); auto w = now > y.at ? now - y.at : 0;
+        obj->wait += w; obj->worst = max( obj->worst, w ); obj->done++; y.cb();
+    }
+
+    void drain() const noexcept {
+        auto end = process::now() + obj->budget;
+        for( ulong x=0; x<obj->batch && !obj->list.empty(); x++ ){
+             auto y = obj->list.first()->data; obj->list.shift(); invoke( y );
+             if( process::now() >= end ){ break; }
+        }
+    }
+
+    void watch() const noexcept {
+        if( obj->task ){ return; } obj->task = 1; auto self = type::bind( this );
+        process::poll::add([=](){ self->drain();
+            if( self->obj->list.empty() ){ self->obj->task = 0; return -1; }
+            return 1;
+        });
+    }
+
+public:
+
+    express_defer_t() noexcept : obj( new NODE() ) {}
+
+    /*.........................................................................*/
+
+    void set_limit ( ulong limit ) const noexcept { obj->limit  = max( limit, 1UL ); }
+    void set_policy( uint policy ) const noexcept { obj->policy = policy; }
+
+    /* how much of each loop pass the queue may take */
+    void set_batch( ulong size, ulong ms ) const noexcept {
+         obj->batch = max( size, 1UL ); obj->budget = max( ms, 1UL );
+    }
+
+    /*.........................................................................*/
+
+    ulong size()        const noexcept { return obj->list.size(); }
+    ulong get_queued()  const noexcept { return obj->queued;  }
+    ulong get_done()    const noexcept { return obj->done;    }
+    ulong get_dropped() const noexcept { return obj->dropped; }
+    ulong get_inlined() const noexcept { return obj->inlined; }
+    ulong get_peak()    const noexcept { return obj->peak;    }
+    ulong get_worst()   const noexcept { return obj->worst;   }
+
+    /* average time a task waited for its turn, in ms */
+    ulong get_wait() const noexcept { return obj->done==0 ? 0 : obj->wait / obj->done; }
+
+    /*.........................................................................*/
+
+    /* false when the task was refused, see express::defer::POLICY */
+    bool push( function_t<void> cb ) const noexcept {
+        TASK y; y.cb = cb; y.at = process::now();
+
+        if( obj->list.size() >= obj->limit ){
+          if( obj->policy == express::defer::INLINE  ){ obj->inlined++; invoke( y ); return true; }
+          if( obj->policy != express::defer::DROP_OLD ){ obj->dropped++; return false; }
+              obj->list.shift(); obj->dropped++;
+        }
+
+        obj->list.push( y ); obj->queued++;
+        obj->peak = max( obj->peak, obj->list.size() );
+        watch(); return true;
+    }
+
+};}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+namespace nodepp { namespace express { namespace defer {
+
+    inline express_defer_t& engine() {
+        static express_defer_t out; return out;
+    }
+
+    inline bool add( function_t<void> cb ) { return engine().push( cb ); }
+
+}}}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#endif
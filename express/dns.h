@@ -0,0 +1,255 @@
+/*
+ * Copyright 2023 The Nodepp Project Authors. All Rights Reserved.
+ *
+ * Licensed under the MIT (the "License").  You may not use
+ * this file except in compliance with the License.  You can obtain a copy
+ * in the file LICENSE in the source distribution or at
+ * https://github.com/NodeppOficial/nodepp/blob/main/LICENSE
+ */
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#ifndef NODEPP_EXPRESS_DNS
+#define NODEPP_EXPRESS_DNS
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#include <nodepp/nodepp.h>
+#include <nodepp/url.h>
+
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <deque>
+#include <vector>
+#include <string>
+
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+/* host name -> addresses, shared by every outbound connection. Answers are
+   kept `ttl` ms and handed out round-robin over all A/AAAA records, AAAA
+   only when the host has an IPv6 address of its own; for another `grace`
+   ms past the ttl a stale answer is still returned while a refresh runs
+   behind it, failed refreshes do not stretch that. Failures are
+   remembered `negative` ms. getaddrinfo() blocks,
+   so it runs on a few worker threads and completions are delivered on the
+   loop thread by a poll task. A stub set with set_stub() answers instead,
+   synchronously, which is what tests want. */
+
+namespace nodepp { class express_dns_t {
+protected:
+
+    struct ENTRY {
+        array_t<string_t> addr;
+        ulong until = 0;            // no new lookup before, ms
+        ulong expiry= 0;            // ttl end of the last good answer, ms
+        ulong next  = 0;            // round-robin cursor
+        bool  busy  = 0;
+        queue_t<function_t<void,string_t>> wait;
+    };
+
+    struct JOB {
+        std::string              host;  // the only fields a worker touches
+        std::vector<std::string> addr;
+        ptr_t<ENTRY>             ref;
+    };
+
+    struct NODE {
+        std::mutex               mtx;
+        std::condition_variable  cv ;
+        std::deque<JOB*>         todo, done;
+        std::vector<std::thread> pool;
+        std::atomic<ulong>       ready { 0 };
+        bool                     stop = 0;
+
+        map_t<string_t,ptr_t<ENTRY>> list;
+        function_t<array_t<string_t>,string_t> stub;
+        bool  stubbed  = 0;
+        ulong ttl      = 30000;
+        ulong grace    = 30000;
+        ulong negative = 5000;
+        ulong limit    = 4096;      // names kept
+        ulong threads  = 2;
+        ulong inflight = 0;
+        bool  task     = 0;
+
+        ulong hits = 0, miss = 0, stale = 0, fails = 0;
+
+       ~NODE() noexcept {
+            { std::unique_lock<std::mutex> lock( mtx ); stop = 1; } cv.notify_all();
+            for( auto& y: pool ){ if( y.joinable() ){ y.join(); } }
+        }
+    };  ptr_t<NODE> obj;
+
+    /*.........................................................................*/
+
+    static void worker( NODE* node ) {
+        while( true ){ JOB* job = nullptr; {
+            std::unique_lock<std::mutex> lock( node->mtx );
+            node->cv.wait( lock, [&](){ return node->stop || !node->todo.empty(); } );
+            if( node->stop ){ return; } job = node->todo.front(); node->todo.pop_front();
+        }
+            struct addrinfo hint, *res = nullptr; memset( &hint, 0, sizeof(hint) );
+            hint.ai_family = AF_UNSPEC; hint.ai_socktype = SOCK_STREAM;
+            hint.ai_flags  = AI_ADDRCONFIG; // no AAAA to rotate over without IPv6
+
+            if( ::getaddrinfo( job->host.c_str(), nullptr, &hint, &res ) == 0 ){
+            for( auto y = res; y != nullptr; y = y->ai_next ){ char buf[INET6_ADDRSTRLEN] = {0};
+                 if( y->ai_family == AF_INET  ){ ::inet_ntop( AF_INET , &((sockaddr_in *) y->ai_addr)->sin_addr , buf, sizeof(buf) ); }
+               elif( y->ai_family == AF_INET6 ){ ::inet_ntop( AF_INET6, &((sockaddr_in6*) y->ai_addr)->sin6_addr, buf, sizeof(buf) ); }
+                 std::string ip( buf ); if( ip.empty() ){ continue; } bool seen = 0;
+                 for( auto& z: job->addr ){ if( z == ip ){ seen = 1; break; } }
+                 if( !seen ){ job->addr.push_back( ip ); }
+            }   ::freeaddrinfo( res ); }
+
+            std::unique_lock<std::mutex> lock( node->mtx );
+            node->done.push_back( job ); node->ready++;
+        }
+    }
+
+    void submit( JOB* job ) const noexcept {
+        obj->inflight++; { std::unique_lock<std::mutex> lock( obj->mtx ); obj->todo.push_back( job ); }
+        if( obj->pool.empty() ){
+            for( ulong x=0; x<obj->threads; x++ ){ obj->pool.push_back( std::thread( &worker, obj.get() ) ); }
+        }   obj->cv.notify_one(); watch();
+    }
+
+    void reap() const noexcept {
+        if( obj->ready.load() == 0 ){ return; } std::deque<JOB*> list; {
+            std::unique_lock<std::mutex> lock( obj->mtx );
+            list.swap( obj->done ); obj->ready = 0;
+        }
+        for( auto y: list ){ obj->inflight--;
+            array_t<string_t> addr; for( auto& z: y->addr ){ addr.push( string_t( z.c_str(), z.size() ) ); }
+            auto ref = y->ref; delete y; settle( ref, addr );
+        }
+    }
+
+    void watch() const noexcept {
+        if( obj->task ){ return; } obj->task = 1; auto self = type::bind( this );
+        process::poll::add([=](){ self->reap();
+            if( self->obj->inflight==0 ){ self->obj->task=0; return -1; }
+            return 1;
+        });
+    }
+
+    /*.........................................................................*/
+
+    string_t pick( const ptr_t<ENTRY>& y ) const noexcept {
+        if( y->addr.empty() ){ return nullptr; }
+        return y->addr[ y->next++ % y->addr.size() ];
+    }
+
+    /* a failed refresh keeps a stale answer no longer than its grace */
+    void settle( ptr_t<ENTRY> y, array_t<string_t> addr ) const noexcept {
+        auto now = process::now(); y->busy = 0;
+        if( !addr.empty() ){ y->addr = addr; y->until = y->expiry = now + obj->ttl; }
+        else { obj->fails++; y->until = now + obj->negative; expire( y, now ); }
+        while( !y->wait.empty() ){
+            auto cb = y->wait.first()->data; y->wait.shift(); cb( pick( y ) );
+        }
+    }
+
+    void resolve( string_t host, ptr_t<ENTRY> y ) const noexcept {
+        if( y->busy ){ return; } y->busy = 1;
+        if( obj->stubbed ){ settle( y, obj->stub( host ) ); return; }
+        auto job = new JOB(); job->host = std::string( host.get(), host.size() );
+        job->ref = y; submit( job );
+    }
+
+    void expire( const ptr_t<ENTRY>& y, ulong now ) const noexcept {
+        if( now >= y->expiry + obj->grace ){ y->addr.clear(); }
+    }
+
+    ptr_t<ENTRY> entry( const string_t& host ) const noexcept {
+        if( obj->list.has( host ) ){ return obj->list[host]; }
+        if( obj->list.size() >= obj->limit ){ obj->list.clear(); } // in-flight jobs hold their entry
+        auto y = ptr_t<ENTRY>( new ENTRY() ); obj->list[host] = y; return y;
+    }
+
+public:
+
+    express_dns_t() noexcept : obj( new NODE() ) {}
+
+    /*.........................................................................*/
+
+    /* ms an answer is fresh, served stale while refreshing, and a failure
+       is remembered */
+    void set_ttl( ulong ttl, ulong grace, ulong negative ) const noexcept {
+         obj->ttl = max( ttl, 1UL ); obj->grace = grace; obj->negative = negative;
+    }
+
+    void set_limit  ( ulong names ) const noexcept { obj->limit   = max( names, 1UL ); }
+    void set_threads( ulong size  ) const noexcept { obj->threads = max( size , 1UL ); }
+
+    /* answers lookups instead of the system resolver; an empty list is a
+       failed lookup. */
+    void set_stub( function_t<array_t<string_t>,string_t> cb ) const noexcept {
+         obj->stub = cb; obj->stubbed = 1; clear();
+    }
+
+    void del_stub() const noexcept { obj->stubbed = 0; clear(); }
+
+    void clear() const noexcept { obj->list.clear(); }
+
+    /*.........................................................................*/
+
+    ulong size()       const noexcept { return obj->list.size(); }
+    ulong get_hits()   const noexcept { return obj->hits;  }
+    ulong get_miss()   const noexcept { return obj->miss;  }
+    ulong get_stale()  const noexcept { return obj->stale; }
+    ulong get_fails()  const noexcept { return obj->fails; }
+
+    /*.........................................................................*/
+
+    static bool literal( const string_t& host ) noexcept {
+        unsigned char buf[sizeof(struct in6_addr)];
+        return ::inet_pton( AF_INET , host.get(), buf ) == 1 ||
+               ::inet_pton( AF_INET6, host.get(), buf ) == 1;
+    }
+
+    /* calls `cb` with one address of `host`, or an empty string when it
+       cannot be resolved; addresses are passed through untouched. */
+    void lookup( string_t host, function_t<void,string_t> cb ) const noexcept {
+        if( host.empty() ){ cb( nullptr ); return; }
+        if( host[0] == '[' ){ host = regex::replace_all( host, "[\\[\\]]", "" ); }
+        if( literal( host ) ){ cb( host ); return; }
+
+        host = host.to_lower_case(); auto y = entry( host ); auto now = process::now(); expire( y, now );
+        if( now < y->until ){ obj->hits++; cb( pick( y ) ); return; }
+        if( !y->addr.empty() ){ obj->stale++; cb( pick( y ) ); resolve( host, y ); return; }
+
+        obj->miss++; y->wait.push( cb ); resolve( host, y );
+    }
+
+};}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+namespace nodepp { namespace express { namespace dns {
+
+    inline express_dns_t& engine() {
+        static express_dns_t out; return out;
+    }
+
+    inline void lookup( string_t host, function_t<void,string_t> cb ) { engine().lookup( host, cb ); }
+
+    /* `href` with its host name swapped for `ip`; the Host header has to
+       carry the original name. */
+    inline string_t pin( string_t href, string_t ip ) {
+        auto host = url::hostname( href ); if( host.empty() || ip.empty() ){ return href; }
+        if( !ip.find( ':' ).empty() ){ ip = "[" + ip + "]"; }
+        auto pos  = href.find( host ); if( pos.empty() ){ return href; }
+        return href.slice( 0, pos[0] ) + ip + href.slice( pos[1] );
+    }
+
+}}}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#endif
@@ -0,0 +1,169 @@
+/*
+ * Copyright 2023 The Nodepp Project Authors. All Rights Reserved.
+ *
+ * Licensed under the MIT (the "License").  You may not use
+ * this file except in compliance with the License.  You can obtain a copy
+ * in the file LICENSE in the source distribution or at
+ * https://github.com/NodeppOficial/nodepp/blob/main/LICENSE
+ */
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#ifndef NODEPP_EXPRESS_FD
+#define NODEPP_EXPRESS_FD
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#include <nodepp/nodepp.h>
+#include <nodepp/stream.h>
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+namespace nodepp { struct express_fd_t {
+    int   fd   =-1;
+    ulong size = 0;
+    ulong ino  = 0;
+    ulong dev  = 0;
+    ulong mtime= 0;
+    ulong check= 0;   // last revalidation
+    ulong used = 0;   // LRU clock
+   ~express_fd_t() noexcept { if( fd >= 0 ){ ::close( fd ); } }
+};}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+namespace nodepp { class express_fd_cache_t {
+protected:
+
+    struct NODE {
+        map_t<string_t,ptr_t<express_fd_t>> list;
+        ulong size  = 256;
+        ulong check = TIME_SECONDS(1);
+        ulong clock = 0;
+        ulong hits  = 0;
+        ulong miss  = 0;
+        ulong evict = 0;
+        ulong stale = 0;
+    };  ptr_t<NODE> obj;
+
+    /*.........................................................................*/
+
+    bool same( const express_fd_t& y, const struct stat& st ) const noexcept {
+        return y.ino  == (ulong) st.st_ino  && y.dev   == (ulong) st.st_dev &&
+               y.size == (ulong) st.st_size && y.mtime == (ulong) st.st_mtime;
+    }
+
+    ptr_t<express_fd_t> open( const string_t& path ) const noexcept {
+        int fd = ::open( path.get(), O_RDONLY | O_CLOEXEC ); struct stat st;
+        if( fd < 0 ){ return nullptr; }
+        if( ::fstat( fd, &st ) != 0 || !S_ISREG( st.st_mode ) ){ ::close( fd ); return nullptr; }
+
+        auto out = ptr_t<express_fd_t>( new express_fd_t() );
+        out->fd    = fd;                  out->size  = st.st_size;
+        out->ino   = st.st_ino;           out->dev   = st.st_dev;
+        out->mtime = st.st_mtime;         out->check = process::now();
+        return out;
+    }
+
+    /* descriptors still referenced by a response stay open until that
+       response drops them; eviction only forgets them here. */
+    void evict() const noexcept {
+        while( obj->list.size() >= obj->size ){
+            string_t key; ulong old = 0; bool found = false;
+            forEach( item, obj->list.data() ){
+            if( !found || item.second->used < old ){
+                 key = item.first; old = item.second->used; found = true;
+            }}   if( !found ){ break; }
+            obj->list.erase( key ); obj->evict++;
+        }
+    }
+
+public:
+
+    express_fd_cache_t( ulong size, ulong check ) noexcept : obj( new NODE() )
+                      { obj->size = max( size, 1UL ); obj->check = check; }
+
+    express_fd_cache_t( ulong size ) noexcept : obj( new NODE() )
+                      { obj->size = max( size, 1UL ); }
+
+    express_fd_cache_t() noexcept : obj( new NODE() ) {}
+
+    /*.........................................................................*/
+
+    ulong get_hits()  const noexcept { return obj->hits;  }
+    ulong get_miss()  const noexcept { return obj->miss;  }
+    ulong get_evict() const noexcept { return obj->evict; }
+    ulong get_stale() const noexcept { return obj->stale; }
+    ulong size()      const noexcept { return obj->list.size(); }
+
+    /*.........................................................................*/
+
+    /* returns a shared read-only descriptor for `path`, or nullptr when it
+       is not a readable regular file. Cached entries are re-checked with
+       stat() at most once per `check` ms and reopened when the inode,
+       size or mtime changed. */
+    ptr_t<express_fd_t> get( const string_t& path ) const noexcept {
+        auto now = process::now();
+
+        if( obj->list.has( path ) ){ auto y = obj->list[path];
+            if( now - y->check < obj->check ){ y->used = ++obj->clock; obj->hits++; return y; }
+            struct stat st; if( ::stat( path.get(), &st ) == 0 && same( *y, st ) ){
+                y->check = now; y->used = ++obj->clock; obj->hits++; return y;
+            }   obj->list.erase( path ); obj->stale++;
+        }
+
+        obj->miss++; auto y = open( path ); if( y == nullptr ){ return nullptr; }
+        evict(); y->used = ++obj->clock; obj->list[path] = y; return y;
+    }
+
+    void erase( const string_t& path ) const noexcept { obj->list.erase( path ); }
+    void clear()                       const noexcept { obj->list.clear(); }
+
+};}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+namespace nodepp { namespace express { namespace fd {
+
+    inline express_fd_cache_t& cache() {
+        static express_fd_cache_t out; return out;
+    }
+
+    /*.........................................................................*/
+
+    inline string_t read( const ptr_t<express_fd_t>& fd, ulong from, ulong to ) {
+        if( to <= from ){ return nullptr; } ptr_t<char> buf ( to - from, '\0' ); ulong len = 0;
+        while( len < to - from ){
+            auto c = ::pread( fd->fd, buf.get() + len, to - from - len, from + len );
+            if ( c <= 0 ){ break; } len += c;
+        }   return string_t( buf.get(), len );
+    }
+
+    /* streams [from,to) with pread, so any number of responses can share
+       one descriptor without fighting over its file offset. */
+    template< class T >
+    void pipe( ptr_t<express_fd_t> fd, const T& cli, ulong from, ulong to ) {
+        auto pos = type::bind( from ); auto data = type::bind( string_t() );
+        auto wrt = type::bind( _file_::write() );
+
+        process::poll::add([=](){
+            if( !cli.is_available() ){ return -1; }
+            if( data->empty() ){ if( *pos >= to ){ return -1; }
+               *data = read( fd, *pos, min( *pos + CHUNK_SIZE, to ) );
+                if( data->empty() ){ return -1; }
+            }
+            if((*wrt)( &cli, *data )==1 ){ return 1; }
+            if(  wrt->state <= 0 ){ return -1; }
+           *pos += data->size(); *data = nullptr; return 1;
+        });
+    }
+
+}}}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#endif
@@ -0,0 +1,58 @@
+/*
+ * Copyright 2023 The Nodepp Project Authors. All Rights Reserved.
+ *
+ * Licensed under the MIT (the "License").  You may not use
+ * this file except in compliance with the License.  You can obtain a copy
+ * in the file LICENSE in the source distribution or at
+ * https://github.com/NodeppOficial/nodepp/blob/main/LICENSE
+ */
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#ifndef NODEPP_EXPRESS_HEAP
+#define NODEPP_EXPRESS_HEAP
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#include <nodepp/nodepp.h>
+#include <express/arena.h>
+#include <cstdlib>
+#include <atomic>
+#include <new>
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+/* process wide allocation counters. This header replaces the global
+   operator new and delete, so it is never pulled in by other headers:
+   include it in exactly one translation unit, the one that holds main().
+   It also feeds the per-thread count express::arena::per_request() reads. */
+
+namespace nodepp { namespace _express_ {
+    inline std::atomic<ulong>& heap_new() { static std::atomic<ulong> out(0); return out; }
+    inline std::atomic<ulong>& heap_del() { static std::atomic<ulong> out(0); return out; }
+}}
+
+void* operator new( size_t len ) {
+    nodepp::_express_::heap_new()++; nodepp::_express_::heap_count()++; void* y = malloc( len ? len : 1 );
+    if( y == nullptr ){ throw std::bad_alloc(); } return y;
+}
+
+void* operator new[]( size_t len ) { return ::operator new( len ); }
+void  operator delete( void* y ) noexcept { if( y ){ nodepp::_express_::heap_del()++; free( y ); } }
+void  operator delete[]( void* y ) noexcept { ::operator delete( y ); }
+void  operator delete( void* y, size_t ) noexcept { ::operator delete( y ); }
+void  operator delete[]( void* y, size_t ) noexcept { ::operator delete( y ); }
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+namespace nodepp { namespace express { namespace heap {
+
+    /* global allocations and releases since the process started */
+    inline ulong get_new() { return _express_::heap_new().load(); }
+    inline ulong get_del() { return _express_::heap_del().load(); }
+
+}}}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#endif
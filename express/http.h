@@ -34,6 +34,16 @@
 #include <nodepp/fs.h>
 #include <nodepp/os.h>
 
+#include <express/arena.h>
+#include <express/defer.h>
+#include <express/dns.h>
+#include <express/log.h>
+#include <express/fd.h>
+#include <express/aio.h>
+#include <express/json.h>
+#include <express/shed.h>
+#include <express/wheel.h>
+
 /*────────────────────────────────────────────────────────────────────────────*/
 
 #ifndef NODEPP_EXPRESS_GENERATOR
@@ -157,12 +167,16 @@ public:
                         { "Host"  , url::hostname( path ) }
                     });
 
-                    http::fetch( args ).fail([=](...){ *self->state=0; })
-                                       .then([=]( http_t cli ){
-                        cli.onDrain.once([=](){ *self->state=0; });
-                        cli.onData([=]( string_t data ){
-                            strm->get_borrow() +=data;
-                        }); process::poll::add( task, cli, str );
+                    express::dns::lookup( url::hostname( path ), [=]( string_t ip ){
+                        if( ip.empty() ){ *self->state=0; return; } auto cfg = args;
+                        cfg.url = express::dns::pin( cfg.url, ip ); // Host keeps the name
+                        http::fetch( cfg ).fail([=](...){ *self->state=0; })
+                                          .then([=]( http_t cli ){
+                            cli.onDrain.once([=](){ *self->state=0; });
+                            cli.onData([=]( string_t data ){
+                                strm->get_borrow() +=data;
+                            }); process::poll::add( task, cli, str );
+                        });
                     });
 
                 } while(0); coNext;
@@ -267,20 +281,76 @@ public:
 
 /*────────────────────────────────────────────────────────────────────────────*/
 
+/* defined by express/ws.h; WS() only needs them once a route uses it */
+
+namespace nodepp { template< class T > class express_ws_t; }
+namespace nodepp { namespace express { namespace ws {
+    template< class T > express_ws_t<T> upgrade( T& cli );
+}}}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
 namespace nodepp { class express_http_t : public http_t {
 protected:
 
     struct NODE {
         header_t _headers;
         cookie_t _cookies;
+        array_t<string_t> _parts;   // path split once per request
+        string_t          _split;
+        ptr_t<express_timer_t> _deadline;
+        bool              _admit = 0;   // counted as in flight by express::shed
+        char              _gate  =-1;   // express::shed verdict, -1 not asked yet
+        array_t<string_t> _cookie;      // incoming: name, value, name, value...
+        string_t          _slot[5];     // common request headers, see SLOT
+        uint              _slots = 0;   // slots already resolved
+        bool              _parsed= 0;   // _cookie filled
+        char              _gzip  =-1;   // Accept-Encoding allows gzip, -1 unknown
+        array_t<function_t<void>> _defer; // handed to express::defer once released
+        ulong             _start = 0;   // access log: when the request came in, 0 unlogged
+        long              _bytes =-1;   // access log: body size, -1 unknown
+        string_t          _peer;
+        ulong             _heap  = 0;   // express/heap.h count when the request came in, +1
         uint  status= 200;
         int    state= 0;
+        static void* operator new( size_t len ){ return _express_::arena_t<NODE>::alloc( len ); }
+        static void  operator delete( void* y, size_t len ) noexcept { _express_::arena_t<NODE>::release( y, len ); }
     };  ptr_t<NODE> exp;
 
+    static void parse_cookies( const string_t& raw, array_t<string_t>& out ) noexcept {
+        ulong pos = 0; while( pos < raw.size() ){
+            ulong end = pos; while( end<raw.size() && raw[end]!=';' ){ end++; }
+            ulong beg = pos; while( beg<end && raw[beg]==' ' ){ beg++; }
+            ulong eq  = beg; while( eq <end && raw[eq] !='=' ){ eq++;  }
+            if( eq < end && eq > beg ){
+                ulong vb = eq+1, ve = end; while( ve>vb && raw[ve-1]==' ' ){ ve--; }
+                if( ve-vb >= 2 && raw[vb]=='"' && raw[ve-1]=='"' ){ vb++; ve--; }
+                out.push( raw.slice( beg, eq ) ); out.push( raw.slice( vb, ve ) );
+            }   pos = end + 1;
+        }
+    }
+
+    /* one access log line; the size is whatever account() or the
+       Content-Length header said, unknown otherwise. */
+    void logged() const noexcept {
+        auto len = exp->_bytes; if( len < 0 ){
+             if( exp->_headers.has("Content-Length") ){ len = string::to_long( exp->_headers["Content-Length"] ); }
+           elif( exp->_headers.has("content-length") ){ len = string::to_long( exp->_headers["content-length"] ); }
+        }   express::log::engine().record( *this, exp->_peer, exp->status, len, process::now() + 1 - exp->_start );
+    }
+
 public: query_t params;
 
-    express_http_t ( http_t& cli ) noexcept : http_t( cli ), exp( new NODE() ) { exp->state = 1; }
-   ~express_http_t () noexcept { if( exp.count() > 1 ){ return; } exp->state=0; free(); }
+    enum SLOT { HOST, ACCEPT_ENCODING, CONTENT_LENGTH, CONTENT_TYPE, RANGE };
+
+    express_http_t ( http_t& cli ) noexcept : http_t( cli ), exp( new NODE() ) { exp->state = 1; exp->_heap = _express_::heap_count() + 1;
+        if( express::log::engine().is_enabled() ){ exp->_start = process::now() + 1; exp->_peer = get_peername(); } }
+   ~express_http_t () noexcept { if( exp.count() > 1 ){ return; } exp->state=0;
+                                 express::wheel::engine().cancel( exp->_deadline );
+                         if( exp->_admit ){ express::shed::engine().leave(); }
+                         if( exp->_start ){ logged(); } free();
+                         if( exp->_heap  ){ _express_::arena_t<NODE>::measure( exp->_heap - 1 ); }
+                         forEach( item, exp->_defer ){ express::defer::add( item ); } }
     express_http_t () noexcept : exp( new NODE() ) { exp->state = 0; }
 
     /*.........................................................................*/
@@ -288,6 +358,86 @@ public: query_t params;
     bool is_express_available() const noexcept { return exp->state >  0; }
     bool is_express_closed()    const noexcept { return exp->state <= 0; }
 
+    /* closes the connection `ms` from now unless it is already gone, see
+       express/wheel.h; 0 disarms it. */
+    const express_http_t& set_deadline( ulong ms ) const noexcept {
+        express::wheel::engine().cancel( exp->_deadline ); exp->_deadline = nullptr;
+        if( ms > 0 ){ exp->_deadline = express::wheel::deadline( (const http_t&)(*this), ms ); }
+        return (*this);
+    }
+
+    /* request headers the server itself reads on every response; each is
+       looked up once and then served from its slot. */
+    const string_t& get_header( SLOT id ) const noexcept {
+        static const char* name[] = { "Host", "Accept-Encoding", "Content-Length", "Content-Type", "Range" };
+        if( exp->_slots & ( 1u << id ) ){ return exp->_slot[id]; } exp->_slots |= 1u << id;
+        if( headers.has( name[id] ) ){ exp->_slot[id] = headers[ name[id] ]; }
+        return exp->_slot[id];
+    }
+
+    bool accepts_gzip() const noexcept {
+        if( exp->_gzip < 0 ){ exp->_gzip = regex::test( get_header( ACCEPT_ENCODING ), "gzip" ); }
+        return exp->_gzip;
+    }
+
+    /*.........................................................................*/
+
+    /* incoming cookies, parsed on first use into a flat list; the cookie()
+       setter below only concerns the response. */
+    const array_t<string_t>& get_cookies() const noexcept {
+        if( !exp->_parsed ){ exp->_parsed = 1; if( headers.has( "Cookie" ) )
+          { parse_cookies( headers["Cookie"], exp->_cookie ); }
+        }  return exp->_cookie;
+    }
+
+    string_t get_cookie( const string_t& name ) const noexcept {
+        auto& y = get_cookies(); for( ulong x=0; x+1<y.size(); x+=2 )
+            { if( y[x] == name ){ return y[x+1]; } }
+        return nullptr;
+    }
+
+    bool has_cookie( const string_t& name ) const noexcept {
+        auto& y = get_cookies(); for( ulong x=0; x+1<y.size(); x+=2 )
+            { if( y[x] == name ){ return true; } }
+        return false;
+    }
+
+    /*.........................................................................*/
+
+    /* runs `cb` in the background once the response has been fully written
+       and the connection released, see express/defer.h */
+    const express_http_t& defer( function_t<void> cb ) const noexcept {
+        exp->_defer.push( cb ); return (*this);
+    }
+
+    /* counts this request as in flight until its last copy is gone. */
+    void track() const noexcept {
+        if( exp->_admit ){ return; } exp->_admit = 1; express::shed::engine().enter();
+    }
+
+    /* a request turned into a websocket or an event stream holds its
+       connection on purpose, it no longer counts as in flight */
+    void untrack() const noexcept {
+        if( !exp->_admit ){ return; } exp->_admit = 0; express::shed::engine().leave();
+    }
+
+    /* express::shed is asked once per request, with the priority of the
+       first route that answers it; later routes share the verdict */
+    bool admitted( uint priority ) const noexcept {
+        if( exp->_gate < 0 ){ exp->_gate = express::shed::engine().admit( priority ); } return exp->_gate;
+    }
+
+    static express_alloc_t get_alloc() noexcept { return express::arena::stats<NODE>(); }
+
+    /*.........................................................................*/
+
+    /* path segments shared by every route tested against this request; they
+       are split again only when a middleware rewrites the path. */
+    const array_t<string_t>& get_parts() const noexcept {
+        if( exp->_split != path ){ exp->_split = path; exp->_parts = string::split( path, '/' ); }
+        return exp->_parts;
+    }
+
     /*.........................................................................*/
 
     promise_t<object_t,except_t> parse_stream() const noexcept {
@@ -332,7 +482,7 @@ public: query_t params;
      const express_http_t& send( string_t msg ) const noexcept {
         if( exp->state == 0 ){ return (*this); }
         header( "Content-Length", string::to_string(msg.size()) );
-        if( regex::test( headers["Accept-Encoding"], "gzip" ) && msg.size()>UNBFF_SIZE ){
+        if( accepts_gzip() && msg.size()>UNBFF_SIZE ){
             header( "Content-Encoding", "gzip" ); send();
             write( zlib::gzip::get( msg ) ); close();
         } else {
@@ -341,23 +491,50 @@ public: query_t params;
     }
 
     const express_http_t& sendFile( string_t dir ) const noexcept {
-        if( exp->state == 0 ){ return (*this); } if( fs::exists_file( dir ) == false )
-          { status(404).send("file does not exist"); } file_t file ( dir, "r" );
-            header( "Content-Length", string::to_string(file.size()) );
+        if( exp->state == 0 ){ return (*this); } auto fd = express::fd::cache().get( dir );
+        if( fd == nullptr ){ status(404).send("file does not exist"); return (*this); }
             header( "Content-Type", path::mimetype(dir) );
-        if( regex::test( headers["Accept-Encoding"], "gzip" ) ){
+        if( accepts_gzip() ){
+        if( fd->size <= CHUNK_MB(1) ){ send( express::fd::read( fd, 0, fd->size ) ); return (*this); }
+            file_t file ( dir, "r" );
+            header( "Content-Length", string::to_string(file.size()) );
             header( "Content-Encoding", "gzip" ); send();
             zlib::gzip::pipe( file, *this );
         } else {
-            send(); stream::pipe( file, *this );
+            sendFd( fd, 0, fd->size );
         }   exp->state = 0; return (*this);
     }
 
+    const express_http_t& sendFd( ptr_t<express_fd_t> fd, ulong from, ulong to ) const noexcept {
+        if( exp->state == 0 ){ return (*this); } if( to < from ){ to = from; }
+        header( "Content-Length", string::to_string( to - from ) ); send();
+        if( express::aio::engine().is_enabled() ){ express::aio::pipe( fd, *this, from, to ); }
+        else                                     { express::fd::pipe ( fd, *this, from, to ); }
+        exp->state = 0; return (*this);
+    }
+
     const express_http_t& sendJSON( object_t json ) const noexcept {
         if( exp->state == 0 ){ return (*this); } auto data = json::stringify(json);
-        header( "content-length", string::to_string(data.size()) );
-        header( "content-type", path::mimetype(".json") );
-        send( data ); exp->state = 0; return (*this);
+        if( data.size() <= CHUNK_SIZE ){
+            header( "Content-Type", path::mimetype(".json") );
+            send( data ); return (*this);
+        }  auto pos = type::bind( (ulong) 0 );
+        return sendJSONStream([=]( express_json_t& out ){
+            out.raw( data.slice( *pos, *pos + CHUNK_SIZE ) );
+           *pos += CHUNK_SIZE; return *pos < data.size();
+        });
+    }
+
+    /* `gen` is pulled one chunk at a time, see express::json::pipe(); use
+       express::json::rows() to stream an array element by element. */
+    const express_http_t& sendJSONStream( function_t<bool,express_json_t&> gen ) const noexcept {
+        if( exp->state == 0 ){ return (*this); }
+        bool gzip    = accepts_gzip();
+        bool chunked =!regex::test( get_version(), "1\\.0" );
+        header( "Content-Type", path::mimetype(".json") );
+        if( chunked ){ header( "Transfer-Encoding", "chunked" ); }
+        if( gzip    ){ header( "Content-Encoding", "gzip" ); }
+        send(); express::json::pipe( *this, gen, gzip, chunked ); return (*this);
     }
 
     const express_http_t& cache( ulong time ) const noexcept {
@@ -383,10 +560,26 @@ public: query_t params;
         send(); exp->state = 0; return (*this);
     }
 
+    /* uncompressed files are read in the background, see express/aio.h;
+       only the file's set_range(), or what is left past its offset, is sent */
+    const express_http_t& sendStream( file_t file ) const noexcept {
+        if( exp->state == 0 ){ return (*this); }
+        if( accepts_gzip() ){
+            header( "Content-Encoding", "gzip" ); send();
+            zlib::gzip::pipe( file, *this ); return (*this);
+        }
+        if( !express::aio::engine().is_enabled() ){ send(); stream::pipe( file, *this ); return (*this); }
+        int fd = ::dup( file.get_fd() ); if( fd < 0 ){ status(500).send( "file unavailable" ); return (*this); }
+        auto y = ptr_t<express_fd_t>( new express_fd_t() ); y->fd = fd; y->size = file.size();
+        auto rng = file.get_range(); ulong from = file.pos(), to = y->size; // set_range() wins over the offset
+        if( rng[1] != 0 ){ from = rng[0]; to = min( (ulong) rng[1], y->size ); } if( to < from ){ to = from; }
+        send(); express::aio::pipe( y, *this, from, to ); return (*this);
+    }
+
     template< class T >
     const express_http_t& sendStream( T readableStream ) const noexcept {
        if( exp->state == 0 ){ return (*this); }
-       if( regex::test( headers["Accept-Encoding"], "gzip" ) ){
+       if( accepts_gzip() ){
             header( "Content-Encoding", "gzip" ); send();
             zlib::gzip::pipe( readableStream, *this );
         } else { send();
@@ -394,6 +587,15 @@ public: query_t params;
         }   exp->state = 0; return (*this);
     }
 
+    const express_http_t& sendEvents() const noexcept {
+        if( exp->state == 0 ){ return (*this); }
+        header( "Content-Type", "text/event-stream" );
+        header( "Cache-Control", "no-cache" );
+        header( "X-Accel-Buffering", "no" );
+        header( "Connection", "keep-alive" ); untrack();
+        set_timeout( 0 ); set_deadline( 0 ); send(); return (*this);
+    }
+
     const express_http_t& header( header_t headers ) const noexcept {
         if( exp->state == 0 ){ return (*this); }
         forEach( item, headers.data() ){
@@ -418,6 +620,12 @@ public: query_t params;
             exp->status=value; return (*this);
     }
 
+    /* status and size for the access log of a response written around
+       send(), e.g. one relayed straight from an upstream. */
+    const express_http_t& account( uint value, long bytes=-1 ) const noexcept {
+        exp->status = value; exp->_bytes = bytes; return (*this);
+    }
+
     const express_http_t& clear_cookies() const noexcept {
         if( exp->state == 0 ){ return (*this); }
         header( "Clear-Site-Data", "\"cookies\"" );
@@ -443,65 +651,160 @@ public: query_t params;
 namespace nodepp { class express_tcp_t {
 protected:
 
+    struct express_memo_t {
+        string_t          base;
+        string_t          path;
+        string_t          name;     // normalized pattern
+        array_t<string_t> parts;
+        ptr_t<regex_t>    reg ;
+    };
+
     struct express_item_t {
+        ptr_t<express_memo_t> memo;
         optional_t<MIDDL> middleware;
         optional_t<CALBK> callback;
         optional_t<MIMES> router;
         string_t          method;
         string_t          path;
+        bool              nocache = 0;
+        uint              priority= express::shed::NORMAL;
+    };
+
+    typedef decltype( queue_t<express_item_t>().first() ) express_node_t;
+
+    struct express_hit_t {
+        express_node_t node = nullptr;
+        query_t        params;
+        bool           live = 0;    // opted out: evaluate from here on
+    };
+
+    struct express_cache_t {
+        map_t<string_t,array_t<express_hit_t>> list;
+        queue_t<string_t> order;
+        ulong size = 0;             // 0 disables the cache
+        ulong hits = 0;
+        ulong miss = 0;
+        ulong time = 0;             // nanoseconds spent resolving routes
     };
 
     struct NODE {
         queue_t<express_item_t> list;
+        express_memo_t memo;
+        express_cache_t cache;
+        ulong    deadline = 0;
+        optional_t<function_t<bool,http_t>> upgrade;
         agent_t* agent= nullptr;
         string_t path = nullptr;
         tcp_t    fd;
     };  ptr_t<NODE> obj;
 
     void execute( string_t path, express_item_t& data, express_http_t& cli, function_t<void>& next ) const noexcept {
+        if( data.callback.has_value() && !cli.admitted( data.priority ) ){
+            cli.status(503).header( "Retry-After", string::to_string( express::shed::engine().get_retry() ) )
+               .send( "service unavailable" ); return;
+        }
           if( data.middleware.has_value() ){ data.middleware.value()( cli, next ); }
         elif( data.callback.has_value()   ){ data.callback.value()( cli ); next(); }
         elif( data.router.has_value()     ){ data.router.value().run( path, cli ); next(); }
     }
 
-    bool path_match( express_http_t& cli, string_t base, string_t path ) const noexcept {
-        string_t pathname = normalize( base, path );
+    /* patterns are normalized, split and compiled once per mount point
+       instead of once per request. */
+    express_memo_t& memoize( express_memo_t& memo, const string_t& base, const string_t& path ) const noexcept {
+        if( memo.reg != nullptr && memo.base == base && memo.path == path ){ return memo; }
+        memo.base = base; memo.path = path; memo.name = normalize( base, path );
+        memo.parts= string::split( memo.name, '/' );
+        memo.reg  = ptr_t<regex_t>( new regex_t( "^"+memo.name ) ); return memo;
+    }
 
-        array_t<string_t> _path[2] = {
-            string::split( cli.path, '/' ),
-            string::split( pathname, '/' )
-        };
+    bool path_match( express_http_t& cli, string_t base, express_item_t& data, query_t& params ) const noexcept {
+        if( data.memo == nullptr ){ data.memo = ptr_t<express_memo_t>( new express_memo_t() ); }
+        auto& memo = memoize( *data.memo, base, data.path );
+        auto& _path= cli.get_parts();
 
-        if( regex::test( cli.path, "^"+pathname ) ){ return true;  }
-        if( _path[0].size() != _path[1].size() )   { return false; }
+        if( memo.reg->test( cli.path ) )         { return true;  }
+        if( _path.size() != memo.parts.size() ){ return false; }
 
-        for ( ulong x=0; x<_path[0].size(); x++ ){ if( _path[1][x]==nullptr ){ return false; }
-        elif( _path[1][x][0] == ':' ){ if( _path[0][x].empty() ){ return false; }
-              cli.params[_path[1][x].slice(1)] = url::normalize( _path[0][x] ); }
-        elif( _path[1][x].empty()        ){ continue;     }
-        elif( _path[1][x] == "*"         ){ continue;     }
-        elif( _path[1][x] != _path[0][x] ){ return false; }}
+        for ( ulong x=0; x<_path.size(); x++ ){ auto& y = memo.parts[x]; if( y==nullptr ){ return false; }
+        elif( y[0] == ':' ){ if( _path[x].empty() ){ return false; }
+              params[y.slice(1)] = url::normalize( _path[x] ); }
+        elif( y.empty()        ){ continue;     }
+        elif( y == "*"         ){ continue;     }
+        elif( y != _path[x]    ){ return false; }}
 
         return true;
     }
 
-    void run( string_t path, express_http_t& cli ) const noexcept {
+    bool match( express_item_t& data, express_memo_t& root, express_http_t& cli, query_t& params ) const noexcept {
+        return ( data.path=="*" && root.reg->test( cli.path ))
+            || ( data.path=="*" && obj->path.empty() )
+            || ( path_match( cli, root.name, data, params ) );
+    }
 
-        auto n     = obj->list.first();
-        auto _base = normalize( path, obj->path );
+    void scan( express_node_t n, express_memo_t& root, express_http_t& cli ) const noexcept {
         function_t<void> next = [&](){ n = n->next; };
 
         while ( n!=nullptr ) {
             if( !cli.is_available() || cli.is_express_closed() ){ break; }
-            if(( n->data.path=="*" && regex::test( cli.path, "^"+_base ))
-            || ( n->data.path=="*" && obj->path.empty() )
-            || ( path_match( cli, _base, n->data.path ) ) ){
+            if( match( n->data, root, cli, cli.params ) ){
             if ( n->data.method.empty() || n->data.method==cli.method ){
-                 execute( _base, n->data, cli, next );
+                 execute( root.name, n->data, cli, next );
             } else { next(); }
             } else { next(); }
         }
+    }
+
+    ulong nanos() const noexcept {
+        struct timespec ts; clock_gettime( CLOCK_MONOTONIC, &ts );
+        return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+    }
+
+    /* routes matched by (method, mount, path); resolution stops at the first
+       route that opted out, which is then evaluated live for every request. */
+    array_t<express_hit_t> lookup( express_memo_t& root, express_http_t& cli ) const noexcept {
+        auto& c = obj->cache; auto time = nanos();
+        auto key = cli.method + " " + root.name + " " + cli.path;
+
+        if( c.list.has( key ) ){ c.hits++; auto out = c.list[key]; c.time += nanos() - time; return out; }
+
+        array_t<express_hit_t> out; auto n = obj->list.first(); c.miss++;
+        while( n!=nullptr ){ express_hit_t y; y.node = n;
+            if( n->data.nocache ){ y.live = 1; out.push( y ); break; }
+            if( match( n->data, root, cli, y.params ) &&
+              ( n->data.method.empty() || n->data.method==cli.method ) ){ out.push( y ); }
+            n = n->next;
+        }
+
+        while( !c.order.empty() && c.order.size() >= c.size ){
+            c.list.erase( c.order.first()->data ); c.order.shift();
+        }  c.list[key] = out; c.order.push( key );
+
+        c.time += nanos() - time; return out;
+    }
+
+    void run( string_t path, express_http_t& cli ) const noexcept {
+        auto& root = memoize( obj->memo, path, obj->path );
+        if( obj->cache.size == 0 ){ scan( obj->list.first(), root, cli ); return; }
+
+        auto list = lookup( root, cli ); ulong x = 0;
+        function_t<void> next = [&](){ x++; };
+
+        while ( x < list.size() ) {
+            if( !cli.is_available() || cli.is_express_closed() ){ break; }
+            auto& y = list[x]; if( y.live ){ scan( y.node, root, cli ); return; }
+            forEach( item, y.params.data() ){ cli.params[item.first] = item.second; }
+
+            auto pth = cli.path; auto mth = cli.method; auto z = x;
+            execute( root.name, y.node->data, cli, next );
+
+            if( cli.path != pth || cli.method != mth ){ // rewritten: the cached list no longer applies
+                scan( x==z ? y.node : y.node->next, root, cli ); return;
+            }
+        }
+    }
 
+    void push( express_item_t& item ) const noexcept {
+        obj->list.push( item ); clear_cache();
     }
 
     string_t normalize( string_t base, string_t path ) const noexcept {
@@ -522,6 +825,47 @@ public:
 
     /*.........................................................................*/
 
+    /* caches up to `size` (method, path) lookups; 0 turns the cache off. */
+    void set_cache( ulong size ) const noexcept { obj->cache.size = size; clear_cache(); }
+
+    /* total time a request may take before its connection is closed;
+       0, the default, leaves it to the socket timeout. */
+    void set_deadline( ulong ms ) const noexcept { obj->deadline = ms; }
+
+    /* sees every new connection before it is read as HTTP/1.1 and returns
+       true when it took it over, see express::http2::enable(). */
+    void set_upgrade( function_t<bool,http_t> cb ) const noexcept { obj->upgrade = optional_t<function_t<bool,http_t>>(cb); }
+
+    void clear_cache() const noexcept { obj->cache.list.clear(); obj->cache.order.clear(); }
+
+    ulong get_cache_hits() const noexcept { return obj->cache.hits; }
+    ulong get_cache_miss() const noexcept { return obj->cache.miss; }
+
+    float get_cache_rate() const noexcept { auto all = obj->cache.hits + obj->cache.miss;
+        return all==0 ? 0.0f : (float) obj->cache.hits / all;
+    }
+
+    /* average route resolution time in nanoseconds. */
+    ulong get_lookup_time() const noexcept { auto all = obj->cache.hits + obj->cache.miss;
+        return all==0 ? 0 : obj->cache.time / all;
+    }
+
+    /* admission priority of the last registered route, see express/shed.h */
+    const express_tcp_t& priority( uint level ) const noexcept {
+        if( !obj->list.empty() ){ obj->list.last()->data.priority = level; }
+        return (*this);
+    }
+
+    /* marks the last registered route as uncacheable, e.g. a middleware
+       whose effect depends on headers: it and everything after it are
+       evaluated for every request. */
+    const express_tcp_t& no_cache() const noexcept {
+        if( !obj->list.empty() ){ obj->list.last()->data.nocache = 1; }
+        clear_cache(); return (*this);
+    }
+
+    /*.........................................................................*/
+
     bool is_closed() const noexcept { return obj->fd.is_closed(); }
     void     close() const noexcept { obj->fd.close(); }
     tcp_t   get_fd() const noexcept { return obj->fd; }
@@ -533,7 +877,7 @@ public:
         item.path     = _path.empty() ? "*" : _path;
         item.method   = _method;
         item.callback = cb;
-        obj->list.push( item ); return (*this);
+        push( item ); return (*this);
     }
 
     const express_tcp_t& RAW( string_t _method, CALBK cb ) const noexcept {
@@ -552,7 +896,7 @@ public:
         item.method     = nullptr;
         item.path       = "*";
         item.router     = optional_t<MIMES>(cb);
-        obj->list.push( item ); return (*this);
+        push( item ); return (*this);
     }
 
     const express_tcp_t& USE( express_tcp_t cb ) const noexcept {
@@ -566,7 +910,7 @@ public:
         item.path       = _path.empty() ? "*" : _path;
         item.middleware = optional_t<MIDDL>(cb);
         item.method     = nullptr;
-        obj->list.push( item ); return (*this);
+        push( item ); return (*this);
     }
 
     const express_tcp_t& USE( MIDDL cb ) const noexcept {
@@ -685,14 +1029,37 @@ public:
 
     /*.........................................................................*/
 
+    /* `cb` takes an express_ws_t<express_http_t>; routes using it need express/ws.h */
+    template< class F, class V=express_http_t >
+    const express_tcp_t& WS( string_t _path, F cb ) const noexcept {
+        return RAW( "GET", _path, [=]( V& cli ){
+            auto ws = express::ws::upgrade( cli );
+            if ( ws.is_closed() ){ return; } cb( ws );
+        });
+    }
+
+    /*.........................................................................*/
+
+    void emit( http_t cli ) const noexcept {
+        express_http_t res(cli); if( cli.headers.has("Params") ){
+            res.params= query::parse( cli.headers["Params"] );
+        }   if( obj->deadline > 0 ){ res.set_deadline( obj->deadline ); }
+             if( express::shed::engine().is_enabled() ){ res.track(); }
+             run( nullptr, res );
+    }
+
+    /* runs this route table for a request accepted by another router. */
+    void dispatch( express_http_t& cli ) const noexcept { run( nullptr, cli ); }
+
+    /*.........................................................................*/
+
     template<class... T>
     tcp_t& listen( const T&... args ) const noexcept {
         auto self = type::bind( this );
 
         function_t<void,http_t> cb = [=]( http_t cli ){
-            express_http_t res(cli); if( cli.headers.has("Params") ){
-                res.params= query::parse( cli.headers["Params"] );
-            }   self->run( nullptr, res );
+            if( self->obj->upgrade.has_value() && self->obj->upgrade.value()( cli ) ){ return; }
+            self->emit( cli );
         };
 
         obj->fd=http::server( cb, obj->agent );
@@ -727,7 +1094,7 @@ namespace nodepp { namespace express { namespace http {
                 dir = path::join( base, "404.html" ); cli.status(404);
             } else { cli.status(404).send("Oops 404 Error"); return; } }
 
-            if( !cli.headers.has("Range") ){
+            if( cli.get_header( express_http_t::RANGE ).empty() ){
 
                 if( regex::test(path::mimetype(dir),"audio|video",true) ){ cli.send(); return; }
                 if( regex::test(path::mimetype(dir),"html",true) ){ cli.render(dir); } else {
@@ -735,19 +1102,23 @@ namespace nodepp { namespace express { namespace http {
 			        cli.sendFile( dir );
                 }
 
-            } else { auto str = fs::readable( dir );
+            } else { auto str = express::fd::cache().get( dir );
+                if( str == nullptr ){ cli.status(404).send("not_found"); return; }
 
-                array_t<string_t> range = regex::match_all(cli.headers["Range"],"\\d+",true);
+                array_t<string_t> range = regex::match_all(cli.get_header( express_http_t::RANGE ),"\\d+",true);
+                if( range.empty() || string::to_ulong( range[0] ) >= str->size ){
+                    cli.header( "Content-Range", string::format( "bytes */%lu", str->size ) );
+                    cli.status(416).send( "range not satisfiable" ); return;
+                }
                    ulong rang[3]; rang[0] = string::to_ulong( range[0] );
-                         rang[1] =min(rang[0]+CHUNK_MB(10),str.size()-1);
-                         rang[2] =min(rang[0]+CHUNK_MB(10),str.size()  );
+                         rang[1] =min(rang[0]+CHUNK_MB(10),str->size-1);
+                         rang[2] =min(rang[0]+CHUNK_MB(10),str->size  );
 
-                cli.header( "Content-Range", string::format("bytes %lu-%lu/%lu",rang[0],rang[1],str.size()) );
+                cli.header( "Content-Range", string::format("bytes %lu-%lu/%lu",rang[0],rang[1],str->size) );
                 cli.header( "Content-Type",  path::mimetype(dir) ); cli.header( "Accept-Range", "bytes" );
                 cli.header( "Cache-Control", "public, max-age=604800" );
 
-                str.set_range( rang[0], rang[2] );
-                cli.status(206).sendStream( str );
+                cli.status(206).sendFd( str, rang[0], rang[2] );
 
             }
         });
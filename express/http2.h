@@ -0,0 +1,863 @@
+/*
+ * Copyright 2023 The Nodepp Project Authors. All Rights Reserved.
+ *
+ * Licensed under the MIT (the "License").  You may not use
+ * this file except in compliance with the License.  You can obtain a copy
+ * in the file LICENSE in the source distribution or at
+ * https://github.com/NodeppOficial/nodepp/blob/main/LICENSE
+ */
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#ifndef NODEPP_EXPRESS_HTTP2
+#define NODEPP_EXPRESS_HTTP2
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#include <nodepp/nodepp.h>
+#include <nodepp/stream.h>
+#include <nodepp/http.h>
+#include <nodepp/url.h>
+#include <express/https.h>
+
+#include <sys/socket.h>
+#include <fcntl.h>
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+namespace nodepp { namespace _http2_ {
+
+    enum FRAME {
+        FRAME_DATA         = 0x0, FRAME_HEADERS = 0x1, FRAME_PRIORITY = 0x2,
+        FRAME_RST_STREAM   = 0x3, FRAME_SETTINGS= 0x4, FRAME_PUSH     = 0x5,
+        FRAME_PING         = 0x6, FRAME_GOAWAY  = 0x7, FRAME_WINDOW   = 0x8,
+        FRAME_CONTINUATION = 0x9
+    };
+
+    enum FLAG {
+        FLAG_END_STREAM = 0x01, FLAG_ACK     = 0x01, FLAG_END_HEADERS = 0x04,
+        FLAG_PADDED     = 0x08, FLAG_PRIORITY= 0x20
+    };
+
+    enum ERROR {
+        ERROR_NONE     = 0x0, ERROR_PROTOCOL = 0x1, ERROR_INTERNAL   = 0x2,
+        ERROR_FLOW     = 0x3, ERROR_CLOSED   = 0x5, ERROR_FRAME_SIZE = 0x6,
+        ERROR_REFUSED  = 0x7, ERROR_CANCEL   = 0x8, ERROR_COMPRESSION= 0x9,
+        ERROR_CALM     = 0xb
+    };
+
+    static const ulong MAX_FRAME  = 16384;
+    static const ulong MAX_STREAM = 100;
+    static const long  MAX_WINDOW = 2147483647;
+    static const ulong MAX_HEADER = 65536;  // header block, SETTINGS_MAX_HEADER_LIST_SIZE
+    static const ulong MAX_RESET  = 100;    // streams the client may cancel per RESET_SPAN
+    static const ulong RESET_SPAN = 10000;  // ms
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+    static const char* STATIC_TABLE[61][2] = {
+        { ":authority"                  , ""               },
+        { ":method"                     , "GET"            },
+        { ":method"                     , "POST"           },
+        { ":path"                       , "/"              },
+        { ":path"                       , "/index.html"    },
+        { ":scheme"                     , "http"           },
+        { ":scheme"                     , "https"          },
+        { ":status"                     , "200"            },
+        { ":status"                     , "204"            },
+        { ":status"                     , "206"            },
+        { ":status"                     , "304"            },
+        { ":status"                     , "400"            },
+        { ":status"                     , "404"            },
+        { ":status"                     , "500"            },
+        { "accept-charset"              , ""               },
+        { "accept-encoding"             , "gzip, deflate"  },
+        { "accept-language"             , ""               },
+        { "accept-ranges"               , ""               },
+        { "accept"                      , ""               },
+        { "access-control-allow-origin" , ""               },
+        { "age"                         , ""               },
+        { "allow"                       , ""               },
+        { "authorization"               , ""               },
+        { "cache-control"               , ""               },
+        { "content-disposition"         , ""               },
+        { "content-encoding"            , ""               },
+        { "content-language"            , ""               },
+        { "content-length"              , ""               },
+        { "content-location"            , ""               },
+        { "content-range"               , ""               },
+        { "content-type"                , ""               },
+        { "cookie"                      , ""               },
+        { "date"                        , ""               },
+        { "etag"                        , ""               },
+        { "expect"                      , ""               },
+        { "expires"                     , ""               },
+        { "from"                        , ""               },
+        { "host"                        , ""               },
+        { "if-match"                    , ""               },
+        { "if-modified-since"           , ""               },
+        { "if-none-match"               , ""               },
+        { "if-range"                    , ""               },
+        { "if-unmodified-since"         , ""               },
+        { "last-modified"               , ""               },
+        { "link"                        , ""               },
+        { "location"                    , ""               },
+        { "max-forwards"                , ""               },
+        { "proxy-authenticate"          , ""               },
+        { "proxy-authorization"         , ""               },
+        { "range"                       , ""               },
+        { "referer"                     , ""               },
+        { "refresh"                     , ""               },
+        { "retry-after"                 , ""               },
+        { "server"                      , ""               },
+        { "set-cookie"                  , ""               },
+        { "strict-transport-security"   , ""               },
+        { "transfer-encoding"           , ""               },
+        { "user-agent"                  , ""               },
+        { "vary"                        , ""               },
+        { "via"                         , ""               },
+        { "www-authenticate"            , ""               }
+    };
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+    static const uint HUFF_CODE[257] = {
+        0x00001ff8, 0x007fffd8, 0x0fffffe2, 0x0fffffe3, 0x0fffffe4, 0x0fffffe5,
+        0x0fffffe6, 0x0fffffe7, 0x0fffffe8, 0x00ffffea, 0x3ffffffc, 0x0fffffe9,
+        0x0fffffea, 0x3ffffffd, 0x0fffffeb, 0x0fffffec, 0x0fffffed, 0x0fffffee,
+        0x0fffffef, 0x0ffffff0, 0x0ffffff1, 0x0ffffff2, 0x3ffffffe, 0x0ffffff3,
+        0x0ffffff4, 0x0ffffff5, 0x0ffffff6, 0x0ffffff7, 0x0ffffff8, 0x0ffffff9,
+        0x0ffffffa, 0x0ffffffb, 0x00000014, 0x000003f8, 0x000003f9, 0x00000ffa,
+        0x00001ff9, 0x00000015, 0x000000f8, 0x000007fa, 0x000003fa, 0x000003fb,
+        0x000000f9, 0x000007fb, 0x000000fa, 0x00000016, 0x00000017, 0x00000018,
+        0x00000000, 0x00000001, 0x00000002, 0x00000019, 0x0000001a, 0x0000001b,
+        0x0000001c, 0x0000001d, 0x0000001e, 0x0000001f, 0x0000005c, 0x000000fb,
+        0x00007ffc, 0x00000020, 0x00000ffb, 0x000003fc, 0x00001ffa, 0x00000021,
+        0x0000005d, 0x0000005e, 0x0000005f, 0x00000060, 0x00000061, 0x00000062,
+        0x00000063, 0x00000064, 0x00000065, 0x00000066, 0x00000067, 0x00000068,
+        0x00000069, 0x0000006a, 0x0000006b, 0x0000006c, 0x0000006d, 0x0000006e,
+        0x0000006f, 0x00000070, 0x00000071, 0x00000072, 0x000000fc, 0x00000073,
+        0x000000fd, 0x00001ffb, 0x0007fff0, 0x00001ffc, 0x00003ffc, 0x00000022,
+        0x00007ffd, 0x00000003, 0x00000023, 0x00000004, 0x00000024, 0x00000005,
+        0x00000025, 0x00000026, 0x00000027, 0x00000006, 0x00000074, 0x00000075,
+        0x00000028, 0x00000029, 0x0000002a, 0x00000007, 0x0000002b, 0x00000076,
+        0x0000002c, 0x00000008, 0x00000009, 0x0000002d, 0x00000077, 0x00000078,
+        0x00000079, 0x0000007a, 0x0000007b, 0x00007ffe, 0x000007fc, 0x00003ffd,
+        0x00001ffd, 0x0ffffffc, 0x000fffe6, 0x003fffd2, 0x000fffe7, 0x000fffe8,
+        0x003fffd3, 0x003fffd4, 0x003fffd5, 0x007fffd9, 0x003fffd6, 0x007fffda,
+        0x007fffdb, 0x007fffdc, 0x007fffdd, 0x007fffde, 0x00ffffeb, 0x007fffdf,
+        0x00ffffec, 0x00ffffed, 0x003fffd7, 0x007fffe0, 0x00ffffee, 0x007fffe1,
+        0x007fffe2, 0x007fffe3, 0x007fffe4, 0x001fffdc, 0x003fffd8, 0x007fffe5,
+        0x003fffd9, 0x007fffe6, 0x007fffe7, 0x00ffffef, 0x003fffda, 0x001fffdd,
+        0x000fffe9, 0x003fffdb, 0x003fffdc, 0x007fffe8, 0x007fffe9, 0x001fffde,
+        0x007fffea, 0x003fffdd, 0x003fffde, 0x00fffff0, 0x001fffdf, 0x003fffdf,
+        0x007fffeb, 0x007fffec, 0x001fffe0, 0x001fffe1, 0x003fffe0, 0x001fffe2,
+        0x007fffed, 0x003fffe1, 0x007fffee, 0x007fffef, 0x000fffea, 0x003fffe2,
+        0x003fffe3, 0x003fffe4, 0x007ffff0, 0x003fffe5, 0x003fffe6, 0x007ffff1,
+        0x03ffffe0, 0x03ffffe1, 0x000fffeb, 0x0007fff1, 0x003fffe7, 0x007ffff2,
+        0x003fffe8, 0x01ffffec, 0x03ffffe2, 0x03ffffe3, 0x03ffffe4, 0x07ffffde,
+        0x07ffffdf, 0x03ffffe5, 0x00fffff1, 0x01ffffed, 0x0007fff2, 0x001fffe3,
+        0x03ffffe6, 0x07ffffe0, 0x07ffffe1, 0x03ffffe7, 0x07ffffe2, 0x00fffff2,
+        0x001fffe4, 0x001fffe5, 0x03ffffe8, 0x03ffffe9, 0x0ffffffd, 0x07ffffe3,
+        0x07ffffe4, 0x07ffffe5, 0x000fffec, 0x00fffff3, 0x000fffed, 0x001fffe6,
+        0x003fffe9, 0x001fffe7, 0x001fffe8, 0x007ffff3, 0x003fffea, 0x003fffeb,
+        0x01ffffee, 0x01ffffef, 0x00fffff4, 0x00fffff5, 0x03ffffea, 0x007ffff4,
+        0x03ffffeb, 0x07ffffe6, 0x03ffffec, 0x03ffffed, 0x07ffffe7, 0x07ffffe8,
+        0x07ffffe9, 0x07ffffea, 0x07ffffeb, 0x0ffffffe, 0x07ffffec, 0x07ffffed,
+        0x07ffffee, 0x07ffffef, 0x07fffff0, 0x03ffffee, 0x3fffffff
+    };
+
+    static const uchar HUFF_LEN[257] = {
+        13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+        28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+         6, 10, 10, 12, 13,  6,  8, 11, 10, 10,  8, 11,  8,  6,  6,  6,
+         5,  5,  5,  6,  6,  6,  6,  6,  6,  6,  7,  8, 15,  6, 12, 10,
+        13,  6,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,
+         7,  7,  7,  7,  7,  7,  7,  7,  8,  7,  8, 13, 19, 13, 14,  6,
+        15,  5,  6,  5,  6,  5,  6,  6,  6,  5,  7,  7,  6,  6,  6,  5,
+         6,  7,  6,  5,  5,  6,  7,  7,  7,  7,  7, 15, 11, 14, 13, 28,
+        20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+        24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+        22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+        21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+        26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+        19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+        20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+        26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+        30
+    };
+/*────────────────────────────────────────────────────────────────────────────*/
+
+    /* decoding tree built once from the canonical RFC 7541 code; children
+       are node indexes, leaves are stored as -(symbol+1). */
+    inline short (*huffman_tree())[2] {
+        static short tree[512][2]; static bool ready = false; if( ready ){ return tree; }
+        short size = 1; for( uint sym=0; sym<257; sym++ ){ short node = 0;
+        for( int bit=HUFF_LEN[sym]-1; bit>=0; bit-- ){
+             uchar  y = ( HUFF_CODE[sym] >> bit ) & 1;
+             if( bit == 0 ){ tree[node][y] = -(short)( sym + 1 ); break; }
+             if( tree[node][y] == 0 ){ tree[node][y] = size++; }
+             node = tree[node][y];
+        }}   ready = true; return tree;
+    }
+
+    inline bool huffman( const uchar* data, ulong len, string_t& out ) {
+        auto tree = huffman_tree(); short node = 0; uint pad = 0; bool ones = true;
+        for( ulong x=0; x<len; x++ ){ for( int bit=7; bit>=0; bit-- ){
+             uchar  y = ( data[x] >> bit ) & 1; short nxt = tree[node][y];
+             if( nxt == 0 ){ return false; } if( nxt < 0 ){
+             if( nxt == -257 ){ return false; } // EOS inside a string
+                 out.push( (char)( -nxt - 1 ) ); node = 0; pad = 0; ones = true;
+             } else { node = nxt; pad++; ones = ones && y; }
+        }}   return pad < 8 && ones;
+    }
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+    inline bool integer( const uchar* data, ulong len, ulong& pos, uint prefix, ulong& out ) {
+        if( pos >= len ){ return false; } ulong mask = ( 1UL << prefix ) - 1;
+        out = data[pos++] & mask; if( out < mask ){ return true; }
+        for( uint m=0; pos<len && m<=28; m+=7 ){ uchar y = data[pos++];
+             out += (ulong)( y & 0x7f ) << m; if( !( y & 0x80 ) ){ return true; }
+        }    return false;
+    }
+
+    inline void integer( string_t& out, uchar flag, uint prefix, ulong value ) {
+        ulong mask = ( 1UL << prefix ) - 1;
+        if( value < mask ){ out.push( (char)( flag | value ) ); return; }
+        out.push( (char)( flag | mask ) ); value -= mask;
+        while( value >= 128 ){ out.push( (char)( ( value & 0x7f ) | 0x80 ) ); value >>= 7; }
+        out.push( (char) value );
+    }
+
+    inline bool literal( const uchar* data, ulong len, ulong& pos, string_t& out ) {
+        if( pos >= len ){ return false; } bool huff = data[pos] & 0x80; ulong size = 0;
+        if( !integer( data, len, pos, 7, size ) || size > len - pos ){ return false; }
+        if( huff ){ out = string_t(); if( !huffman( data+pos, size, out ) ){ return false; } }
+        else      { out = string_t( (char*) data+pos, size ); }
+        pos += size; return true;
+    }
+
+    inline void literal( string_t& out, const string_t& value ) {
+        integer( out, 0x00, 7, value.size() ); out += value;
+    }
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+class hpack_t {
+protected:
+
+    struct ENTRY {
+        string_t name;
+        string_t value;
+    };
+
+    struct NODE {
+        array_t<ENTRY> table;
+        ulong size  = 0;
+        ulong max   = 4096;
+        ulong limit = 4096; // advertised SETTINGS_HEADER_TABLE_SIZE
+    };  ptr_t<NODE> obj;
+
+    void evict() const noexcept {
+        while( obj->size > obj->max && !obj->table.empty() ){
+            auto y = obj->table[ obj->table.size()-1 ];
+            obj->size -= y.name.size() + y.value.size() + 32;
+            obj->table.pop();
+        }
+    }
+
+    void insert( const string_t& name, const string_t& value ) const noexcept {
+        ENTRY y; y.name = name; y.value = value;
+        obj->size += name.size() + value.size() + 32;
+        obj->table.unshift( y ); evict();
+    }
+
+    bool get( ulong idx, string_t& name, string_t& value ) const noexcept {
+        if( idx == 0 ){ return false; } if( idx <= 61 ){
+            name  = STATIC_TABLE[idx-1][0];
+            value = STATIC_TABLE[idx-1][1]; return true;
+        }   idx -= 62; if( idx >= obj->table.size() ){ return false; }
+            name  = obj->table[idx].name;
+            value = obj->table[idx].value; return true;
+    }
+
+    ulong find( const string_t& name ) const noexcept {
+        for( ulong x=0; x<61; x++ ){
+        if ( name == STATIC_TABLE[x][0] ){ return x+1; }
+        }    return 0;
+    }
+
+public:
+
+    hpack_t() noexcept : obj( new NODE() ) {}
+
+    /*.........................................................................*/
+
+    bool decode( const string_t& block, function_t<void,string_t,string_t> cb ) const noexcept {
+        auto data = (const uchar*) block.get(); ulong len = block.size(), pos = 0;
+
+        while( pos < len ){ uchar y = data[pos]; ulong idx = 0;
+            string_t name, value;
+
+            if( y & 0x80 ){ // indexed field
+                if( !integer( data, len, pos, 7, idx ) ){ return false; }
+                if( !get( idx, name, value ) )          { return false; }
+                cb( name, value ); continue;
+            }
+
+            if( ( y & 0xe0 ) == 0x20 ){ // dynamic table size update
+                if( !integer( data, len, pos, 5, idx ) ){ return false; }
+                if( idx > obj->limit ){ return false; }
+                obj->max = idx; evict(); continue;
+            }
+
+            bool index = ( y & 0xc0 ) == 0x40;
+            if( !integer( data, len, pos, index ? 6 : 4, idx ) ){ return false; }
+
+            if( idx == 0 ){ if( !literal( data, len, pos, name ) ){ return false; } }
+            elif( !get( idx, name, value ) ){ return false; }
+            if( !literal( data, len, pos, value ) ){ return false; }
+
+            if( index ){ insert( name, value ); } cb( name, value );
+        }
+
+        return true;
+    }
+
+    /*.........................................................................*/
+
+    /* responses are encoded as literals without indexing, so the encoder
+       keeps no state and never has to track the peer's table size. */
+    string_t encode( uint status, const header_t& headers ) const noexcept {
+        string_t out; switch( status ){
+            case 200: out.push( (char) 0x88 ); break;
+            case 204: out.push( (char) 0x89 ); break;
+            case 206: out.push( (char) 0x8a ); break;
+            case 304: out.push( (char) 0x8b ); break;
+            case 400: out.push( (char) 0x8c ); break;
+            case 404: out.push( (char) 0x8d ); break;
+            case 500: out.push( (char) 0x8e ); break;
+            default : integer( out, 0x00, 4, 8 );
+                      literal( out, string::to_string( status ) );
+        }
+
+        forEach( item, headers.data() ){
+            auto idx = find( item.first ); integer( out, 0x00, 4, idx );
+            if( idx == 0 ){ literal( out, item.first ); }
+            literal( out, item.second );
+        }
+
+        return out;
+    }
+
+};
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+    inline uint u32( const uchar* data ) {
+        return ( (uint) data[0] << 24 ) | ( (uint) data[1] << 16 ) |
+               ( (uint) data[2] <<  8 ) | ( (uint) data[3] <<  0 ) ;
+    }
+
+    inline void u32( string_t& out, uint value ) {
+        out.push( (char)( value >> 24 ) ); out.push( (char)( value >> 16 ) );
+        out.push( (char)( value >>  8 ) ); out.push( (char)( value >>  0 ) );
+    }
+
+    /* h2 field names are lowercase; handlers look them up as HTTP/1.1
+       writes them, so `accept-encoding` becomes `Accept-Encoding`. */
+    inline string_t capitalize( string_t name ) {
+        bool up = true; for( ulong x=0; x<name.size(); x++ ){
+             if( up && name[x]>='a' && name[x]<='z' ){ name[x] -= 32; }
+             up = name[x] == '-';
+        }    return name;
+    }
+
+    template< class T >
+    bool is_preface( const T& cli ) {
+        return cli.method == "PRI" && cli.path == "*";
+    }
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+template< class T > class session_t {
+protected:
+
+    struct STREAM {
+        uint     id    = 0;
+        int      fd    =-1;    // session end of the stream socket pair
+        long     window= 65535;
+        long     recv  = 65535;  // request bytes the client may still send
+        ulong    credit= 0;      // taken by the handler, not yet given back
+        bool     ended = 0;      // END_STREAM received
+        string_t in;             // request body the handler has not taken yet
+        long     length=-1;    // response bytes left, -1 when unknown
+        bool     head  = 0;    // response head already forwarded
+        bool     eof   = 0;    // handler closed its end
+        bool     done  = 0;    // END_STREAM sent
+        bool     nobody= 0;    // HEAD request
+        bool     chunked=0;    // handler answered with chunked coding
+        long     chunk = -1;   // bytes left in the current chunk, <0 expects a size line
+        socket_t brg;
+        string_t buff;
+        string_t wire;         // chunked bytes not yet decoded
+    };
+
+    struct NODE {
+        T        conn;
+        hpack_t  hpack;
+        map_t<uint,ptr_t<STREAM>> stream;
+        function_t<void,http_t>   cb;
+        string_t buff ;         // inbound bytes not yet framed
+        string_t block;         // header block being assembled
+        uint     block_id = 0;
+        bool     block_end= 0;
+        uint     last     = 0;
+        long     window   = 65535;
+        long     initial  = 65535;
+        long     recv     = 65535;  // connection window the client may still use
+        ulong    credit   = 0;
+        ulong    resets   = 0;      // open streams the client cancelled
+        ulong    since    = 0;      // start of the current RESET_SPAN
+        ulong    frame    = MAX_FRAME;
+        bool     preface  = 0;
+        int      state    = 1;
+    };  ptr_t<NODE> obj;
+
+    /*.........................................................................*/
+
+    void write( uchar type, uchar flag, uint sid, const string_t& data ) const noexcept {
+        if( obj->state <= 0 ){ return; } string_t out; ulong len = data.size();
+        out.push( (char)( len >> 16 ) ); out.push( (char)( len >> 8 ) );
+        out.push( (char)( len >>  0 ) ); out.push( (char) type );
+        out.push( (char) flag );  u32( out, sid & 0x7fffffff );
+        out += data; obj->conn.write( out );
+    }
+
+    void goaway( uint code ) const noexcept {
+        string_t out; u32( out, obj->last ); u32( out, code );
+        write( FRAME_GOAWAY, 0, 0, out ); close();
+    }
+
+    void reset( uint sid, uint code ) const noexcept {
+        string_t out; u32( out, code ); write( FRAME_RST_STREAM, 0, sid, out );
+        if( obj->stream.has( sid ) ){ release( obj->stream[sid] ); }
+    }
+
+    void window( uint sid, uint size ) const noexcept {
+        if( size == 0 ){ return; } string_t out; u32( out, size );
+        write( FRAME_WINDOW, 0, sid, out );
+    }
+
+    /* inbound flow control: window space goes back to the client only
+       as the handler takes the body off the socket pair, so a stalled
+       handler stalls its sender instead of buffering without bound. */
+    void give( ptr_t<STREAM> str, ulong len ) const noexcept {
+        obj->credit += len; if( str != nullptr ){ str->credit += len; }
+        bool idle = str == nullptr || str->in.empty();
+        if( obj->credit > 0 && ( obj->credit >= MAX_FRAME / 2 || idle ) )
+          { window( 0, obj->credit ); obj->recv += obj->credit; obj->credit = 0; }
+        if( str == nullptr || str->credit == 0 || !( str->credit >= MAX_FRAME / 2 || idle ) ){ return; }
+        if( !str->ended ){ window( str->id, str->credit ); str->recv += str->credit; } str->credit = 0;
+    }
+
+    void drain( ptr_t<STREAM> str ) const noexcept {
+        while( str->fd >= 0 && !str->in.empty() ){
+            auto c = ::send( str->fd, str->in.get(), str->in.size(), MSG_NOSIGNAL );
+            if ( c <= 0 ){ break; } str->in = str->in.slice( c ); give( str, c );
+        }
+        if( str->fd >= 0 && str->ended && str->in.empty() ){ ::shutdown( str->fd, SHUT_WR ); }
+    }
+
+    /*.........................................................................*/
+
+    array_t<ptr_t<STREAM>> streams() const noexcept {
+        array_t<ptr_t<STREAM>> out; forEach( item, obj->stream.data() )
+        { out.push( item.second ); } return out;
+    }
+
+    void release( ptr_t<STREAM> str ) const noexcept {
+        if( str->fd < 0 ){ return; } str->done = 1; str->fd = -1;
+        str->brg.close(); obj->stream.erase( str->id );
+    }
+
+    void flush( ptr_t<STREAM> str ) const noexcept {
+        while( !str->done && str->head && !str->buff.empty() ){
+            long len = min( (long) str->buff.size(), (long) obj->frame );
+                 len = min( len, min( obj->window, str->window ) );
+            if ( str->length >= 0 ){ len = min( len, str->length ); }
+            if ( len <= 0 ){ break; }
+
+            auto data = str->buff.slice( 0, len );
+            str->buff = str->buff.slice( len );
+            obj->window -= len; str->window -= len;
+            if( str->length >= 0 ){ str->length -= len; }
+
+            bool end = str->length == 0 || ( str->eof && str->buff.empty() );
+            write( FRAME_DATA, end ? FLAG_END_STREAM : 0, str->id, data );
+            if ( end ){ release( str ); return; }
+        }
+
+        if( !str->done && str->eof ){
+        if( !str->head ){ reset( str->id, ERROR_INTERNAL ); return; }
+        if(  str->buff.empty() ){
+            write( FRAME_DATA, FLAG_END_STREAM, str->id, nullptr );
+            release( str );
+        }}
+    }
+
+    /*.........................................................................*/
+
+    /* HTTP/2 frames the body itself, so chunked coding is undone here;
+       trailers are dropped. */
+    void dechunk( ptr_t<STREAM> str ) const noexcept {
+        while( !str->wire.empty() ){
+            if( str->chunk == -3 ){ str->wire = nullptr; return; }
+            if( str->chunk >  0 ){ ulong len = min( (ulong) str->chunk, str->wire.size() );
+                str->buff += str->wire.slice( 0, len ); str->wire = str->wire.slice( len );
+                str->chunk-= len; if( str->chunk == 0 ){ str->chunk = -2; } continue;
+            }
+
+            auto pos = regex::search( str->wire, "\r\n" ); if( pos.empty() ){ return; }
+            auto line= str->wire.slice( 0, pos[0] ); str->wire = str->wire.slice( pos[0] + 2 );
+            if( str->chunk == -2 ){ str->chunk = -1; continue; }
+
+            long len = 0; for( ulong x=0; x<line.size(); x++ ){ char c = line[x];
+                  if( c>='0' && c<='9' ){ len = len*16 + c - '0'; }
+                elif( ( c|0x20 )>='a' && ( c|0x20 )<='f' ){ len = len*16 + ( c|0x20 ) - 'a' + 10; }
+                else { break; }
+            }   if( len == 0 ){ str->chunk = -3; str->eof = 1; } else { str->chunk = len; }
+        }
+    }
+
+    /* the handler answers in HTTP/1.1 on its end of the socket pair; the
+       status line and headers become a HEADERS frame, the rest DATA. */
+    void respond( ptr_t<STREAM> str, const string_t& data ) const noexcept {
+        if( str->head ){
+            if( str->chunked ){ str->wire += data; dechunk( str ); }
+            else              { str->buff += data; }
+            flush( str ); return;
+        }   str->buff += data;
+
+        auto pos = regex::search( str->buff, "\r\n\r\n" ); if( pos.empty() ){ return; }
+        auto raw = regex::match_all( str->buff.slice( 0, pos[0] ), "[^\r\n]+" );
+        str->buff= str->buff.slice( pos[0] + 4 ); if( raw.empty() ){ return; }
+
+        uint status = string::to_ulong( regex::match( raw[0], "\\d{3}" ) );
+        header_t hdr; for( ulong x=1; x<raw.size(); x++ ){ ulong y=0;
+            while( y<raw[x].size() && raw[x][y] != ':' ){ y++; }
+            if   ( y==raw[x].size() ){ continue; }
+
+            auto name = raw[x].slice( 0, y ).to_lower_case(); y++;
+            while( y<raw[x].size() && raw[x][y] == ' ' ){ y++; }
+            auto  val = raw[x].slice( y );
+
+            if( name=="transfer-encoding" ){ str->chunked = regex::test( val, "chunked", true ); continue; }
+            if( name=="connection" || name=="keep-alive" || name=="upgrade" ||
+                name=="proxy-connection" ){ continue; }
+            if( name=="content-length" ){ str->length = string::to_ulong( val ); }
+            hdr[name] = val;
+        }
+
+        if( str->nobody ){ str->length = 0; }
+        if( str->chunked && !str->nobody ){ str->wire = str->buff; str->buff = nullptr; dechunk( str ); }
+
+        auto blk = obj->hpack.encode( status, hdr ); str->head = 1;
+        uchar end= str->length==0 ? FLAG_END_STREAM : 0; bool first = true;
+
+        do { auto len = min( (ulong) blk.size(), obj->frame );
+             auto chk = blk.slice( 0, len ); blk = blk.slice( len );
+             uchar flg= blk.empty() ? FLAG_END_HEADERS : 0;
+             if( first ){ write( FRAME_HEADERS, flg | end, str->id, chk ); }
+             else       { write( FRAME_CONTINUATION, flg, str->id, chk ); }
+             first = false;
+        } while( !blk.empty() );
+
+        if( end ){ release( str ); return; } flush( str );
+    }
+
+    /*.........................................................................*/
+
+    void open( uint sid, bool end, header_t& hdr, string_t method, string_t path ) const noexcept {
+        if( obj->stream.size() >= MAX_STREAM ){ reset( sid, ERROR_REFUSED ); return; }
+
+        int fd[2]; if( ::socketpair( AF_UNIX, SOCK_STREAM, 0, fd ) != 0 )
+          { reset( sid, ERROR_INTERNAL ); return; }
+
+        for( int x=0; x<2; x++ ){ int size = CHUNK_MB(1);
+             ::fcntl( fd[x], F_SETFL, ::fcntl( fd[x], F_GETFL, 0 ) | O_NONBLOCK );
+             ::setsockopt( fd[x], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size) );
+        }
+
+        auto str = type::bind( STREAM() );
+             str->id     = sid; str->fd = fd[0];
+             str->window = obj->initial;
+             str->nobody = method == "HEAD";
+             str->brg    = socket_t( fd[0] );
+        obj->stream[sid] = str;
+
+        http_t cli ( fd[1] ); ulong idx = 0;
+        while( idx<path.size() && path[idx]!='?' ){ idx++; }
+        cli.method  = method;
+        cli.path    = path.slice( 0, idx );
+        cli.search  = path.slice( idx );
+        cli.query   = query::parse( cli.search );
+        cli.headers = hdr;
+
+        auto self = type::bind( this );
+        auto _read= type::bind( _file_::read() );
+
+        process::poll::add([=](){
+            if( self->obj->state<=0 || str->done ){ return -1; }
+            if( !str->in.empty() ){ self->drain( str ); }
+            if( str->buff.size() >= CHUNK_SIZE * 4 ){ return 1; }
+            if(!str->brg.is_available() ){ str->eof=1; self->flush( str ); return -1; }
+            if((*_read)(&str->brg)==1 )  { return 1; }
+            if(  _read->state<=0 )       { return 1; }
+            self->respond( str, _read->data ); return 1;
+        });
+
+        if( end ){ ::shutdown( fd[0], SHUT_WR ); } obj->cb( cli );
+    }
+
+    void headers() const noexcept {
+        uint sid = obj->block_id; bool end = obj->block_end;
+        obj->block_id = 0; header_t hdr; string_t method, path, authority;
+        bool fail = false;
+
+        bool ok = obj->hpack.decode( obj->block, [&]( string_t name, string_t value ){
+            if( name.empty() ){ fail = true; return; } if( name[0]==':' ){
+                  if( name == ":method"    ){ method    = value; }
+                elif( name == ":path"      ){ path      = value; }
+                elif( name == ":authority" ){ authority = value; }
+                return;
+            }   name = capitalize( name );
+            if( !hdr.has( name ) ){ hdr[name] = value; return; }
+            hdr[name] += name=="Cookie" ? "; " + value : ", " + value;
+        }); obj->block = nullptr;
+
+        if( !ok ){ goaway( ERROR_COMPRESSION ); return; }
+
+        if( obj->stream.has( sid ) ){ // trailers
+            if( end ){ obj->stream[sid]->ended = 1; drain( obj->stream[sid] ); }
+            return;
+        }
+
+        if( sid % 2 == 0 || sid <= obj->last ){ goaway( ERROR_PROTOCOL ); return; }
+        obj->last = sid;
+
+        if( fail || method.empty() || path.empty() ){ reset( sid, ERROR_PROTOCOL ); return; }
+        if( !authority.empty() && !hdr.has("Host") ){ hdr["Host"] = authority; }
+
+        open( sid, end, hdr, method, path );
+    }
+
+    /*.........................................................................*/
+
+    void frame( uchar type, uchar flag, uint sid, string_t data ) const noexcept {
+        auto raw = (const uchar*) data.get(); ulong len = data.size();
+
+        if( obj->block_id != 0 && ( type != FRAME_CONTINUATION || sid != obj->block_id ) )
+          { goaway( ERROR_PROTOCOL ); return; }
+
+        switch( type ){
+
+            case FRAME_DATA: { if( sid == 0 ){ goaway( ERROR_PROTOCOL ); return; }
+                ulong pos = 0, end = len; if( flag & FLAG_PADDED ){
+                if( len == 0 || raw[0] >= len ){ goaway( ERROR_PROTOCOL ); return; }
+                    pos = 1; end = len - raw[0];
+                }   if( (long) len > obj->recv ){ goaway( ERROR_FLOW ); return; } obj->recv -= len;
+
+                if( !obj->stream.has( sid ) ){ give( nullptr, len ); return; } auto str = obj->stream[sid];
+                if( str->ended ){ give( nullptr, len ); reset( sid, ERROR_CLOSED ); return; }
+                if( (long) len > str->recv ){ give( nullptr, len ); reset( sid, ERROR_FLOW ); return; }
+                str->recv -= len; str->in += data.slice( pos, end );
+                if( flag & FLAG_END_STREAM ){ str->ended = 1; }
+                give( str, len - ( end - pos ) ); drain( str ); // padding is given back at once
+            } break;
+
+            case FRAME_HEADERS: { if( sid == 0 ){ goaway( ERROR_PROTOCOL ); return; }
+                ulong pos = 0, end = len; if( flag & FLAG_PADDED ){
+                if( len == 0 || raw[0] >= len ){ goaway( ERROR_PROTOCOL ); return; }
+                    pos = 1; end = len - raw[0];
+                }   if( flag & FLAG_PRIORITY ){ pos += 5; }
+                if( pos > end ){ goaway( ERROR_PROTOCOL ); return; }
+
+                if( end - pos > MAX_HEADER ){ goaway( ERROR_CALM ); return; }
+                obj->block     = data.slice( pos, end );
+                obj->block_id  = sid;
+                obj->block_end = flag & FLAG_END_STREAM;
+                if( flag & FLAG_END_HEADERS ){ headers(); }
+            } break;
+
+            case FRAME_CONTINUATION: {
+                if( obj->block_id == 0 ){ goaway( ERROR_PROTOCOL ); return; }
+                if( obj->block.size() + len > MAX_HEADER ){ goaway( ERROR_CALM ); return; } // CONTINUATION flood
+                obj->block += data; if( flag & FLAG_END_HEADERS ){ headers(); }
+            } break;
+
+            case FRAME_RST_STREAM: { if( len != 4 ){ goaway( ERROR_FRAME_SIZE ); return; }
+                if( !obj->stream.has( sid ) ){ return; } release( obj->stream[sid] );
+                auto now = process::now(); if( now - obj->since > RESET_SPAN ){ obj->since = now; obj->resets = 0; }
+                if( ++obj->resets > MAX_RESET ){ goaway( ERROR_CALM ); return; } // rapid reset
+            } break;
+
+            case FRAME_SETTINGS: { if( sid != 0 ){ goaway( ERROR_PROTOCOL ); return; }
+                if( flag & FLAG_ACK ){ return; }
+                if( len % 6 != 0 ){ goaway( ERROR_FRAME_SIZE ); return; }
+
+                for( ulong x=0; x<len; x+=6 ){
+                     uint key = ( raw[x] << 8 ) | raw[x+1];
+                     uint val = u32( raw + x + 2 );
+
+                     if( key == 0x4 ){ // INITIAL_WINDOW_SIZE
+                     if( val > (uint) MAX_WINDOW ){ goaway( ERROR_FLOW ); return; }
+                         long dif = (long) val - obj->initial; obj->initial = val;
+                         forEach( item, streams() ){ item->window += dif; }
+                     } elif( key == 0x5 ){ // MAX_FRAME_SIZE
+                     if( val < 16384 || val > 16777215 ){ goaway( ERROR_PROTOCOL ); return; }
+                         obj->frame = val;
+                     }
+                }
+
+                write( FRAME_SETTINGS, FLAG_ACK, 0, nullptr );
+                forEach( item, streams() ){ flush( item ); }
+            } break;
+
+            case FRAME_PING: { if( sid != 0 ){ goaway( ERROR_PROTOCOL ); return; }
+                if( len != 8 ){ goaway( ERROR_FRAME_SIZE ); return; }
+                if( !( flag & FLAG_ACK ) ){ write( FRAME_PING, FLAG_ACK, 0, data ); }
+            } break;
+
+            case FRAME_WINDOW: { if( len != 4 ){ goaway( ERROR_FRAME_SIZE ); return; }
+                long inc = u32( raw ) & 0x7fffffff; if( sid == 0 ){
+                if( inc == 0 || obj->window + inc > MAX_WINDOW ){ goaway( ERROR_FLOW ); return; }
+                    obj->window += inc; forEach( item, streams() ){ flush( item ); }
+                } elif( obj->stream.has( sid ) ){ auto str = obj->stream[sid];
+                if( inc == 0 || str->window + inc > MAX_WINDOW ){ reset( sid, ERROR_FLOW ); return; }
+                    str->window += inc; flush( str );
+                }
+            } break;
+
+            case FRAME_GOAWAY: { close(); } break;
+            case FRAME_PUSH  : { goaway( ERROR_PROTOCOL ); } break;
+            default          : break; // PRIORITY and unknown frames are ignored
+
+        }
+    }
+
+    /*.........................................................................*/
+
+    void feed( const string_t& data ) const noexcept {
+        obj->buff += data; if( !obj->preface ){
+            if( obj->buff.size() < 6 ){ return; }
+            if( obj->buff.slice( 0, 6 ) != "SM\r\n\r\n" ){ close(); return; }
+            obj->buff = obj->buff.slice( 6 ); obj->preface = 1;
+        }
+
+        ulong pos = 0; while( obj->state>0 && obj->buff.size() - pos >= 9 ){
+            auto  raw = (const uchar*) obj->buff.get() + pos;
+            ulong len = ( raw[0] << 16 ) | ( raw[1] << 8 ) | raw[2];
+            if( len > MAX_FRAME ){ goaway( ERROR_FRAME_SIZE ); return; }
+            if( obj->buff.size() - pos < 9 + len ){ break; }
+
+            uint sid = u32( raw + 5 ) & 0x7fffffff;
+            auto pay = obj->buff.slice( pos + 9, pos + 9 + len );
+            pos += 9 + len; frame( raw[3], raw[4], sid, pay );
+        }
+
+        if( obj->state > 0 ){ obj->buff = obj->buff.slice( pos ); }
+    }
+
+public:
+
+    session_t( T cli, function_t<void,http_t> cb ) noexcept : obj( new NODE() ) {
+        obj->conn = cli; obj->cb = cb; cli.set_timeout( 0 );
+
+        string_t out; // SETTINGS_MAX_CONCURRENT_STREAMS
+        out.push( 0x00 ); out.push( 0x03 ); u32( out, MAX_STREAM );
+        out.push( 0x00 ); out.push( 0x06 ); u32( out, MAX_HEADER ); // SETTINGS_MAX_HEADER_LIST_SIZE
+        write( FRAME_SETTINGS, 0, 0, out );
+
+        auto self = type::bind( this );
+        auto _read= type::bind( _file_::read() );
+
+        process::poll::add([=](){
+            if( self->obj->state<=0 )  { return -1; }
+            if(!cli.is_available() )   { self->close(); return -1; }
+            if((*_read)(&cli)==1 )     { return 1; }
+            if(  _read->state<=0 )     { return 1; }
+            self->feed( _read->data ); return 1;
+        });
+    }
+
+    session_t() noexcept : obj( new NODE() ) { obj->state = 0; }
+
+    /*.........................................................................*/
+
+    ulong get_streams() const noexcept { return obj->stream.size(); }
+    bool  is_closed()   const noexcept { return obj->state <= 0; }
+
+    void close() const noexcept {
+        if( obj->state <= 0 ){ return; } obj->state = 0;
+        forEach( item, streams() ){ release( item ); }
+        obj->conn.close();
+    }
+
+};
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+    template< class T >
+    session_t<T> server( T cli, function_t<void,http_t> cb ) {
+        return session_t<T>( cli, cb );
+    }
+
+}}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+namespace nodepp { namespace _http2_ {
+
+    inline int alpn( SSL*, const uchar** out, uchar* len, const uchar* inp, uint size, void* ) {
+        static const uchar list[] = "\x02h2\x08http/1.1";
+        if( SSL_select_next_proto( (uchar**) out, len, list, sizeof(list)-1, inp, size )
+         != OPENSSL_NPN_NEGOTIATED ){ return SSL_TLSEXT_ERR_NOACK; }
+        return SSL_TLSEXT_ERR_OK;
+    }
+
+}}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+namespace nodepp { namespace express { namespace http2 {
+
+    /* h2c with prior knowledge on a plain router */
+    inline void enable( const express_tcp_t& app ) {
+        app.set_upgrade( function_t<bool,http_t>([=]( http_t cli ){
+            if( !_http2_::is_preface( cli ) ){ return false; }
+            _http2_::server( cli, function_t<void,http_t>([=]( http_t str ){ app.emit( str ); }) ); return true;
+        }));
+    }
+
+    /* h2 through ALPN on a TLS router. Streams are bridged to plain http_t
+       sockets, which only an express_tcp_t router can serve, so `routes`
+       registers the same table on `tls` and on a plain mirror of it; h2 is
+       only offered for that mirror. `routes` takes either router:
+       `[]( auto& app ){ app.GET( "/", []( auto& cli ){ cli.send("hi"); }); }`.
+       The mirror is returned for settings such as set_deadline(). */
+    template< class F >
+    express_tcp_t enable( const express_tls_t& tls, F routes ) {
+        express_tcp_t app; routes( tls ); routes( app );
+        tls.set_upgrade( function_t<bool,https_t>([=]( https_t cli ){
+            if( !_http2_::is_preface( cli ) ){ return false; }
+            _http2_::server( cli, function_t<void,http_t>([=]( http_t str ){ app.emit( str ); }) ); return true;
+        }), &_http2_::alpn ); return app;
+    }
+
+}}}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#endif
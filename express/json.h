@@ -0,0 +1,199 @@
+/*
+ * Copyright 2023 The Nodepp Project Authors. All Rights Reserved.
+ *
+ * Licensed under the MIT (the "License").  You may not use
+ * this file except in compliance with the License.  You can obtain a copy
+ * in the file LICENSE in the source distribution or at
+ * https://github.com/NodeppOficial/nodepp/blob/main/LICENSE
+ */
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#ifndef NODEPP_EXPRESS_JSON
+#define NODEPP_EXPRESS_JSON
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#include <nodepp/nodepp.h>
+#include <nodepp/stream.h>
+#include <nodepp/json.h>
+#include <zlib.h>
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+namespace nodepp { namespace express { namespace json {
+
+    inline string_t escape( const string_t& data ) {
+        string_t out = "\""; for( ulong x=0; x<data.size(); x++ ){ uchar c = data[x];
+              if( c == '"'  ){ out += "\\\""; }
+            elif( c == '\\' ){ out += "\\\\"; }
+            elif( c == '\n' ){ out += "\\n";  }
+            elif( c == '\r' ){ out += "\\r";  }
+            elif( c == '\t' ){ out += "\\t";  }
+            elif( c <  0x20 ){ out += string::format( "\\u%04x", (uint) c ); }
+            else             { out.push( (char) c ); }
+        }   out += "\""; return out;
+    }
+
+}}}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+/* builds a JSON document piece by piece; commas and nesting are tracked
+   here so generators only say what comes next. take() hands out what has
+   been written so far. */
+
+namespace nodepp { class express_json_t {
+protected:
+
+    struct NODE {
+        string_t       buff;
+        array_t<ulong> level;       // values written at each depth
+        bool           key = 0;     // a key is waiting for its value
+    };  ptr_t<NODE> obj;
+
+    void next() const noexcept {
+        if( obj->key ){ obj->key = 0; return; }
+        if( obj->level.empty() ){ return; } auto& y = obj->level[ obj->level.size()-1 ];
+        if( y++ > 0 ){ obj->buff.push( ',' ); }
+    }
+
+    const express_json_t& open( char c ) const noexcept {
+        next(); obj->buff.push( c ); obj->level.push( 0 ); return (*this);
+    }
+
+    const express_json_t& close( char c ) const noexcept {
+        if( !obj->level.empty() ){ obj->level.pop(); }
+        obj->buff.push( c ); return (*this);
+    }
+
+public:
+
+    express_json_t() noexcept : obj( new NODE() ) {}
+
+    /*.........................................................................*/
+
+    const express_json_t& begin_array()  const noexcept { return open ( '[' ); }
+    const express_json_t& end_array()    const noexcept { return close( ']' ); }
+    const express_json_t& begin_object() const noexcept { return open ( '{' ); }
+    const express_json_t& end_object()   const noexcept { return close( '}' ); }
+
+    const express_json_t& key( const string_t& name ) const noexcept {
+        next(); obj->buff += express::json::escape( name );
+        obj->buff.push( ':' ); obj->key = 1; return (*this);
+    }
+
+    /*.........................................................................*/
+
+    /* an already serialized fragment */
+    const express_json_t& raw( const string_t& data ) const noexcept {
+        next(); obj->buff += data; return (*this);
+    }
+
+    const express_json_t& value( const string_t& data ) const noexcept { return raw( express::json::escape( data ) ); }
+    const express_json_t& value( const char* data )     const noexcept { return value( string_t( data ) ); }
+    const express_json_t& value( const object_t& data ) const noexcept { return raw( nodepp::json::stringify( data ) ); }
+    const express_json_t& value( bool data )            const noexcept { return raw( data ? "true" : "false" ); }
+    const express_json_t& value( double data )          const noexcept { return raw( string::to_string( data ) ); }
+    const express_json_t& value( long data )            const noexcept { return raw( string::to_string( data ) ); }
+    const express_json_t& value( ulong data )           const noexcept { return raw( string::to_string( data ) ); }
+    const express_json_t& value( int data )             const noexcept { return value( (long) data ); }
+    const express_json_t& null()                        const noexcept { return raw( "null" ); }
+
+    /* sqlite rows and other flat string maps */
+    const express_json_t& value( const map_t<string_t,string_t>& data ) const noexcept {
+        begin_object(); forEach( item, data.data() ){ key( item.first ); value( item.second ); }
+        return end_object();
+    }
+
+    /*.........................................................................*/
+
+    ulong    size() const noexcept { return obj->buff.size(); }
+    string_t take() const noexcept { auto out = obj->buff; obj->buff = nullptr; return out; }
+
+};}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+namespace nodepp { namespace _express_ {
+
+    /* streaming gzip: keeps the deflate window between chunks, so a body
+       is compressed as it is produced instead of after the fact. */
+    struct deflate_t {
+        z_stream strm; bool ok = 0;
+
+        deflate_t() noexcept { memset( &strm, 0, sizeof(strm) );
+            ok = deflateInit2( &strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY ) == Z_OK;
+        }
+
+       ~deflate_t() noexcept { if( ok ){ deflateEnd( &strm ); } }
+        deflate_t( const deflate_t& ) = delete;
+
+        string_t push( const string_t& data, bool end ) noexcept {
+            string_t out; if( !ok ){ return out; } ptr_t<char> buf ( CHUNK_SIZE, '\0' );
+            strm.next_in  = (Bytef*) data.get(); strm.avail_in = data.size();
+            int ret; do {
+                strm.next_out = (Bytef*) buf.get(); strm.avail_out = CHUNK_SIZE;
+                ret = deflate( &strm, end ? Z_FINISH : Z_NO_FLUSH );
+                out += string_t( buf.get(), CHUNK_SIZE - strm.avail_out );
+            } while( strm.avail_out == 0 || ( end && ret == Z_OK ) );
+            return out;
+        }
+    };
+
+    inline string_t chunk( const string_t& data ) {
+        if( data.empty() ){ return data; }
+        return string::format( "%lx\r\n", (ulong) data.size() ) + data + "\r\n";
+    }
+
+}}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+namespace nodepp { namespace express { namespace json {
+
+    /* pulls from `gen` until about `size` bytes are buffered, writes them
+       and only then asks for more: peak memory is one chunk (plus the
+       deflate window), whatever the size of the document. `gen` returns
+       false once the document is complete. */
+    template< class T >
+    void pipe( const T& cli, function_t<bool,express_json_t&> gen, bool gzip, bool chunked, ulong size=CHUNK_SIZE ) {
+        auto out  = type::bind( express_json_t() );
+        auto wrt  = type::bind( _file_::write() );
+        auto data = type::bind( string_t() );
+        ptr_t<_express_::deflate_t> zip;
+        if( gzip ){ zip = ptr_t<_express_::deflate_t>( new _express_::deflate_t() ); }
+        auto end  = type::bind( (bool) 0 );
+        auto done = type::bind( (bool) 0 );
+
+        process::poll::add([=](){
+            if( !cli.is_available() ){ return -1; }
+            if( data->empty() ){ if( *done ){ return -1; }
+                while( !*end && out->size() < size ){ if( !gen( *out ) ){ *end = 1; } }
+                auto raw = out->take(); if( gzip ){ raw = zip->push( raw, *end ); }
+                *data = chunked ? _express_::chunk( raw ) : raw;
+                if( *end ){ *done = 1; if( chunked ){ *data += "0\r\n\r\n"; } }
+                if( data->empty() ){ return 1; }
+            }
+            if((*wrt)( &cli, *data )==1 ){ return 1; }
+            if(  wrt->state <= 0 ){ return -1; }
+           *data = nullptr; return 1;
+        });
+    }
+
+    /* one element per pull: the array is never serialized as a whole. */
+    template< class V >
+    function_t<bool,express_json_t&> rows( array_t<V> list ) {
+        auto pos = type::bind( (ulong) 0 );
+        return [=]( express_json_t& out ){
+            if( *pos == 0 ){ out.begin_array(); }
+            if( *pos >= list.size() ){ out.end_array(); return false; }
+            out.value( list[ (*pos)++ ] ); return true;
+        };
+    }
+
+}}}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#endif
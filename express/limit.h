@@ -0,0 +1,190 @@
+/*
+ * Copyright 2023 The Nodepp Project Authors. All Rights Reserved.
+ *
+ * Licensed under the MIT (the "License").  You may not use
+ * this file except in compliance with the License.  You can obtain a copy
+ * in the file LICENSE in the source distribution or at
+ * https://github.com/NodeppOficial/nodepp/blob/main/LICENSE
+ */
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#ifndef NODEPP_EXPRESS_LIMIT
+#define NODEPP_EXPRESS_LIMIT
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#include <nodepp/nodepp.h>
+#include <nodepp/mutex.h>
+
+#include <atomic>
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#ifndef NODEPP_EXPRESS_LIMIT_CONFIG
+#define NODEPP_EXPRESS_LIMIT_CONFIG
+namespace nodepp { struct express_limit_config_t {
+    string_t header  = nullptr;           // key header, peername when empty
+    string_t message = "Too Many Requests";
+    double   rate    = 10;                // tokens refilled per second
+    uint     burst   = 20;                // bucket capacity
+    ulong    size    = 65536;             // total slots across all shards
+    uint     shard   = 16;                // number of shards
+    uint     probe   = 8;                 // slots scanned per lookup
+    ulong    idle    = TIME_SECONDS(60);  // idle buckets are reclaimed
+    uint     status  = 429;
+    bool     headers = true;              // emit RateLimit-* headers
+};}
+#endif
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+namespace nodepp { class express_limit_t {
+protected:
+
+    struct SLOT {
+        ulong hash = 0;
+        ulong last = 0;
+        float token= 0;
+    };
+
+    struct SHARD {
+        ptr_t<SLOT> slot;
+        mutex_t     mtx ;
+    };
+
+    struct NODE {
+        express_limit_config_t cfg;
+        ptr_t<SHARD> shard;
+        ulong mask   = 0;
+        std::atomic<ulong> hits   { 0 };    // shared by every thread taking
+        std::atomic<ulong> limited{ 0 };
+        std::atomic<ulong> evicted{ 0 };
+    };  ptr_t<NODE> obj;
+
+    /*.........................................................................*/
+
+    ulong hash( const string_t& key ) const noexcept {
+        ulong out = 14695981039346656037ULL;
+        for( ulong x=0; x<key.size(); x++ ){
+             out ^= (uchar) key[x]; out *= 1099511628211ULL;
+        }    return out | 1; // 0 marks an empty slot
+    }
+
+    ulong pow2( ulong value ) const noexcept {
+        ulong out = 1; while( out < value ){ out <<= 1; } return out;
+    }
+
+    /*.........................................................................*/
+
+    SLOT* find( SHARD& shd, ulong hash, ulong now ) const noexcept {
+        ulong idx = ( hash >> 16 ) & obj->mask; SLOT* free=nullptr; SLOT* old=nullptr;
+
+        for( ulong x=0; x<obj->cfg.probe; x++ ){
+             auto y = &shd.slot[ ( idx + x ) & obj->mask ];
+             if( y->hash == hash ){ return y; }
+             if( y->hash == 0 || now - y->last > obj->cfg.idle )
+               { if( free == nullptr ){ free = y; } continue; }
+             if( old == nullptr || y->last < old->last ){ old = y; }
+        }
+
+        if( free == nullptr ){ free = old; obj->evicted++; }
+        free->hash = hash; free->last = now; free->token = obj->cfg.burst;
+        return free;
+    }
+
+public:
+
+    express_limit_t( express_limit_config_t cfg ) noexcept : obj( new NODE() ) {
+        if( !( cfg.rate > 0 ) ){ process::error( "rate limit needs a positive rate" ); }
+        obj->cfg = cfg; if( obj->cfg.shard==0 ){ obj->cfg.shard=1; }
+        if( obj->cfg.probe==0 ){ obj->cfg.probe=1; }
+        ulong len = pow2( max( obj->cfg.size / obj->cfg.shard, (ulong) obj->cfg.probe ) );
+        obj->shard = ptr_t<SHARD>( obj->cfg.shard, SHARD() );
+        for( ulong x=0; x<obj->cfg.shard; x++ ){
+             obj->shard[x].slot = ptr_t<SLOT>( len, SLOT() );
+             obj->shard[x].mtx  = mutex_t(); // one lock per shard
+        }    obj->mask = len - 1;
+    }
+
+    express_limit_t() noexcept : express_limit_t( express_limit_config_t() ) {}
+
+    /*.........................................................................*/
+
+    ulong get_hits()    const noexcept { return obj->hits;    }
+    ulong get_limited() const noexcept { return obj->limited; }
+    ulong get_evicted() const noexcept { return obj->evicted; }
+
+    /*.........................................................................*/
+
+    /* takes one token from the bucket of `key`; returns the tokens left, or
+       -1 when the bucket is empty. `reset` receives the seconds until the
+       bucket is full again, or until the next token when limited. */
+    long take( const string_t& key, ulong& reset ) const noexcept {
+        auto now = process::now(); auto hsh = hash( key ); long out = -1;
+        auto& shd = obj->shard[ ( hsh >> 40 ) % obj->cfg.shard ]; // low bits are forced odd
+
+        shd.mtx.lock(); auto slt = find( shd, hsh, now );
+
+        slt->token = min( (float) obj->cfg.burst, (float)(
+                     slt->token + ( now - slt->last ) * obj->cfg.rate / 1000 )
+        );           slt->last  = now;
+
+        if( slt->token >= 1 ){ slt->token -= 1; out = (long) slt->token;
+            reset = (ulong)( ( obj->cfg.burst - slt->token ) / obj->cfg.rate + 0.999 );
+        } else {
+            reset = (ulong)( ( 1 - slt->token ) / obj->cfg.rate + 0.999 );
+        }
+
+        shd.mtx.unlock(); obj->hits++; if( out<0 ){ obj->limited++; }
+        return out;
+    }
+
+    /*.........................................................................*/
+
+    template< class T >
+    function_t<void,T&,function_t<void>> middleware() const noexcept {
+        auto self = type::bind( this );
+    return [=]( T& cli, function_t<void> next ){
+        auto& cfg = self->obj->cfg; ulong reset = 0;
+
+        auto key = cfg.header.empty() ? cli.get_peername() :
+                   cli.headers[ cfg.header ];
+        if ( key.empty() ){ key = cli.get_peername(); }
+
+        auto left = self->take( key, reset );
+
+        if( cfg.headers ){
+            cli.header( "RateLimit-Limit",     string::to_string( cfg.burst ) );
+            cli.header( "RateLimit-Remaining", string::to_string( max( left, 0L ) ) );
+            cli.header( "RateLimit-Reset",     string::to_string( reset ) );
+        }
+
+        if( left < 0 ){
+            cli.header( "Retry-After", string::to_string( reset ) );
+            cli.status( cfg.status ).send( cfg.message ); return;
+        }   next();
+
+    }; }
+
+};}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+namespace nodepp { namespace express { namespace limit {
+
+    template< class T >
+    function_t<void,T&,function_t<void>> add( express_limit_config_t cfg ) {
+        return express_limit_t( cfg ).middleware<T>();
+    }
+
+    template< class T >
+    function_t<void,T&,function_t<void>> add() {
+        return express_limit_t().middleware<T>();
+    }
+
+}}}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#endif
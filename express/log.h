@@ -0,0 +1,251 @@
+/*
+ * Copyright 2023 The Nodepp Project Authors. All Rights Reserved.
+ *
+ * Licensed under the MIT (the "License").  You may not use
+ * this file except in compliance with the License.  You can obtain a copy
+ * in the file LICENSE in the source distribution or at
+ * https://github.com/NodeppOficial/nodepp/blob/main/LICENSE
+ */
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#ifndef NODEPP_EXPRESS_LOG
+#define NODEPP_EXPRESS_LOG
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#include <nodepp/nodepp.h>
+
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <string>
+
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>
+#include <ctime>
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+namespace nodepp { namespace express { namespace log {
+    /* COMMON and COMBINED are the NCSA formats; JSON writes one object per
+       line with the same fields plus the response time. */
+    enum FORMAT { COMMON = 0, COMBINED = 1, JSON = 2 };
+}}}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+/* access log of one worker process. Requests are formatted on the loop
+   thread into a single-producer, single-consumer byte ring; a writer
+   thread drains it every `flush` ms (sooner once it is half full) in one
+   writev() per pass and rotates the file by size or age. A line that does
+   not fit is dropped and counted, request handling never waits on the
+   disk. Settings other than the format take effect at open(). */
+
+namespace nodepp { class express_log_t {
+protected:
+
+    struct NODE {
+        std::mutex              mtx;
+        std::condition_variable cv ;
+        std::thread             writer;
+        std::atomic<ulong>      head { 0 };     // written by the loop
+        std::atomic<ulong>      tail { 0 };     // written by the writer
+        std::atomic<bool>       stop { 0 };
+        char*  ring  = nullptr;
+        ulong  cap   = CHUNK_MB(4);             // power of two
+        int    fd    =-1;
+
+        std::string path;
+        ulong  flush  = 200;                    // ms between passes
+        ulong  size   = 0;                      // rotate past this many bytes, 0 never
+        ulong  period = 0;                      // rotate after this many ms, 0 never
+        uint   keep   = 5;                      // rotated files kept
+        uint   format = express::log::COMBINED;
+        bool   enabled= 0;
+
+        std::atomic<ulong> written { 0 };       // bytes
+        std::atomic<ulong> rotated { 0 };
+        ulong  logged  = 0;
+        ulong  dropped = 0;
+
+        time_t   second = 0;                    // date cache, one strftime per second
+        string_t date;
+
+       ~NODE() noexcept {
+            stop = 1; cv.notify_all(); if( writer.joinable() ){ writer.join(); }
+            if( fd >= 0 ){ ::close( fd ); } if( ring != nullptr ){ ::free( ring ); }
+        }
+    };  ptr_t<NODE> obj;
+
+    /*.........................................................................*/
+
+    static int reopen( NODE* node ) {
+        return ::open( node->path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644 );
+    }
+
+    /* path.N-1 -> path.N ... path -> path.1, then a fresh path */
+    static void rotate( NODE* node ) {
+        for( uint x=node->keep; x-->1; ){
+            auto from = node->path + "." + std::to_string( x );
+            auto to   = node->path + "." + std::to_string( x+1 );
+            ::rename( from.c_str(), to.c_str() );
+        }   if( node->keep > 0 ){ ::rename( node->path.c_str(), ( node->path + ".1" ).c_str() ); }
+        else { ::unlink( node->path.c_str() ); }
+        int fd = reopen( node ); if( fd < 0 ){ return; }
+        ::close( node->fd ); node->fd = fd; node->rotated++;
+    }
+
+    static void drain( NODE* node, ulong& size ) {
+        auto h = node->head.load( std::memory_order_acquire );
+        auto t = node->tail.load( std::memory_order_relaxed ); if( h == t ){ return; }
+
+        auto from = t & ( node->cap - 1 ), len = h - t;
+        struct iovec io[2]; int cnt = 1;
+        io[0].iov_base = node->ring + from; io[0].iov_len = min( len, node->cap - from );
+        if( io[0].iov_len < len ){ io[1].iov_base = node->ring; io[1].iov_len = len - io[0].iov_len; cnt = 2; }
+
+        ulong done = 0; while( cnt > 0 ){
+            auto c = ::writev( node->fd, io, cnt );
+            if ( c < 0 && errno == EINTR ){ continue; } if( c <= 0 ){ break; } done += c;
+            while( cnt > 0 && (ulong) c >= io[0].iov_len ){ c -= io[0].iov_len; io[0] = io[1]; cnt--; }
+            if ( cnt > 0 ){ io[0].iov_base = (char*) io[0].iov_base + c; io[0].iov_len -= c; }
+        }
+
+        node->tail.store( h, std::memory_order_release ); // what failed to write is lost
+        node->written += done; size += done;
+    }
+
+    static void worker( NODE* node ) {
+        struct stat st; ulong size = ::fstat( node->fd, &st ) == 0 ? st.st_size : 0;
+        auto since = std::chrono::steady_clock::now();
+
+        while( true ){ bool stop = node->stop; {
+            std::unique_lock<std::mutex> lock( node->mtx );
+            if( !stop ){ node->cv.wait_for( lock, std::chrono::milliseconds( node->flush ) ); }
+        }   drain( node, size );
+
+            auto age = std::chrono::duration_cast<std::chrono::milliseconds>( std::chrono::steady_clock::now() - since ).count();
+            if(( node->size > 0 && size >= node->size ) || ( node->period > 0 && (ulong) age >= node->period ))
+              { rotate( node ); size = 0; since = std::chrono::steady_clock::now(); }
+
+            if( stop ){ return; }
+        }
+    }
+
+    /*.........................................................................*/
+
+    static string_t escape( const string_t& data, bool json ) {
+        string_t out; for( ulong x=0; x<data.size(); x++ ){ auto c = data[x];
+              if( c == '"' || c == '\\' ){ out += "\\"; out += c; }
+            elif( (unsigned char) c < 0x20 ){ out += json ? string::format( "\\u%04x", (unsigned char) c ) : string::format( "\\x%02x", (unsigned char) c ); }
+            else { out += c; }
+        }   return out;
+    }
+
+    const string_t& date() const noexcept {
+        auto now = ::time( nullptr ); if( now == obj->second ){ return obj->date; }
+        struct tm t; ::localtime_r( &now, &t ); char buf[64] = {0};
+        ::strftime( buf, sizeof(buf), obj->format == express::log::JSON ? "%Y-%m-%dT%H:%M:%S%z" : "%d/%b/%Y:%H:%M:%S %z", &t );
+        obj->second = now; obj->date = buf; return obj->date;
+    }
+
+public:
+
+    express_log_t() noexcept : obj( new NODE() ) {}
+
+    /*.........................................................................*/
+
+    /* ring size, rounded up to a power of two */
+    void set_ring  ( ulong bytes ) const noexcept { ulong y = 4096; while( y < bytes ){ y <<= 1; } obj->cap = y; }
+    void set_flush ( ulong ms    ) const noexcept { obj->flush  = max( ms, 10UL ); }
+    void set_format( uint format ) const noexcept { obj->format = format; obj->second = 0; }
+
+    /* rotate past `bytes` or every `ms`, keeping `keep` old files */
+    void set_rotate( ulong bytes, ulong ms, uint keep ) const noexcept {
+         obj->size = bytes; obj->period = ms; obj->keep = keep;
+    }
+
+    bool open( string_t path ) const noexcept {
+        if( obj->enabled ){ return false; } obj->path = std::string( path.get(), path.size() );
+        obj->fd = reopen( obj.get() ); if( obj->fd < 0 ){ return false; }
+        obj->ring = (char*) ::malloc( obj->cap ); if( obj->ring == nullptr ){ ::close( obj->fd ); obj->fd = -1; return false; }
+        obj->writer = std::thread( &worker, obj.get() ); obj->enabled = 1; return true;
+    }
+
+    /*.........................................................................*/
+
+    bool  is_enabled()  const noexcept { return obj->enabled; }
+    ulong get_logged()  const noexcept { return obj->logged;  }
+    ulong get_dropped() const noexcept { return obj->dropped; }
+    ulong get_written() const noexcept { return obj->written; }
+    ulong get_rotated() const noexcept { return obj->rotated; }
+    ulong get_pending() const noexcept { return obj->head.load() - obj->tail.load(); }
+
+    /*.........................................................................*/
+
+    /* queues one finished line; false when the ring had no room for it */
+    bool push( const string_t& line ) const noexcept {
+        if( !obj->enabled ){ return false; }
+        auto h = obj->head.load( std::memory_order_relaxed );
+        auto t = obj->tail.load( std::memory_order_acquire );
+        if( line.size() > obj->cap - ( h - t ) ){ obj->dropped++; return false; }
+
+        auto from = h & ( obj->cap - 1 ), first = min( line.size(), obj->cap - from );
+        memcpy( obj->ring + from, line.get(), first );
+        memcpy( obj->ring, line.get() + first, line.size() - first );
+        obj->head.store( h + line.size(), std::memory_order_release ); obj->logged++;
+
+        if( h + line.size() - t > obj->cap / 2 ){ obj->cv.notify_one(); } return true;
+    }
+
+    /* `bytes` < 0 is logged as unknown */
+    template< class T >
+    void record( const T& cli, const string_t& peer, uint status, long bytes, ulong ms ) const noexcept {
+        if( !obj->enabled ){ return; }
+        auto ref = cli.headers.has( "Referer"    ) ? cli.headers["Referer"]    : string_t();
+        auto agn = cli.headers.has( "User-Agent" ) ? cli.headers["User-Agent"] : string_t();
+        auto url = cli.path + cli.search;
+
+        if( obj->format == express::log::JSON ){
+            push( string::format( "{\"time\":\"%s\",\"remote\":\"%s\",\"method\":\"%s\",\"url\":\"%s\",\"status\":%u,\"bytes\":%ld,\"ms\":%lu,\"referer\":\"%s\",\"agent\":\"%s\"}\n",
+                date().get(), escape( peer, 1 ).get(), escape( cli.method, 1 ).get(), escape( url, 1 ).get(),
+                status, bytes < 0 ? 0L : bytes, ms, escape( ref, 1 ).get(), escape( agn, 1 ).get() ) ); return;
+        }
+
+        auto line = string::format( "%s - - [%s] \"%s %s %s\" %u ",
+            peer.empty() ? "-" : peer.get(), date().get(), escape( cli.method, 0 ).get(),
+            escape( url, 0 ).get(), cli.get_version().get(), status
+        ) + ( bytes < 0 ? string_t( "-" ) : string::to_string( bytes ) );
+
+        if( obj->format == express::log::COMBINED ){
+            line += " \"" + ( ref.empty() ? string_t( "-" ) : escape( ref, 0 ) ) + "\" \""
+                          + ( agn.empty() ? string_t( "-" ) : escape( agn, 0 ) ) + "\"";
+        }   push( line + "\n" );
+    }
+
+};}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+namespace nodepp { namespace express { namespace log {
+
+    inline express_log_t& engine() {
+        static express_log_t out; return out;
+    }
+
+    /* starts logging every request of this process to `path` */
+    inline bool open( string_t path, uint format=COMBINED ) {
+        engine().set_format( format ); return engine().open( path );
+    }
+
+}}}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#endif
@@ -0,0 +1,149 @@
+/*
+ * Copyright 2023 The Nodepp Project Authors. All Rights Reserved.
+ *
+ * Licensed under the MIT (the "License").  You may not use
+ * this file except in compliance with the License.  You can obtain a copy
+ * in the file LICENSE in the source distribution or at
+ * https://github.com/NodeppOficial/nodepp/blob/main/LICENSE
+ */
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#ifndef NODEPP_EXPRESS_SHED
+#define NODEPP_EXPRESS_SHED
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#include <nodepp/nodepp.h>
+#include <nodepp/timer.h>
+#include <cmath>
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+namespace nodepp { namespace express { namespace shed {
+    enum PRIORITY { LOW = 0, NORMAL = 1, CRITICAL = 2 };
+}}}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+/* admission control in the spirit of CoDel. Queueing delay is measured as
+   the lag of a probe timer: requests waiting on a busy loop delay it just
+   like they delay each other. Once the delay stays above `target` for a
+   whole `interval`, LOW routes are refused outright and NORMAL routes are
+   refused at a rate that grows with sqrt(drops) until the delay recovers;
+   CRITICAL routes are never refused. An optional in-flight cap refuses
+   everything but CRITICAL when reached. */
+
+namespace nodepp { class express_shed_t {
+protected:
+
+    struct NODE {
+        ulong target  = 5;          // ms of tolerated delay
+        ulong interval= 100;        // ms the delay may stay above target
+        ulong period  = 10;         // probe period
+        ulong limit   = 0;          // in-flight cap, 0 = none
+        ulong retry   = 1;          // Retry-After seconds
+
+        ulong delay   = 0;          // last measured delay
+        ulong expect  = 0;
+        ulong first   = 0;          // when the delay may trigger dropping
+        ulong next    = 0;          // next NORMAL drop while dropping
+        ulong leave   = 0;          // when dropping last ended
+        ulong count   = 0;          // drops in the current episode
+        bool  dropping= 0;
+        bool  enabled = 0;
+
+        ulong inflight= 0;
+        ulong admitted= 0;
+        ulong shed[3] = { 0, 0, 0 };
+        ptr_t<int> timer;
+    };  ptr_t<NODE> obj;
+
+    /*.........................................................................*/
+
+    void probe() const noexcept {
+        auto now = process::now(); obj->delay = now > obj->expect ? now - obj->expect : 0;
+        obj->expect = now + obj->period;
+
+        if( obj->delay < obj->target ){ obj->first = 0;
+            if( obj->dropping ){ obj->dropping = 0; obj->leave = now; }
+        } elif( obj->first == 0 ){ obj->first = now + obj->interval; }
+          elif( now >= obj->first && !obj->dropping ){
+            obj->dropping = 1; obj->next = now;
+            obj->count = now - obj->leave < obj->interval * 16 && obj->count > 2 ? obj->count - 2 : 1;
+        }
+    }
+
+    void start() const noexcept {
+        if( obj->timer != nullptr ){ return; } auto self = type::bind( this );
+        obj->expect = process::now() + obj->period;
+        obj->timer  = timer::interval([=](){ self->probe(); }, obj->period );
+    }
+
+    void stop() const noexcept {
+        if( obj->timer == nullptr ){ return; }
+        timer::clear( obj->timer ); obj->timer = nullptr;
+        obj->dropping = 0; obj->first = 0;
+    }
+
+public:
+
+    express_shed_t() noexcept : obj( new NODE() ) {}
+
+    /*.........................................................................*/
+
+    void set_target( ulong target, ulong interval ) const noexcept {
+         obj->target = target; obj->interval = max( interval, 1UL );
+    }
+
+    void set_limit( ulong limit )   const noexcept { obj->limit = limit; }
+    void set_retry( ulong seconds ) const noexcept { obj->retry = seconds; }
+
+    void set_enabled( bool value )  const noexcept {
+         obj->enabled = value; if( value ){ start(); } else { stop(); }
+    }
+
+    /*.........................................................................*/
+
+    bool  is_enabled()   const noexcept { return obj->enabled;  }
+    bool  is_dropping()  const noexcept { return obj->dropping; }
+    ulong get_delay()    const noexcept { return obj->delay;    }
+    ulong get_inflight() const noexcept { return obj->inflight; }
+    ulong get_admitted() const noexcept { return obj->admitted; }
+    ulong get_retry()    const noexcept { return obj->retry;    }
+
+    ulong get_shed( uint priority ) const noexcept { return obj->shed[ min( priority, 2u ) ]; }
+    ulong get_shed() const noexcept { return obj->shed[0] + obj->shed[1] + obj->shed[2]; }
+
+    /*.........................................................................*/
+
+    void enter() const noexcept { obj->inflight++; }
+    void leave() const noexcept { if( obj->inflight > 0 ){ obj->inflight--; } }
+
+    /* true when a route of this priority may run now */
+    bool admit( uint priority ) const noexcept {
+        if( !obj->enabled || priority >= express::shed::CRITICAL ){ obj->admitted++; return true; }
+        if( obj->limit > 0 && obj->inflight > obj->limit ){ obj->shed[priority]++; return false; }
+        if( !obj->dropping ){ obj->admitted++; return true; }
+        if( priority == express::shed::LOW ){ obj->shed[priority]++; return false; }
+
+        auto now = process::now(); if( now < obj->next ){ obj->admitted++; return true; }
+        obj->count++; obj->next = now + (ulong)( obj->interval / ::sqrt( (double) obj->count ) );
+        obj->shed[priority]++; return false;
+    }
+
+};}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+namespace nodepp { namespace express { namespace shed {
+
+    inline express_shed_t& engine() {
+        static express_shed_t out; return out;
+    }
+
+}}}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#endif
@@ -0,0 +1,177 @@
+/*
+ * Copyright 2023 The Nodepp Project Authors. All Rights Reserved.
+ *
+ * Licensed under the MIT (the "License").  You may not use
+ * this file except in compliance with the License.  You can obtain a copy
+ * in the file LICENSE in the source distribution or at
+ * https://github.com/NodeppOficial/nodepp/blob/main/LICENSE
+ */
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#ifndef NODEPP_EXPRESS_SSE
+#define NODEPP_EXPRESS_SSE
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#include <nodepp/nodepp.h>
+#include <nodepp/stream.h>
+#include <nodepp/timer.h>
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+namespace nodepp { namespace express { namespace sse {
+
+    inline string_t format( ulong id, const string_t& event, const string_t& data ) {
+        string_t out = "id: " + string::to_string( id ) + "\n";
+        if( !event.empty() ){ out += "event: " + event + "\n"; }
+
+        ulong pos = 0; for( ulong x=0; x<=data.size(); x++ ){
+        if( x<data.size() && data[x] != '\n' ){ continue; }
+            out += "data: " + data.slice( pos, x ) + "\n"; pos = x + 1;
+        }   out += "\n"; return out;
+    }
+
+}}}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+namespace nodepp { template< class T > class express_sse_t {
+protected:
+
+    struct EVENT {
+        ulong    id = 0;
+        string_t data;
+    };
+
+    struct SUB {
+        T                 cli;
+        queue_t<string_t> queue;
+        ulong             bytes= 0;
+        bool              busy = 0;
+        bool              dead = 0;
+    };
+
+    struct NODE {
+        map_t<ulong,ptr_t<SUB>> list;
+        ptr_t<EVENT> ring;
+        ulong size  = 0;          // ring capacity
+        ulong last  = 0;          // id of the newest event
+        ulong next  = 0;          // subscriber ids
+        ulong limit = CHUNK_MB(1);
+        ulong beat  = TIME_SECONDS(15);
+        ulong sent  = 0;
+        ulong drop  = 0;
+        ptr_t<int> timer;
+    };  ptr_t<NODE> obj;
+
+    /*.........................................................................*/
+
+    void drain( ptr_t<SUB> sub ) const noexcept {
+        if( sub->busy || sub->dead ){ return; } sub->busy = 1;
+        auto wrt = type::bind( _file_::write() );
+
+        process::poll::add([=](){
+            if( sub->dead || !sub->cli.is_available() ){ sub->dead=1; return -1; }
+            if( sub->queue.empty() ){ sub->busy=0; return -1; }
+            auto data = sub->queue.first()->data;
+            if((*wrt)( &sub->cli, data )==1 ){ return 1; }
+            if(  wrt->state <= 0 ){ sub->dead=1; return -1; }
+            sub->bytes -= data.size(); sub->queue.shift(); return 1;
+        });
+    }
+
+    bool push( ptr_t<SUB> sub, const string_t& data ) const noexcept {
+        if( sub->dead || !sub->cli.is_available() ){ sub->dead=1; return false; }
+        if( sub->bytes + data.size() > obj->limit ){ sub->dead=1; sub->cli.close(); return false; }
+        sub->bytes += data.size(); sub->queue.push( data ); drain( sub ); return true;
+    }
+
+    ulong fanout( const string_t& data ) const noexcept {
+        array_t<ulong> gone; ulong out = 0;
+        forEach( item, obj->list.data() ){
+            if( push( item.second, data ) ){ out++; continue; }
+            gone.push( item.first );
+        }
+
+        forEach( item, gone ){ obj->list.erase( item ); }
+        obj->drop += gone.size(); if( obj->list.empty() ){ stop(); }
+        return out;
+    }
+
+    /*.........................................................................*/
+
+    /* one timer per feed keeps every subscriber alive; it only runs while
+       somebody is listening. */
+    void start() const noexcept {
+        if( obj->timer != nullptr || obj->beat == 0 ){ return; }
+        auto self = type::bind( this ); string_t ping = ": ping\n\n";
+        obj->timer = timer::interval([=](){ self->fanout( ping ); }, obj->beat );
+    }
+
+    void stop() const noexcept {
+        if( obj->timer == nullptr ){ return; }
+        timer::clear( obj->timer ); obj->timer = nullptr;
+    }
+
+public:
+
+    express_sse_t( ulong history ) noexcept : obj( new NODE() ) {
+        obj->size = max( history, 1UL ); obj->ring = ptr_t<EVENT>( obj->size, EVENT() );
+    }
+
+    express_sse_t() noexcept : express_sse_t( 64 ) {}
+
+    /*.........................................................................*/
+
+    void  set_limit( ulong limit )     const noexcept { obj->limit = limit; }
+    void  set_heartbeat( ulong time )  const noexcept { obj->beat  = time;  }
+
+    ulong size()      const noexcept { return obj->list.size(); }
+    ulong get_last()  const noexcept { return obj->last; }
+    ulong get_sent()  const noexcept { return obj->sent; }
+    ulong get_drop()  const noexcept { return obj->drop; }
+
+    /*.........................................................................*/
+
+    /* opens the stream on `cli` and replays the events newer than its
+       Last-Event-ID that are still in the ring buffer. */
+    void subscribe( T& cli ) const noexcept {
+        auto sub = type::bind( SUB() ); sub->cli = cli; cli.sendEvents();
+
+        if( cli.headers.has( "Last-Event-ID" ) ){
+            ulong from = string::to_ulong( cli.headers["Last-Event-ID"] ) + 1;
+            ulong old  = obj->last >= obj->size ? obj->last - obj->size + 1 : 1;
+            for( ulong x=max( from, old ); x<=obj->last; x++ ){
+                 auto& y = obj->ring[ x % obj->size ];
+                 if  ( y.id == x ){ push( sub, y.data ); }
+            }
+        }
+
+        obj->list[ ++obj->next ] = sub; start();
+    }
+
+    /*.........................................................................*/
+
+    ulong publish( const string_t& data, const string_t& event ) const noexcept {
+        auto id = ++obj->last; auto& y = obj->ring[ id % obj->size ];
+        y.id = id; y.data = express::sse::format( id, event, data );
+        auto out = fanout( y.data ); obj->sent += out; return out;
+    }
+
+    ulong publish( const string_t& data ) const noexcept {
+        return publish( data, nullptr );
+    }
+
+    /*.........................................................................*/
+
+    void close() const noexcept {
+        stop(); forEach( item, obj->list.data() ){ item.second->cli.close(); }
+        obj->list.clear();
+    }
+
+};}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#endif
@@ -0,0 +1,132 @@
+/*
+ * Copyright 2023 The Nodepp Project Authors. All Rights Reserved.
+ *
+ * Licensed under the MIT (the "License").  You may not use
+ * this file except in compliance with the License.  You can obtain a copy
+ * in the file LICENSE in the source distribution or at
+ * https://github.com/NodeppOficial/nodepp/blob/main/LICENSE
+ */
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#ifndef NODEPP_EXPRESS_VHOST
+#define NODEPP_EXPRESS_VHOST
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#include <nodepp/nodepp.h>
+#include <nodepp/optional.h>
+#include <express/https.h>
+#include <utility>
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+namespace nodepp { namespace express { namespace vhost {
+
+    /* lower case, no port, no trailing dot: "Api.Example.com.:8080" -> "api.example.com" */
+    inline string_t hostname( string_t host ) {
+        if( host.empty() ){ return host; } ulong end = host.size();
+        if( host[0] == '[' ){ for( ulong x=0; x<host.size(); x++ ){ if( host[x]==']' ){ end = x+1; break; } } }
+        else { for( ulong x=0; x<host.size(); x++ ){ if( host[x]==':' ){ end = x; break; } } }
+        while( end > 0 && host[end-1] == '.' ){ end--; }
+        return host.slice( 0, end ).to_lower_case();
+    }
+
+}}}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+/* T is the router type, V the request it hands out. Every request is matched
+   against the Host header once (exact name first, then the longest
+   "*.suffix" through one hash lookup per label) and only walks the route
+   table of its own domain. */
+
+namespace nodepp { template< class T, class V > class express_vhost_t {
+protected:
+
+    struct NODE {
+        map_t<string_t,T> exact;
+        map_t<string_t,T> suffix;   // keyed by ".example.com"
+        optional_t<T>     fallback;
+        T                 front;
+        ulong hits = 0;
+        ulong miss = 0;
+    };  ptr_t<NODE> obj;
+
+public:
+
+    express_vhost_t( T front ) noexcept : obj( new NODE() ) {
+        auto self = type::bind( this ); obj->front = front;
+        obj->front.USE( function_t<void,V&,function_t<void>>([=]( V& cli, function_t<void> next ){
+            T router; if( !self->resolve( cli.get_header( V::HOST ), router ) ){
+                cli.status(421).send( "misdirected request" ); return;
+            }   router.dispatch( cli ); if( !cli.is_express_closed() ){ next(); }
+        }));
+    }
+
+    express_vhost_t() noexcept : express_vhost_t( T() ) {}
+
+    /*.........................................................................*/
+
+    /* "example.com" matches that name only; "*.example.com" matches any
+       subdomain of it, the most specific wildcard wins. */
+    const express_vhost_t& host( string_t name, T router ) const noexcept {
+        name = express::vhost::hostname( name );
+        if( name.size() > 1 && name[0] == '*' && name[1] == '.' ){ obj->suffix[ name.slice(1) ] = router; }
+        else { obj->exact[ name ] = router; } return (*this);
+    }
+
+    const express_vhost_t& set_default( T router ) const noexcept {
+        obj->fallback = optional_t<T>( router ); return (*this);
+    }
+
+    /*.........................................................................*/
+
+    bool resolve( string_t host, T& out ) const noexcept {
+        host = express::vhost::hostname( host );
+
+        if( obj->exact.has( host ) ){ out = obj->exact[host]; obj->hits++; return true; }
+        for( ulong x=0; x<host.size(); x++ ){ if( host[x] != '.' ){ continue; }
+        if ( obj->suffix.has( host.slice(x) ) ){ out = obj->suffix[host.slice(x)]; obj->hits++; return true; }
+        }
+
+        obj->miss++; if( !obj->fallback.has_value() ){ return false; }
+        out = obj->fallback.value(); return true;
+    }
+
+    /*.........................................................................*/
+
+    ulong get_hits() const noexcept { return obj->hits; }
+    ulong get_miss() const noexcept { return obj->miss; }
+    T  get_router()  const noexcept { return obj->front; }
+
+    /*.........................................................................*/
+
+    template< class... A >
+    auto listen( const A&... args ) const noexcept -> decltype( std::declval<T>().listen( args... ) ) {
+        return obj->front.listen( args... );
+    }
+
+};}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+namespace nodepp { namespace express { namespace http {
+
+    template< class... T > express_vhost_t<express_tcp_t,express_http_t> vhost( T... args ) {
+        return express_vhost_t<express_tcp_t,express_http_t>( express_tcp_t(args...) );
+    }
+
+}}}
+
+namespace nodepp { namespace express { namespace https {
+
+    template< class... T > express_vhost_t<express_tls_t,express_https_t> vhost( T... args ) {
+        return express_vhost_t<express_tls_t,express_https_t>( express_tls_t(args...) );
+    }
+
+}}}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#endif
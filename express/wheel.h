@@ -0,0 +1,200 @@
+/*
+ * Copyright 2023 The Nodepp Project Authors. All Rights Reserved.
+ *
+ * Licensed under the MIT (the "License").  You may not use
+ * this file except in compliance with the License.  You can obtain a copy
+ * in the file LICENSE in the source distribution or at
+ * https://github.com/NodeppOficial/nodepp/blob/main/LICENSE
+ */
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#ifndef NODEPP_EXPRESS_WHEEL
+#define NODEPP_EXPRESS_WHEEL
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#include <nodepp/nodepp.h>
+#include <nodepp/timer.h>
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+namespace nodepp { struct express_timer_t {
+    ptr_t<express_timer_t> next;
+    express_timer_t*       prev = nullptr;
+    function_t<void>       cb;
+    ulong when = 0;    // expiry tick
+    int   level=-1;    // -1 while not linked
+    int   index=-1;
+};}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+/* four levels of 64 slots: level L holds timers due within 64^(L+1) ticks,
+   so arming and cancelling are a list link/unlink and each tick touches one
+   slot, plus a cascade every 64 ticks. touch() only moves the deadline
+   forward; the timer is re-slotted when its old slot comes up, which makes
+   idle timers cheap to refresh on every read. */
+
+namespace nodepp { class express_wheel_t {
+protected:
+
+    enum { BITS = 6, SLOTS = 64, LEVELS = 4 };
+
+    struct NODE {
+        ptr_t<express_timer_t> slot[LEVELS][SLOTS];
+        ulong tick = 100;     // ms per tick
+        ulong now  = 0;       // current tick
+        ulong size = 0;       // armed timers
+        ulong fired= 0;
+        ptr_t<int> timer;
+    };  ptr_t<NODE> obj;
+
+    /*.........................................................................*/
+
+    void link( ptr_t<express_timer_t> t ) const noexcept {
+        ulong delta = t->when > obj->now ? t->when - obj->now : 0; int level = 0;
+        while( level < LEVELS-1 && delta >= ( 1UL << ( BITS * ( level+1 ) ) ) ){ level++; }
+        ulong slot = delta < ( 1UL << ( BITS * LEVELS ) ) ? t->when : // beyond the top level:
+                     obj->now + ( 1UL << ( BITS * LEVELS ) ) - 1;     // park it and re-slot later
+
+        int index = ( slot >> ( BITS * level ) ) & ( SLOTS-1 );
+        auto& head = obj->slot[level][index];
+        t->next = head; t->prev = nullptr; if( head != nullptr ){ head->prev = t.get(); }
+        head = t; t->level = level; t->index = index;
+    }
+
+    void unlink( ptr_t<express_timer_t> t ) const noexcept {
+        if( t->level < 0 ){ return; }
+        if( t->prev != nullptr ){ t->prev->next = t->next; }
+        else { obj->slot[t->level][t->index] = t->next; }
+        if( t->next != nullptr ){ t->next->prev = t->prev; }
+        t->next = nullptr; t->prev = nullptr; t->level = -1; t->index = -1;
+    }
+
+    /* detaches a whole slot in one go */
+    array_t<ptr_t<express_timer_t>> take( int level, int index ) const noexcept {
+        array_t<ptr_t<express_timer_t>> out; auto n = obj->slot[level][index];
+        obj->slot[level][index] = nullptr;
+        while( n != nullptr ){ auto y = n->next; n->next = nullptr; n->prev = nullptr;
+               n->level = -1; n->index = -1; out.push( n ); n = y; }
+        return out;
+    }
+
+    /*.........................................................................*/
+
+    void step() const noexcept { obj->now++;
+
+        for( int level=1; level<LEVELS; level++ ){
+            if( ( obj->now & ( ( 1UL << ( BITS * level ) ) - 1 ) ) != 0 ){ break; }
+            int index = ( obj->now >> ( BITS * level ) ) & ( SLOTS-1 );
+            forEach( item, take( level, index ) ){ link( item ); }
+        }
+
+        array_t<ptr_t<express_timer_t>> batch;
+        forEach( item, take( 0, obj->now & ( SLOTS-1 ) ) ){
+            if( item->when > obj->now ){ link( item ); continue; } // touched meanwhile
+            batch.push( item );
+        }
+
+        obj->size -= batch.size(); obj->fired += batch.size();
+        forEach( item, batch ){ auto cb = item->cb; item->cb = nullptr; cb(); }
+    }
+
+    void advance() const noexcept {
+        ulong target = process::now() / obj->tick;
+        if( obj->size == 0 ){ obj->now = max( obj->now, target ); stop(); return; }
+        while( obj->now < target && obj->size > 0 ){ step(); }
+        if( obj->size == 0 ){ obj->now = max( obj->now, target ); stop(); }
+    }
+
+    void start() const noexcept {
+        if( obj->timer != nullptr ){ return; } auto self = type::bind( this );
+        obj->timer = timer::interval([=](){ self->advance(); }, obj->tick );
+    }
+
+    void stop() const noexcept {
+        if( obj->timer == nullptr ){ return; }
+        timer::clear( obj->timer ); obj->timer = nullptr;
+    }
+
+public:
+
+    express_wheel_t( ulong tick ) noexcept : obj( new NODE() ) {
+        obj->tick = max( tick, 1UL ); obj->now = process::now() / obj->tick;
+    }
+
+    express_wheel_t() noexcept : express_wheel_t( 100 ) {}
+
+    /*.........................................................................*/
+
+    ulong size()      const noexcept { return obj->size;  }
+    ulong get_fired() const noexcept { return obj->fired; }
+    ulong get_tick()  const noexcept { return obj->tick;  }
+
+    /*.........................................................................*/
+
+    ptr_t<express_timer_t> add( ulong ms, function_t<void> cb ) const noexcept {
+        if( obj->size == 0 ){ obj->now = max( obj->now, process::now() / obj->tick ); }
+        auto t = ptr_t<express_timer_t>( new express_timer_t() ); t->cb = cb;
+        t->when = obj->now + max( ( ms + obj->tick - 1 ) / obj->tick, 1UL );
+        link( t ); obj->size++; start(); return t;
+    }
+
+    /* pushes the deadline to `ms` from now */
+    void touch( ptr_t<express_timer_t> t, ulong ms ) const noexcept {
+        if( t == nullptr || t->level < 0 ){ return; }
+        t->when = max( t->when, obj->now + max( ( ms + obj->tick - 1 ) / obj->tick, 1UL ) );
+    }
+
+    void cancel( ptr_t<express_timer_t> t ) const noexcept {
+        if( t == nullptr || t->level < 0 ){ return; }
+        unlink( t ); t->cb = nullptr; obj->size--;
+        if( obj->size == 0 ){ stop(); }
+    }
+
+};}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+namespace nodepp { namespace express { namespace wheel {
+
+    inline express_wheel_t& engine() {
+        static express_wheel_t out; return out;
+    }
+
+    /*.........................................................................*/
+
+    /* closes `cli` once `ms` have passed, whatever it is doing. */
+    template< class T >
+    ptr_t<express_timer_t> deadline( const T& cli, ulong ms ) {
+        auto t = engine().add( ms, [=](){ if( cli.is_available() ){ cli.close(); } });
+        cli.onClose.once([=](){ engine().cancel( t ); }); return t;
+    }
+
+    /* closes `cli` after `ms` without inbound data. */
+    template< class T >
+    ptr_t<express_timer_t> idle( const T& cli, ulong ms ) {
+        auto t = deadline( cli, ms );
+        cli.onData([=]( string_t ){ engine().touch( t, ms ); }); return t;
+    }
+
+    /* one idle timer for both ends of a relay: data either way keeps both
+       open, expiry or either side closing ends the pair. */
+    template< class T, class V >
+    ptr_t<express_timer_t> idle( const T& a, const V& b, ulong ms ) {
+        auto t = engine().add( ms, [=](){
+            if( a.is_available() ){ a.close(); }
+            if( b.is_available() ){ b.close(); }
+        });
+        a.onClose.once([=](){ engine().cancel( t ); });
+        b.onClose.once([=](){ engine().cancel( t ); });
+        a.onData([=]( string_t ){ engine().touch( t, ms ); });
+        b.onData([=]( string_t ){ engine().touch( t, ms ); }); return t;
+    }
+
+}}}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#endif
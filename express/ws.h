@@ -0,0 +1,257 @@
+/*
+ * Copyright 2023 The Nodepp Project Authors. All Rights Reserved.
+ *
+ * Licensed under the MIT (the "License").  You may not use
+ * this file except in compliance with the License.  You can obtain a copy
+ * in the file LICENSE in the source distribution or at
+ * https://github.com/NodeppOficial/nodepp/blob/main/LICENSE
+ */
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#ifndef NODEPP_EXPRESS_WS
+#define NODEPP_EXPRESS_WS
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#include <nodepp/nodepp.h>
+#include <nodepp/encoder.h>
+#include <nodepp/crypto.h>
+#include <nodepp/stream.h>
+#include <nodepp/event.h>
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+namespace nodepp { namespace express { namespace ws {
+
+    /* frames are built once and shared: string_t copies point to the same
+       buffer, so a broadcast queues one immutable frame per socket. */
+    inline string_t frame( const string_t& data, uchar opcode=0x1 ) {
+        string_t out; ulong len = data.size(); out.push( (char)( 0x80 | opcode ) );
+        if( len < 126 ){ out.push( (char) len ); }
+        elif( len < 65536 ){
+            out.push( (char) 126 );
+            out.push( (char)( len >> 8 ) ); out.push( (char)( len ) );
+        } else { out.push( (char) 127 );
+            for( int x=7; x>=0; x-- ){ out.push( (char)( len >> ( x*8 ) ) ); }
+        }   out += data; return out;
+    }
+
+    inline string_t accept( const string_t& key ) {
+        auto sha = crypto::hash::SHA1(); string_t raw;
+             sha.update( key + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11" );
+        auto hex = sha.get(); for( ulong x=0; x+1<hex.size(); x+=2 ){ uchar y=0;
+        for( ulong z=x; z<x+2; z++ ){ char c = hex[z]; y <<= 4;
+             y |= c<='9' ? c-'0' : ( c|0x20 ) - 'a' + 10;
+        }    raw.push( (char) y ); } return encoder::base64::get( raw );
+    }
+
+}}}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+namespace nodepp { template< class T > class express_ws_t {
+protected:
+
+    struct NODE {
+        T               cli;
+        queue_t<string_t> queue;
+        string_t        buff ;   // inbound bytes not yet framed
+        string_t        msg  ;   // fragmented message being assembled
+        uchar           type = 0;
+        ulong           id   = 0;
+        ulong           bytes= 0;   // queued outbound bytes
+        ulong           limit= CHUNK_MB(1);
+        ulong           max  = CHUNK_MB(1);
+        bool            busy = 0;
+        int             state= 0;
+    };  ptr_t<NODE> obj;
+
+    /*.........................................................................*/
+
+    void drain() const noexcept {
+        if( obj->busy || obj->state<=0 ){ return; } obj->busy = 1;
+        auto self = type::bind( this ); auto wrt = type::bind( _file_::write() );
+
+        process::poll::add([=](){
+            if( self->is_closed() )          { return -1; }
+            if( self->obj->queue.empty() )   { self->obj->busy=0; return -1; }
+            auto data = self->obj->queue.first()->data;
+            if((*wrt)( &self->obj->cli, data )==1 ){ return 1; }
+            if(  wrt->state <= 0 )           { self->close(); return -1; }
+            self->obj->bytes -= data.size(); self->obj->queue.shift(); return 1;
+        });
+    }
+
+    /*.........................................................................*/
+
+    /* client frames are always masked; control frames are answered here and
+       data frames are reassembled before onData fires. */
+    void feed( const string_t& data ) const noexcept {
+        obj->buff += data; ulong pos = 0;
+
+        while( obj->state > 0 ){
+            auto  raw = (const uchar*) obj->buff.get() + pos;
+            ulong len = obj->buff.size() - pos; if( len < 2 ){ break; }
+
+            bool  fin = raw[0] & 0x80; uchar op = raw[0] & 0x0f;
+            if( !( raw[1] & 0x80 ) ){ close(); return; }
+            ulong size= raw[1] & 0x7f, hdr = 2;
+
+            if( size == 126 ){ if( len < 4  ){ break; } hdr = 4;
+                size = ( raw[2] << 8 ) | raw[3];
+            } elif( size == 127 ){ if( len < 10 ){ break; } hdr = 10; size = 0;
+                for( int x=2; x<10; x++ ){ size = ( size << 8 ) | raw[x]; }
+            }
+
+            if( size > obj->max ){ close(); return; }
+            if( len < hdr + 4 + size ){ break; }
+
+            string_t pay ( (char*) raw + hdr + 4, size );
+            for( ulong x=0; x<size; x++ ){ pay[x] ^= raw[ hdr + ( x % 4 ) ]; }
+            pos += hdr + 4 + size;
+
+              if( op == 0x8 ){ close(); return; }
+            elif( op == 0x9 ){ push( express::ws::frame( pay, 0xA ) ); }
+            elif( op == 0xA ){ /* pong */ }
+            else {
+                if( op != 0x0 ){ obj->type = op; obj->msg = pay; }
+                else           { obj->msg += pay; }
+                if( obj->msg.size() > obj->max ){ close(); return; }
+                if( fin ){ auto msg = obj->msg; obj->msg = nullptr; onData.emit( msg ); }
+            }
+        }
+
+        if( obj->state > 0 ){ obj->buff = obj->buff.slice( pos ); }
+    }
+
+public:
+
+    event_t<string_t> onData;
+    event_t<>         onClose;
+
+    /*.........................................................................*/
+
+    express_ws_t( T& cli ) noexcept : obj( new NODE() ) {
+        static ulong count = 0; obj->id = ++count;
+        obj->cli = cli; obj->state = 1; cli.set_timeout( 0 ); cli.set_deadline( 0 ); cli.untrack();
+
+        auto self = type::bind( this );
+        auto _read= type::bind( _file_::read() );
+
+        process::poll::add([=](){
+            if( self->is_closed() )           { return -1; }
+            if(!self->obj->cli.is_available() ){ self->close(); return -1; }
+            if((*_read)(&self->obj->cli)==1 )  { return 1; }
+            if(  _read->state<=0 )            { return 1; }
+            self->feed( _read->data ); return 1;
+        });
+    }
+
+    express_ws_t() noexcept : obj( new NODE() ) {}
+
+    /*.........................................................................*/
+
+    void  set_limit( ulong limit ) const noexcept { obj->limit = limit; }
+    void  set_max( ulong max )     const noexcept { obj->max   = max;   }
+
+    ulong get_id()      const noexcept { return obj->id;    }
+    ulong get_queued()  const noexcept { return obj->bytes; }
+    T&    get_fd()      const noexcept { return obj->cli;   }
+
+    bool  is_closed()   const noexcept { return obj->state <= 0; }
+
+    /*.........................................................................*/
+
+    /* queues an already framed buffer; a socket whose queue would grow past
+       the limit is a slow consumer and gets dropped. */
+    bool push( const string_t& frame ) const noexcept {
+        if( obj->state <= 0 ){ return false; }
+        if( obj->bytes + frame.size() > obj->limit ){ close(); return false; }
+        obj->bytes += frame.size(); obj->queue.push( frame );
+        drain(); return true;
+    }
+
+    bool send( const string_t& msg ) const noexcept {
+        return push( express::ws::frame( msg, 0x1 ) );
+    }
+
+    bool send_binary( const string_t& msg ) const noexcept {
+        return push( express::ws::frame( msg, 0x2 ) );
+    }
+
+    /*.........................................................................*/
+
+    void close() const noexcept {
+        if( obj->state <= 0 ){ return; } obj->state = 0;
+        obj->queue.clear(); obj->bytes = 0;
+        obj->cli.close(); onClose.emit();
+    }
+
+};}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+namespace nodepp { template< class T > class express_room_t {
+protected:
+
+    struct NODE {
+        map_t<ulong,express_ws_t<T>> list;
+        ulong sent = 0;
+        ulong drop = 0;
+    };  ptr_t<NODE> obj;
+
+public:
+
+    express_room_t() noexcept : obj( new NODE() ) {}
+
+    /*.........................................................................*/
+
+    void join ( const express_ws_t<T>& cli ) const noexcept { obj->list[ cli.get_id() ] = cli; }
+    void leave( const express_ws_t<T>& cli ) const noexcept { obj->list.erase( cli.get_id() ); }
+
+    ulong size()      const noexcept { return obj->list.size(); }
+    ulong get_sent()  const noexcept { return obj->sent; }
+    ulong get_drop()  const noexcept { return obj->drop; }
+
+    /*.........................................................................*/
+
+    ulong broadcast( const string_t& msg, ulong except=0, uchar opcode=0x1 ) const noexcept {
+        auto frame = express::ws::frame( msg, opcode ); array_t<ulong> gone; ulong out = 0;
+
+        forEach( item, obj->list.data() ){
+            if( item.first == except ){ continue; }
+            if( item.second.push( frame ) ){ out++; continue; }
+            gone.push( item.first );
+        }
+
+        forEach( item, gone ){ obj->list.erase( item ); }
+        obj->sent += out; obj->drop += gone.size(); return out;
+    }
+
+};}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+namespace nodepp { namespace express { namespace ws {
+
+    /* answers the upgrade in-router; the returned socket is closed when
+       the request is not a valid websocket handshake. */
+    template< class T >
+    express_ws_t<T> upgrade( T& cli ) {
+        if( !regex::test( cli.headers["Upgrade"], "websocket", true ) ||
+            !cli.headers.has( "Sec-WebSocket-Key" ) ){
+            cli.status(426).header( "Upgrade", "websocket" ).send( "upgrade required" );
+            return express_ws_t<T>();
+        }
+
+        cli.header( "Sec-WebSocket-Accept", accept( cli.headers["Sec-WebSocket-Key"] ) );
+        cli.header( "Connection", "Upgrade" ); cli.header( "Upgrade", "websocket" );
+        cli.status( 101 ).send(); return express_ws_t<T>( cli );
+    }
+
+}}}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#endif
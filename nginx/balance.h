@@ -0,0 +1,341 @@
+/*
+ * Copyright 2023 The Nodepp Project Authors. All Rights Reserved.
+ *
+ * Licensed under the MIT (the "License").  You may not use
+ * this file except in compliance with the License.  You can obtain a copy
+ * in the file LICENSE in the source distribution or at
+ * https://github.com/NodeppOficial/nodepp/blob/main/LICENSE
+ */
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#ifndef NODEPP_NGINX_BALANCE
+#define NODEPP_NGINX_BALANCE
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#include <nodepp/nodepp.h>
+#include <nodepp/timer.h>
+#include <nodepp/https.h>
+#include <nodepp/http.h>
+#include <nodepp/json.h>
+#include <nginx/pool.h>
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include <cstdlib>
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+namespace nodepp { namespace nginx { namespace balance {
+    enum POLICY { ROUND_ROBIN = 0, LEAST_CONN = 1, TWO_CHOICES = 2, HASH = 3 };
+}}}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+namespace nodepp { struct nginx_peer_t {
+    string_t href;
+    url_t    uri ;
+    ulong weight  = 1;
+    long  current = 0;          // smooth round-robin credit
+    ulong active  = 0;          // requests in flight
+    ulong until   = 0;          // ejected until, ms
+    bool  down    = 0;          // failed its active probes
+    uint  streak  = 0;          // probe results against the current state
+    uint  fails   = 0;          // connect errors in a row
+    ulong total   = 0;          // responses in the current window
+    ulong errors  = 0;          // 5xx in the current window
+    ulong requests= 0;
+    ulong ejected = 0;
+};}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+/* spreads a pipe entry over several upstreams. A peer leaves rotation when
+   `max_fails` connects in a row fail or at least `rate` of its answers in
+   the current window are 5xx (passive), or when `fall` active probes in a
+   row fail; it comes back after `eject` ms or `rise` good probes. With
+   every peer out, all of them are tried rather than none. */
+
+namespace nodepp { class nginx_balancer_t {
+protected:
+
+    struct NODE {
+        array_t<ptr_t<nginx_peer_t>>    peer;
+        std::vector<std::pair<ulong,uint>> ring; // consistent hash points
+        uint     policy = nginx::balance::ROUND_ROBIN;
+        string_t key;               // HASH: header or cookie name
+        bool     cookie = 0;
+        ulong    next   = 0;
+
+        uint     max_fails= 3;
+        ulong    eject    = 10000;
+        ulong    window   = 10000;
+        ulong    min_req  = 10;
+        float    rate     = 0.5f;
+        ulong    since    = 0;
+
+        string_t probe;             // path, empty = connect only
+        ulong    interval = 0;
+        ulong    timeout  = 2000;
+        uint     rise     = 1;
+        uint     fall     = 2;
+        ptr_t<int> timer;
+    };  ptr_t<NODE> obj;
+
+    /*.........................................................................*/
+
+    void build() const noexcept { obj->ring.clear();
+        for( uint x=0; x<obj->peer.size(); x++ ){
+        for( ulong y=0; y<obj->peer[x]->weight * 40; y++ ){
+             obj->ring.push_back({ _nginx_::hash( obj->peer[x]->href + "#" + string::to_string( y ) ), x });
+        }}   std::sort( obj->ring.begin(), obj->ring.end() );
+    }
+
+    bool alive( uint x, ulong now ) const noexcept {
+        return !obj->peer[x]->down && obj->peer[x]->until <= now;
+    }
+
+    /*.........................................................................*/
+
+    int round_robin( const array_t<uint>& list ) const noexcept {
+        long total = 0; int best = -1;
+        forEach( x, list ){ auto& p = obj->peer[x]; p->current += p->weight; total += p->weight;
+            if( best < 0 || p->current > obj->peer[best]->current ){ best = x; }
+        }   obj->peer[best]->current -= total; return best;
+    }
+
+    /* a->active/a->weight < b->active/b->weight */
+    bool lighter( uint a, uint b ) const noexcept {
+        return obj->peer[a]->active * obj->peer[b]->weight < obj->peer[b]->active * obj->peer[a]->weight;
+    }
+
+    int least_conn( const array_t<uint>& list ) const noexcept {
+        ulong off = obj->next++; int best = list[ off % list.size() ];
+        for( ulong x=0; x<list.size(); x++ ){ uint y = list[ ( off + x ) % list.size() ];
+             if( lighter( y, best ) ){ best = y; }
+        }    return best;
+    }
+
+    int two_choices( const array_t<uint>& list ) const noexcept {
+        if( list.size() == 1 ){ return list[0]; }
+        ulong a = ::rand() % list.size(), b = ::rand() % ( list.size()-1 ); if( b >= a ){ b++; }
+        return lighter( list[b], list[a] ) ? list[b] : list[a];
+    }
+
+    int hashed( const string_t& key, const array_t<uint>& list, ulong now ) const noexcept {
+        if( key.empty() || obj->ring.empty() ){ return round_robin( list ); }
+        auto it = std::lower_bound( obj->ring.begin(), obj->ring.end(), std::make_pair( _nginx_::hash( key ), 0u ) );
+        for( ulong x=0; x<obj->ring.size(); x++ ){
+             if( it == obj->ring.end() ){ it = obj->ring.begin(); }
+             if( list.size() < obj->peer.size() && !alive( it->second, now ) ){ it++; continue; }
+             return it->second;
+        }    return list[0];
+    }
+
+    /*.........................................................................*/
+
+    void eject( ptr_t<nginx_peer_t> p ) const noexcept {
+        p->until = process::now() + obj->eject; p->ejected++;
+        p->fails = 0; p->total = 0; p->errors = 0;
+    }
+
+    void mark( ptr_t<nginx_peer_t> p, bool ok ) const noexcept {
+        if( ok == !p->down ){ p->streak = 0; return; } p->streak++;
+        if( p->down && p->streak >= obj->rise ){ p->down = 0; p->until = 0; p->fails = 0; p->streak = 0; }
+        elif( !p->down && p->streak >= obj->fall ){ p->down = 1; p->streak = 0; }
+    }
+
+    void check( ptr_t<nginx_peer_t> p ) const noexcept {
+        auto self = type::bind( this ); bool tls = p->uri.protocol.to_lower_case() == "https";
+
+        if( obj->probe.empty() ){ if( tls ){
+            _nginx_::connect( (https_t*) nullptr, p->uri.hostname, p->uri.port,
+                [=]( https_t fd ){ fd.close(); self->mark( p, 1 ); }, [=]( except_t ){ self->mark( p, 0 ); } );
+        } else {
+            _nginx_::connect( (http_t*) nullptr, p->uri.hostname, p->uri.port,
+                [=]( http_t  fd ){ fd.close(); self->mark( p, 1 ); }, [=]( except_t ){ self->mark( p, 0 ); } );
+        }   return; }
+
+        fetch_t args; args.method = "GET"; args.timeout = obj->timeout;
+        args.url = p->uri.protocol + "://" + p->uri.hostname + ":" + string::to_string( p->uri.port ) + obj->probe;
+        args.headers = header_t({ { "Host", p->uri.hostname }, { "Connection", "close" } });
+
+        if( tls ){ ssl_t ssl;
+            https::fetch( args, &ssl ).fail([=](...){ self->mark( p, 0 ); })
+                                      .then([=]( https_t cli ){ self->mark( p, cli.status>0 && cli.status<500 ); cli.close(); });
+        } else {
+            http::fetch ( args ).fail([=](...){ self->mark( p, 0 ); })
+                                .then([=]( http_t  cli ){ self->mark( p, cli.status>0 && cli.status<500 ); cli.close(); });
+        }
+    }
+
+public:
+
+    nginx_balancer_t() noexcept : obj( new NODE() ) {}
+
+    /*.........................................................................*/
+
+    const nginx_balancer_t& add( string_t href, ulong weight=1 ) const noexcept {
+        auto p = ptr_t<nginx_peer_t>( new nginx_peer_t() );
+        p->href = href; p->uri = url::parse( href ); p->weight = max( weight, 1UL );
+        obj->peer.push( p ); build(); return (*this);
+    }
+
+    void set_policy( uint policy ) const noexcept { obj->policy = policy; }
+
+    /* HASH policy key: a request header, or a cookie when `cookie` is set */
+    void set_key( string_t name, bool cookie=false ) const noexcept { obj->key = name; obj->cookie = cookie; }
+
+    void set_passive( uint max_fails, float rate, ulong window, ulong eject ) const noexcept {
+         obj->max_fails = max( max_fails, 1u ); obj->rate = rate;
+         obj->window = max( window, 1UL ); obj->eject = eject;
+    }
+
+    /* probes every peer each `interval` ms with a GET to `path`, or only a
+       connect when it is empty; 0 stops probing. */
+    void set_probe( string_t path, ulong interval, ulong timeout=2000, uint rise=1, uint fall=2 ) const noexcept {
+        obj->probe = path; obj->interval = interval; obj->timeout = timeout;
+        obj->rise  = max( rise, 1u ); obj->fall = max( fall, 1u ); stop();
+        if( interval == 0 ){ return; } auto self = type::bind( this );
+        obj->timer = timer::interval([=](){ forEach( p, self->obj->peer ){ self->check( p ); } }, interval );
+    }
+
+    /* the probe timer holds the balancer, stop() lets it go once the
+       requests that picked from it are done. */
+    void stop() const noexcept {
+        if( obj->timer != nullptr ){ timer::clear( obj->timer ); obj->timer = nullptr; }
+    }
+
+    /*.........................................................................*/
+
+    bool  empty() const noexcept { return obj->peer.empty(); }
+    ulong size()  const noexcept { return obj->peer.size();  }
+
+    ptr_t<nginx_peer_t> get_peer( uint x ) const noexcept { return obj->peer[x]; }
+
+    ulong get_alive() const noexcept { ulong out = 0; auto now = process::now();
+        for( uint x=0; x<obj->peer.size(); x++ ){ if( alive( x, now ) ){ out++; } } return out;
+    }
+
+    /*.........................................................................*/
+
+    /* index of the peer for a request hashed on `key`, -1 without peers */
+    int pick( const string_t& key ) const noexcept {
+        if( obj->peer.empty() ){ return -1; } auto now = process::now();
+        array_t<uint> list; for( uint x=0; x<obj->peer.size(); x++ ){ if( alive( x, now ) ){ list.push( x ); } }
+        if( list.empty() ){ for( uint x=0; x<obj->peer.size(); x++ ){ list.push( x ); } }
+
+        int out; switch( obj->policy ){
+            case nginx::balance::LEAST_CONN : out = least_conn ( list );            break;
+            case nginx::balance::TWO_CHOICES: out = two_choices( list );            break;
+            case nginx::balance::HASH       : out = hashed     ( key, list, now );  break;
+            default                         : out = round_robin( list );            break;
+        }
+
+        obj->peer[out]->active++; obj->peer[out]->requests++; return out;
+    }
+
+    /* a peer other than those in `skip`, preferring live ones, for a retry
+       or a hedge; -1 when every peer was tried. HASH falls back to round
+       robin, the hashed peer is the one being avoided. */
+    int pick_other( const array_t<int>& skip ) const noexcept {
+        auto now = process::now(); array_t<uint> list, rest;
+        for( uint x=0; x<obj->peer.size(); x++ ){ bool seen = 0;
+             forEach( y, skip ){ if( y == (int) x ){ seen = 1; break; } } if( seen ){ continue; }
+             if( alive( x, now ) ){ list.push( x ); } else { rest.push( x ); }
+        }    if( list.empty() ){ list = rest; } if( list.empty() ){ return -1; }
+
+        int out; switch( obj->policy ){
+            case nginx::balance::LEAST_CONN : out = least_conn ( list ); break;
+            case nginx::balance::TWO_CHOICES: out = two_choices( list ); break;
+            default                         : out = round_robin( list ); break;
+        }
+
+        obj->peer[out]->active++; obj->peer[out]->requests++; return out;
+    }
+
+    template< class T >
+    int pick_for( const T& cli ) const noexcept {
+        if( obj->policy != nginx::balance::HASH || obj->key.empty() ){ return pick( nullptr ); }
+        if( obj->cookie ){ return pick( cli.get_cookie( obj->key ) ); }
+        return pick( cli.headers.has( obj->key ) ? cli.headers[ obj->key ] : string_t() );
+    }
+
+    /* outcome of a picked request: the upstream status, 0 when it could
+       not be reached. Every pick() must be reported or released exactly
+       once. */
+    void report( int x, uint status ) const noexcept {
+        if( x < 0 || (ulong) x >= obj->peer.size() ){ return; }
+        auto p = obj->peer[x]; if( p->active > 0 ){ p->active--; } auto now = process::now();
+
+        if( now - obj->since >= obj->window ){ obj->since = now;
+            forEach( y, obj->peer ){ y->total = 0; y->errors = 0; }
+        }
+
+        if( status == 0 ){ if( ++p->fails >= obj->max_fails ){ eject( p ); } return; }
+        p->fails = 0; p->total++; if( status >= 500 ){ p->errors++; }
+        if( p->total >= obj->min_req && p->errors >= p->total * obj->rate ){ eject( p ); }
+    }
+
+    /* a pick whose peer was never contacted, e.g. a request answered from
+       the cache: the slot is given back and nothing is counted for it */
+    void release( int x ) const noexcept {
+        if( x < 0 || (ulong) x >= obj->peer.size() ){ return; }
+        auto p = obj->peer[x]; if( p->active > 0 ){ p->active--; }
+    }
+
+};}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+namespace nodepp { namespace nginx { namespace balance {
+
+    /* builds the balancer of a pipe entry:
+       { "upstream": [ { "href": "http://10.0.0.1:8000", "weight": 2 }, ... ],
+         "balance" : "round-robin" | "least-conn" | "two-choices" | "hash",
+         "hash"    : "header:X-User" | "cookie:sid",
+         "health"  : { "path": "/health", "interval": 2000, "timeout": 1000 },
+         "passive" : { "fails": 3, "rate": 0.5, "window": 10000, "eject": 10000 } }
+       an entry without "upstream" gets an empty balancer. */
+    inline nginx_balancer_t parse( object_t args ) {
+        nginx_balancer_t out; if( !args["upstream"].has_value() ){ return out; }
+
+        forEach( item, args["upstream"].as<array_t<object_t>>() ){
+            if( !item["href"].has_value() ){ continue; }
+            out.add( item["href"].as<string_t>(), item["weight"].has_value() ? item["weight"].as<uint>() : 1 );
+        }
+
+        auto mode = args["balance"].has_value() ? args["balance"].as<string_t>().to_lower_case() : string_t( "round-robin" );
+          if( mode == "least-conn"  ){ out.set_policy( nginx::balance::LEAST_CONN  ); }
+        elif( mode == "two-choices" ){ out.set_policy( nginx::balance::TWO_CHOICES ); }
+        elif( mode == "hash"        ){ out.set_policy( nginx::balance::HASH        ); }
+
+        if( args["hash"].has_value() ){ auto key = args["hash"].as<string_t>();
+            if( regex::test( key, "^cookie:", true ) ){ out.set_key( key.slice(7), true ); }
+            elif( regex::test( key, "^header:", true ) ){ out.set_key( key.slice(7) ); }
+            else { out.set_key( key ); }
+        }
+
+        if( args["passive"].has_value() ){ auto y = args["passive"];
+            out.set_passive( y["fails"] .has_value() ? y["fails"] .as<uint>()   : 3,
+                             y["rate"]  .has_value() ? y["rate"]  .as<float>()  : 0.5f,
+                             y["window"].has_value() ? y["window"].as<ulong>()  : 10000,
+                             y["eject"] .has_value() ? y["eject"] .as<ulong>()  : 10000 );
+        }
+
+        if( args["health"].has_value() ){ auto y = args["health"];
+            out.set_probe( y["path"]    .has_value() ? y["path"]    .as<string_t>() : string_t(),
+                           y["interval"].has_value() ? y["interval"].as<ulong>()    : 2000,
+                           y["timeout"] .has_value() ? y["timeout"] .as<ulong>()    : 2000 );
+        }
+
+        return out;
+    }
+
+}}}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#endif
@@ -0,0 +1,611 @@
+/*
+ * Copyright 2023 The Nodepp Project Authors. All Rights Reserved.
+ *
+ * Licensed under the MIT (the "License").  You may not use
+ * this file except in compliance with the License.  You can obtain a copy
+ * in the file LICENSE in the source distribution or at
+ * https://github.com/NodeppOficial/nodepp/blob/main/LICENSE
+ */
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#ifndef NODEPP_NGINX_CACHE
+#define NODEPP_NGINX_CACHE
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#include <nodepp/nodepp.h>
+#include <nodepp/json.h>
+#include <express/defer.h>
+#include <express/aio.h>
+#include <nginx/pool.h>
+
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>
+#include <ctime>
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+namespace nodepp { struct nginx_entry_t {
+    string_t key;
+    string_t status;            // status line
+    string_t head;              // header lines
+    string_t body;
+    string_t etag;
+    string_t modified;          // Last-Modified
+    ulong stored = 0;           // wall clock ms
+    ulong fresh  = 0;           // ms it may be served without asking
+    ulong swr    = 0;           // stale-while-revalidate, ms past `fresh`
+    ulong sie    = 0;           // stale-if-error, ms past `fresh`
+    ulong age    = 0;           // Age the upstream reported, s
+    ulong seq    = 0;           // last use, for eviction
+    bool  busy   = 0;           // a refresh is in flight
+};}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+namespace nodepp { namespace _nginx_ {
+
+    inline ulong wall() {
+        struct timespec ts; clock_gettime( CLOCK_REALTIME, &ts );
+        return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000UL;
+    }
+
+    /* IMF-fixdate, the only form RFC 9110 lets senders produce */
+    inline ulong date( const string_t& data ) {
+        struct tm t; memset( &t, 0, sizeof(t) ); string_t y = data;
+        if( ::strptime( y.get(), "%a, %d %b %Y %H:%M:%S", &t ) == nullptr ){ return 0; }
+        return (ulong) ::timegm( &t ) * 1000UL;
+    }
+
+    inline bool cacheable( uint code ) {
+        switch( code ){
+            case 200: case 203: case 204: case 300: case 301:
+            case 404: case 405: case 410: case 414: case 501: return true;
+            default : return false;
+        }
+    }
+
+    /* reads the freshness rules of a response into `y`; false when a
+       shared cache must not keep it. */
+    inline bool freshness( nginx_entry_t& y, const string_t& head, bool auth ) {
+        string_t name, value; ulong expires=0, date=0, pos=0; long age=-1, shared=-1;
+        bool expl = 0, pub = 0, strict = 0; y.fresh = 0; y.swr = 0; y.sie = 0; y.age = 0;
+
+        while( pos < head.size() ){
+            ulong end = pos; while( end<head.size() && head[end]!='\n' ){ end++; }
+            auto line = head.slice( pos, end+1 ); pos = end + 1;
+            if( !field( line, name, value ) ){ continue; }
+
+              if( name == "etag"          ){ y.etag     = value; }
+            elif( name == "last-modified" ){ y.modified = value; }
+            elif( name == "expires"       ){ expires    = _nginx_::date( value ); expl = 1; }
+            elif( name == "date"          ){ date       = _nginx_::date( value ); }
+            elif( name == "age"           ){ y.age      = string::to_ulong( value ); }
+            elif( name == "set-cookie"    ){ return false; }
+            elif( name == "cache-control" ){
+                forEach( item, string::split( value.to_lower_case(), ',' ) ){
+                    auto d = regex::replace_all( item, "[ \"]", "" );
+                      if( d == "no-store" || d == "private" ){ return false; }
+                    elif( d == "no-cache" ){ age = 0; expl = 1; }
+                    elif( d == "public"   ){ pub = 1; }
+                    elif( d == "must-revalidate" || d == "proxy-revalidate" ){ strict = 1; }
+                    elif( regex::test( d, "^s-maxage=" ) ){ shared = string::to_ulong( d.slice(9) ); expl = 1; }
+                    elif( regex::test( d, "^max-age="  ) ){ if( age != 0 ){ age = string::to_ulong( d.slice(8) ); } expl = 1; }
+                    elif( regex::test( d, "^stale-while-revalidate=" ) ){ y.swr = string::to_ulong( d.slice(23) ) * 1000; }
+                    elif( regex::test( d, "^stale-if-error="         ) ){ y.sie = string::to_ulong( d.slice(15) ) * 1000; }
+                }
+            }
+        }
+
+        if( auth && !pub && shared < 0 ){ return false; } if( strict ){ y.sie = 0; y.swr = 0; }
+          if( shared >= 0 && age != 0 ){ y.fresh = shared * 1000; }
+        elif( age    >= 0 ){ y.fresh = age * 1000; }
+        elif( expires > 0  ){ auto now = date > 0 ? date : wall(); y.fresh = expires > now ? expires - now : 0; }
+        else { y.fresh = 0; }
+
+        y.fresh = y.fresh > y.age * 1000 ? y.fresh - y.age * 1000 : 0;
+        return expl || !y.etag.empty() || !y.modified.empty();
+    }
+
+    template< class T > void flush( const T& cli, string_t data ) {
+        auto wrt = type::bind( _file_::write() );
+        process::poll::add([=](){
+            if( !cli.is_available() ){ return -1; }
+            if((*wrt)( &cli, data )==1 ){ return 1; }
+            cli.close(); return -1;
+        });
+    }
+
+}}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+/* responses of one pipe entry, keyed by method, host, URL and the request
+   headers the response Varies on. The memory tier holds up to `limit`
+   bytes and drops the least recently used entries; when a directory is
+   set, entries are also written there (from express::defer, off the
+   request path) and read back through express::aio when memory misses
+   them. Only files listed in the disk index are ever opened. */
+
+namespace nodepp { class nginx_cache_t {
+protected:
+
+    struct ORDER {
+        string_t key;
+        ulong    seq = 0;
+    };
+
+    struct NODE {
+        map_t<string_t,ptr_t<nginx_entry_t>> list;
+        map_t<string_t,string_t> vary;   // primary key -> Vary names, up to 4096
+        queue_t<ORDER> order;
+        ulong size   = 0;
+        ulong limit  = CHUNK_MB(64);
+        ulong object = CHUNK_MB(1);      // largest body kept
+        ulong seq    = 0;
+        bool  enabled= 0;
+
+        string_t         disk;
+        map_t<string_t,ulong> files;     // path -> bytes, what the disk holds
+        queue_t<string_t> written;
+        ulong disk_size  = 0;
+        ulong disk_limit = CHUNK_MB(1024);
+
+        map_t<string_t,ptr_t<nginx_flight_t>> flight;
+        map_t<string_t,ulong> pass;      // key -> ms until it may collapse again
+        ulong wait   = 3000;             // ms a follower waits for the head
+        ulong ban    = 120000;           // ms a key that was not shared bypasses collapsing
+
+        ulong hits = 0, miss = 0, stale = 0, revalidated = 0;
+        ulong errors = 0, stored = 0, evicted = 0, bypass = 0;
+        ulong collapsed = 0, fallback = 0;
+    };  ptr_t<NODE> obj;
+
+    /*.........................................................................*/
+
+    ulong weight( const ptr_t<nginx_entry_t>& y ) const noexcept {
+        return y->key.size() + y->status.size() + y->head.size() + y->body.size() + 128;
+    }
+
+    void use( const ptr_t<nginx_entry_t>& y ) const noexcept {
+        ORDER o; o.key = y->key; o.seq = y->seq = ++obj->seq; obj->order.push( o );
+        if( obj->order.size() > obj->list.size() * 4 + 64 ){ // drop records of older uses
+            for( ulong x=obj->order.size(); x-->0; ){
+                 auto z = obj->order.first()->data; obj->order.shift();
+                 if( obj->list.has( z.key ) && obj->list[z.key]->seq == z.seq ){ obj->order.push( z ); }
+            }
+        }
+    }
+
+    void evict() const noexcept {
+        while( obj->size > obj->limit && !obj->order.empty() ){
+            auto z = obj->order.first()->data; obj->order.shift();
+            if( !obj->list.has( z.key ) || obj->list[z.key]->seq != z.seq ){ continue; }
+            obj->size -= weight( obj->list[z.key] ); obj->list.erase( z.key ); obj->evicted++;
+        }
+    }
+
+    void keep( ptr_t<nginx_entry_t> y ) const noexcept {
+        if( obj->list.has( y->key ) ){ obj->size -= weight( obj->list[y->key] ); }
+        obj->list[y->key] = y; obj->size += weight( y ); use( y ); evict();
+    }
+
+    string_t varies( const string_t& head ) const noexcept {
+        string_t vary, name, value; ulong pos = 0;
+        while( pos < head.size() ){
+            ulong end = pos; while( end<head.size() && head[end]!='\n' ){ end++; }
+            if( _nginx_::field( head.slice( pos, end+1 ), name, value ) && name == "vary" )
+              { vary += ( vary.empty() ? "" : "," ) + value; } pos = end + 1;
+        }   return vary;
+    }
+
+    /*.........................................................................*/
+
+    string_t file( const string_t& key ) const noexcept {
+        return obj->disk + "/" + string::format( "%016lx", _nginx_::hash( key ) ) + ".cache";
+    }
+
+    void save( ptr_t<nginx_entry_t> y ) const noexcept {
+        if( obj->disk.empty() ){ return; } auto self = type::bind( this ); auto dir = file( y->key );
+        auto data = string::format( "NGXC %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu\n",
+            y->stored, y->fresh, y->swr, y->sie, y->age, y->key.size(), y->status.size(),
+            y->head.size(), y->etag.size(), y->modified.size(), y->body.size()
+        ) + y->key + y->status + y->head + y->etag + y->modified + y->body;
+
+        express::defer::add([=](){
+            int fd = ::open( ( dir + ".tmp" ).get(), O_WRONLY | O_CREAT | O_TRUNC, 0644 ); if( fd < 0 ){ return; }
+            ulong pos = 0; while( pos < data.size() ){
+                auto c = ::write( fd, data.get() + pos, data.size() - pos );
+                if ( c < 0 && errno == EINTR ){ continue; } if( c <= 0 ){ break; } pos += c;
+            }   ::close( fd );
+            if( pos < data.size() || ::rename( ( dir + ".tmp" ).get(), dir.get() ) != 0 ){ ::unlink( ( dir + ".tmp" ).get() ); return; }
+
+            auto& n = self->obj; if( n->files.has( dir ) ){ n->disk_size -= n->files[dir]; }
+            else { n->written.push( dir ); } n->files[dir] = data.size(); n->disk_size += data.size();
+            while( n->disk_size > n->disk_limit && !n->written.empty() ){
+                auto z = n->written.first()->data; n->written.shift(); if( !n->files.has( z ) ){ continue; }
+                n->disk_size -= n->files[z]; n->files.erase( z ); ::unlink( z.get() );
+            }
+        });
+    }
+
+    void forget( const string_t& dir ) const noexcept {
+        if( !obj->files.has( dir ) ){ return; }
+        obj->disk_size -= obj->files[dir]; obj->files.erase( dir );
+    }
+
+    /* lists what an earlier run left in the directory, so the index knows
+       it; leftovers of interrupted writes are removed. */
+    void scan() const noexcept {
+        auto dir = ::opendir( obj->disk.get() ); if( dir == nullptr ){ return; }
+        while( auto item = ::readdir( dir ) ){
+            string_t name = item->d_name; struct stat st;
+            if( !regex::test( name, "\\.(cache|tmp)$" ) ){ continue; } auto path = obj->disk + "/" + name;
+            if( regex::test( name, "\\.tmp$" ) ){ ::unlink( path.get() ); continue; }
+            if( ::stat( path.get(), &st ) != 0 || !S_ISREG( st.st_mode ) || st.st_size <= 0 ){ continue; }
+            forget( path ); obj->files[path] = st.st_size; obj->written.push( path ); obj->disk_size += st.st_size;
+        }   ::closedir( dir );
+    }
+
+    /* `cb` gets the entry kept on disk for `key`, or nullptr; the file is
+       read by express::aio and `cb` runs on the loop thread. */
+    void load( const string_t& key, function_t<void,ptr_t<nginx_entry_t>> cb ) const noexcept {
+        auto dir = file( key ); if( obj->disk.empty() || !obj->files.has( dir ) ){ cb( nullptr ); return; }
+        int fd = ::open( dir.get(), O_RDONLY | O_CLOEXEC ); if( fd < 0 ){ forget( dir ); cb( nullptr ); return; }
+
+        auto ref = ptr_t<express_fd_t>( new express_fd_t() ); ref->fd = fd; ref->size = obj->files[dir];
+        auto self = type::bind( this ); express::aio::engine().read( ref, 0, ref->size, [=]( string_t data ){
+            auto y = self->parse( key, data ); if( y == nullptr ){ self->forget( dir ); } cb( y );
+        });
+    }
+
+    ptr_t<nginx_entry_t> parse( const string_t& key, const string_t& data ) const noexcept {
+        if( data.empty() ){ return nullptr; }
+        auto y = ptr_t<nginx_entry_t>( new nginx_entry_t() ); ulong len[6]; int off = 0;
+        if( ::sscanf( data.get(), "NGXC %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu\n%n",
+            &y->stored, &y->fresh, &y->swr, &y->sie, &y->age,
+            &len[0], &len[1], &len[2], &len[3], &len[4], &len[5], &off ) != 11 || off <= 0 ){ return nullptr; }
+
+        ulong at = off, all = at; for( auto x: len ){ all += x; } if( all != data.size() ){ return nullptr; }
+        auto take = [&]( ulong n ){ auto out = data.slice( at, at + n ); at += n; return out; };
+        y->key = take( len[0] ); y->status = take( len[1] ); y->head = take( len[2] );
+        y->etag= take( len[3] ); y->modified= take( len[4] ); y->body = take( len[5] );
+        if( y->key != key ){ return nullptr; } return y;
+    }
+
+public:
+
+    nginx_cache_t() noexcept : obj( new NODE() ) {}
+
+    /*.........................................................................*/
+
+    void set_enabled( bool value ) const noexcept { obj->enabled = value; }
+    void set_limit  ( ulong bytes, ulong object ) const noexcept { obj->limit = bytes; obj->object = object; evict(); }
+
+    void set_disk( string_t dir, ulong bytes ) const noexcept {
+         obj->disk = dir; obj->disk_limit = bytes; if( dir.empty() ){ return; }
+         ::mkdir( dir.get(), 0755 ); scan();
+    }
+
+    bool  is_enabled()     const noexcept { return obj->enabled; }
+    ulong get_object()     const noexcept { return obj->object;  }
+    ulong size()           const noexcept { return obj->size;    }
+    ulong get_hits()       const noexcept { return obj->hits;    }
+    ulong get_miss()       const noexcept { return obj->miss;    }
+    ulong get_stale()      const noexcept { return obj->stale;   }
+    ulong get_errors()     const noexcept { return obj->errors;  }
+    ulong get_stored()     const noexcept { return obj->stored;  }
+    ulong get_evicted()    const noexcept { return obj->evicted; }
+    ulong get_bypass()     const noexcept { return obj->bypass;  }
+    ulong get_revalidated()const noexcept { return obj->revalidated; }
+
+    /*.........................................................................*/
+
+    /* GET and HEAD only, and not when the client asks to skip caches */
+    template< class T > bool usable( const T& cli ) const noexcept {
+        if( !obj->enabled ){ return false; }
+        if( cli.method != "GET" && cli.method != "HEAD" ){ obj->bypass++; return false; }
+        if( cli.headers.has( "Cache-Control" ) && regex::test( cli.headers["Cache-Control"], "no-cache|no-store", true ) )
+          { obj->bypass++; return false; }
+        if( cli.headers.has( "Pragma" ) && regex::test( cli.headers["Pragma"], "no-cache", true ) )
+          { obj->bypass++; return false; }
+        return true;
+    }
+
+    template< class T > string_t primary( const T& cli ) const noexcept {
+        return "GET " + cli.get_header( T::HOST ).to_lower_case() + cli.path + cli.search;
+    }
+
+    template< class T > string_t variant( const T& cli, const string_t& key ) const noexcept {
+        if( !obj->vary.has( key ) ){ return key; } string_t out = key;
+        forEach( item, string::split( obj->vary[key], ',' ) ){
+            auto name = regex::replace_all( item, " ", "" ); if( name.empty() ){ continue; }
+            out += "\n" + name + ":" + ( cli.headers.has( name ) ? cli.headers[name] : string_t() );
+        }   return out;
+    }
+
+    /*.........................................................................*/
+
+    /* `cb` gets the entry for `cli` or nullptr: right away from memory,
+       once express::aio read it from disk otherwise. */
+    template< class T > void get( const T& cli, function_t<void,ptr_t<nginx_entry_t>> cb ) const noexcept {
+        auto key = variant( cli, primary( cli ) ); auto self = type::bind( this );
+        if( obj->list.has( key ) ){ auto y = obj->list[key]; use( y ); cb( y ); return; }
+        load( key, [=]( ptr_t<nginx_entry_t> y ){
+              if( self->obj->list.has( key ) ){ y = self->obj->list[key]; self->use( y ); } // stored meanwhile
+            elif( y != nullptr ){ self->keep( y ); } cb( y );
+        });
+    }
+
+    /* turns a captured response into an entry; nullptr when it must not
+       be shared. It is only kept when `store` is set. */
+    template< class T > ptr_t<nginx_entry_t> put( const T& cli, ptr_t<nginx_capture_t> res, bool store=true ) const noexcept {
+        if( !res->done || res->full ){ return nullptr; }
+        auto code = string::to_ulong( res->status.slice( 9, 12 ) );
+        auto method = res->method.empty() ? cli.method : res->method; // a HEAD is refreshed as GET
+        if( !_nginx_::cacheable( code ) || method != "GET" ){ return nullptr; }
+
+        auto y = ptr_t<nginx_entry_t>( new nginx_entry_t() );
+        y->status = res->status; y->head = res->head; y->body = res->body; y->stored = _nginx_::wall();
+        if( !_nginx_::freshness( *y, y->head, cli.headers.has( "Authorization" ) ) ){ return nullptr; }
+
+        auto vary = varies( y->head );
+        if( regex::test( vary, "\\*" ) ){ return nullptr; } auto key = primary( cli );
+        if( vary.empty() ){ obj->vary.erase( key ); } else {
+            if( obj->vary.size() >= 4096 && !obj->vary.has( key ) ){ obj->vary.clear(); }
+            obj->vary[key] = vary;
+        }
+        y->key = variant( cli, key ); if( !store ){ return y; }
+
+        keep( y ); save( y ); obj->stored++; return y;
+    }
+
+    /* a 304 renews the entry with the freshness rules it came with */
+    void renew( ptr_t<nginx_entry_t> y, ptr_t<nginx_capture_t> res ) const noexcept {
+        y->stored = _nginx_::wall(); y->age = 0; auto etag = y->etag, mod = y->modified;
+        _nginx_::freshness( *y, y->head + res->head, false ); // the 304 has the last word
+        if( y->etag.empty() ){ y->etag = etag; } if( y->modified.empty() ){ y->modified = mod; }
+        obj->revalidated++; save( y );
+    }
+
+    /*.........................................................................*/
+
+    /* whether a response head, known before its body, may be streamed to
+       other requests for the same key: the rules of put(), and a Vary that
+       was already part of the key when the flight started. */
+    template< class T > bool shareable( const T& cli, const string_t& status, const string_t& head, const string_t& vary ) const noexcept {
+        auto code = string::to_ulong( status.slice( 9, 12 ) );
+        if( !_nginx_::cacheable( code ) || cli.method != "GET" ){ return false; }
+        nginx_entry_t y; if( !_nginx_::freshness( y, head, cli.headers.has( "Authorization" ) ) ){ return false; }
+        return varies( head ) == vary;
+    }
+
+    /* the Vary names known for the resource `cli` asks for */
+    template< class T > string_t vary( const T& cli ) const noexcept {
+        auto key = primary( cli ); return obj->vary.has( key ) ? obj->vary[key] : string_t();
+    }
+
+    void set_collapse( ulong wait, ulong ban ) const noexcept { obj->wait = wait; obj->ban = ban; }
+
+    ulong get_wait()      const noexcept { return obj->wait;      }
+    ulong get_collapsed() const noexcept { return obj->collapsed; }
+    ulong get_fallback()  const noexcept { return obj->fallback;  }
+
+    /* false while `key` answered something that could not be shared */
+    bool collapsible( const string_t& key ) const noexcept {
+        if( obj->wait == 0 ){ return false; } if( !obj->pass.has( key ) ){ return true; }
+        if( process::now() < obj->pass[key] ){ return false; } obj->pass.erase( key ); return true;
+    }
+
+    void pass( const string_t& key ) const noexcept {
+        if( obj->pass.size() >= 4096 ){ obj->pass.clear(); }
+        obj->pass[key] = process::now() + obj->ban;
+    }
+
+    /* the flight to follow for `key`; nullptr when there is none, or it can
+       no longer be joined: it failed, ended, dropped its start or never
+       got a head within the wait. */
+    ptr_t<nginx_flight_t> follow( const string_t& key ) const noexcept {
+        if( !obj->flight.has( key ) ){ return nullptr; } auto f = obj->flight[key];
+        if( f->join && !f->fail && !f->done && ( f->open || process::now() - f->since < obj->wait ) )
+          { obj->collapsed++; return f; }
+        obj->flight.erase( key ); return nullptr;
+    }
+
+    ptr_t<nginx_flight_t> lead( const string_t& key ) const noexcept {
+        auto f = ptr_t<nginx_flight_t>( new nginx_flight_t() );
+        f->since = process::now(); obj->flight[key] = f; return f;
+    }
+
+    void land( const string_t& key, const ptr_t<nginx_flight_t>& f ) const noexcept {
+        if( obj->flight.has( key ) && obj->flight[key].get() == f.get() ){ obj->flight.erase( key ); }
+    }
+
+    /*.........................................................................*/
+
+    void count_hit()   const noexcept { obj->hits++;   }
+    void count_miss()  const noexcept { obj->miss++;   }
+    void count_stale() const noexcept { obj->stale++;  }
+    void count_error() const noexcept { obj->errors++; }
+    void count_fallback() const noexcept { obj->fallback++; }
+
+    void clear() const noexcept { obj->list.clear(); obj->vary.clear(); obj->order.clear(); obj->size = 0; }
+
+};}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+namespace nodepp { namespace nginx { namespace cache {
+
+    /* "cache": { "size": bytes, "object": bytes, "disk": dir, "disk_size": bytes,
+                  "collapse": ms, "pass": ms }
+       an entry without "cache" gets a disabled cache; "collapse": 0 turns
+       request collapsing off. */
+    inline nginx_cache_t parse( object_t args ) {
+        nginx_cache_t out; if( !args["cache"].has_value() ){ return out; }
+        auto y = args["cache"]; out.set_enabled( true );
+        out.set_limit( y["size"]  .has_value() ? y["size"]  .as<ulong>() : CHUNK_MB(64),
+                       y["object"].has_value() ? y["object"].as<ulong>() : CHUNK_MB(1) );
+        if( y["disk"].has_value() ){
+            out.set_disk( y["disk"].as<string_t>(), y["disk_size"].has_value() ? y["disk_size"].as<ulong>() : CHUNK_MB(1024) );
+        }
+        out.set_collapse( y["collapse"].has_value() ? y["collapse"].as<ulong>() : 3000,
+                          y["pass"]    .has_value() ? y["pass"]    .as<ulong>() : 120000 );
+        return out;
+    }
+
+    /*.........................................................................*/
+
+    /* writes an entry out as a complete response; a matching If-None-Match
+       gets a 304 instead. */
+    template< class T >
+    void reply( const T& cli, ptr_t<nginx_entry_t> y, string_t tag ) {
+        auto age = y->age + ( _nginx_::wall() - y->stored ) / 1000;
+        auto end = "Age: " + string::to_string( age ) + "\r\nX-Cache: " + tag + "\r\nConnection: close\r\n";
+
+        if( !y->etag.empty() && cli.headers.has( "If-None-Match" ) ){
+        forEach( item, string::split( cli.headers["If-None-Match"], ',' ) ){
+            auto tag = regex::replace_all( item, " ", "" ); if( tag != y->etag && tag != "*" ){ continue; }
+            _nginx_::flush( cli, "HTTP/1.1 304 Not Modified\r\nETag: " + y->etag + "\r\n" + end + "\r\n" ); return;
+        }}
+
+        auto data = y->status + y->head + "Content-Length: " + string::to_string( y->body.size() ) + "\r\n" + end + "\r\n";
+        if( cli.method != "HEAD" ){ data += y->body; } _nginx_::flush( cli, data );
+    }
+
+    /*.........................................................................*/
+
+    /* asks the upstream about `y` with its validators, without involving
+       the client; `cb` gets the status (0: unreachable) and what came back */
+    template< class S, class T >
+    void revalidate( nginx_cache_t cache, nginx_pool_t<S>& pool, const T& cli, url_t uri, string_t pth, header_t hdr,
+                     ulong tmo, ptr_t<nginx_entry_t> y, function_t<void,uint,ptr_t<nginx_capture_t>> cb ) {
+        hdr.erase( "If-None-Match" ); hdr.erase( "If-Modified-Since" );
+        if( !y->etag.empty()     ){ hdr["If-None-Match"]     = y->etag;     }
+        if( !y->modified.empty() ){ hdr["If-Modified-Since"] = y->modified; }
+
+        auto req = nginx::pool::prepare( cli, pth, hdr, tmo ); req->quiet = 1; req->nobody = 0;
+        req->head = regex::replace( req->head, "^HEAD ", "GET " ); // refresh the body too
+        req->capture = ptr_t<nginx_capture_t>( new nginx_capture_t() ); req->capture->method = "GET";
+        req->capture->limit = cache.get_object(); auto res = req->capture;
+
+        y->busy = 1; nginx::pool::exchange( pool, cli, uri, req, [=]( uint code, bool ){
+            y->busy = 0; cb( code, res );
+        });
+    }
+
+    /*.........................................................................*/
+
+    /* streams the flight `f` to `cli` from its first byte. When the leader
+       fails before its head is out, or no head comes within the wait, `cli`
+       goes upstream on its own. */
+    template< class S, class T >
+    void trail( nginx_cache_t cache, nginx_pool_t<S>& pool, const T& cli, url_t uri, string_t pth, header_t hdr,
+                ulong tmo, function_t<void,uint> report, function_t<void,uint> release, ptr_t<nginx_flight_t> f ) {
+        auto pos = ptr_t<ulong>( new ulong( f->base ) ); f->reader.push( pos );
+        auto wrt = type::bind( _file_::write() ); auto data = type::bind( string_t() );
+        auto end = process::now() + cache.get_wait(); auto pl = &pool;
+
+        auto leave = [=](){ *pos = ~0UL; f->trim(); release( f->open ? f->code : 200 ); };
+
+        process::poll::add([=](){
+            if( !cli.is_available() ){ leave(); return -1; }
+            if( data->empty() ){
+                if( !f->open ){
+                    if( !f->fail && process::now() < end ){ return 1; } *pos = ~0UL; cache.count_fallback();
+                    nginx::pool::forward( *pl, cli, uri, pth, hdr, tmo, report ); return -1;
+                }
+                if( *pos < f->base + f->buff.size() ){ *data = f->buff.slice( *pos - f->base ); }
+                elif( f->done || f->fail ){ leave(); cli.close(); return -1; }
+                else { return 1; }
+            }
+            if((*wrt)( &cli, *data )==1 ){ return 1; }
+            if( wrt->state<=0 ){ leave(); cli.close(); return -1; }
+            *pos += data->size(); *data = nullptr; f->trim(); return 1;
+        });
+    }
+
+    /*.........................................................................*/
+
+    /* fresh entries are answered from memory; stale ones inside
+       stale-while-revalidate are answered and refreshed in the background;
+       older ones are revalidated first and, inside stale-if-error, still
+       served when the upstream fails. Misses are relayed as they stream
+       in and kept once complete; concurrent misses for the same key follow
+       the first one instead of asking the upstream again. `report` gets the
+       status when the upstream was asked for this request, `release` the
+       status sent when it was answered without it. */
+    template< class S, class T >
+    void answer( nginx_cache_t cache, nginx_pool_t<S>& pool, const T& cli, url_t uri, string_t pth, header_t hdr,
+                 ulong tmo, function_t<void,uint> report, function_t<void,uint> release, ptr_t<nginx_entry_t> y ) {
+        auto now = _nginx_::wall(); auto pl = &pool;
+        auto elapsed = y == nullptr ? 0 : now > y->stored ? now - y->stored : 0;
+
+        if( y != nullptr && elapsed < y->fresh ){
+            cache.count_hit(); release( 200 ); reply( cli, y, "HIT" ); cli.done(); return;
+        }
+
+        if( y != nullptr && elapsed < y->fresh + y->swr ){
+            cache.count_stale(); release( 200 ); reply( cli, y, "STALE" ); cli.done();
+            if( !y->busy ){ revalidate( cache, pool, cli, uri, pth, hdr, tmo, y, [=]( uint code, ptr_t<nginx_capture_t> res ){
+                  if( code == 304 ){ cache.renew( y, res ); }
+                elif( code >  0   ){ cache.put( cli, res ); }
+            }); }   return;
+        }
+
+        if( y != nullptr ){ revalidate( cache, pool, cli, uri, pth, hdr, tmo, y, [=]( uint code, ptr_t<nginx_capture_t> res ){
+            report( code ); if( !cli.is_available() ){ return; }
+            if( code == 304 ){ cache.renew( y, res ); cache.count_hit(); reply( cli, y, "REVALIDATED" ); return; }
+            if(( code == 0 || code >= 500 ) && elapsed < y->fresh + y->sie ){ cache.count_error(); reply( cli, y, "STALE" ); return; }
+            if( code == 0 ){ _nginx_::fail( cli, "503 Service Unavailable", "upstream unavailable" ); return; }
+            if( res->full ){ nginx::pool::forward( *pl, cli, uri, pth, hdr, tmo ); return; } // outgrew the cache
+            auto z = cache.put( cli, res ); if( z == nullptr ){ z = cache.put( cli, res, false ); }
+            if( z != nullptr ){ cache.count_miss(); reply( cli, z, "MISS" ); return; }
+            if( !res->done ){ _nginx_::fail( cli, "502 Bad Gateway", "bad gateway" ); return; }
+            _nginx_::flush( cli, res->status + res->head + "Content-Length: " + string::to_string( res->body.size() ) +
+                                 "\r\nConnection: close\r\n\r\n" + ( cli.method == "HEAD" ? string_t() : res->body ) );
+        }); cli.done(); return; }
+
+        cache.count_miss(); if( cli.method != "GET" ){ nginx::pool::forward( pool, cli, uri, pth, hdr, tmo, report ); return; }
+        auto key = cache.variant( cli, cache.primary( cli ) ); auto pass = !cache.collapsible( key );
+        ptr_t<nginx_flight_t> f; if( !pass ){ f = cache.follow( key ); }
+        if( f != nullptr ){ trail( cache, pool, cli, uri, pth, hdr, tmo, report, release, f ); cli.done(); return; }
+
+        auto req = nginx::pool::prepare( cli, pth, hdr, tmo ); auto res = ptr_t<nginx_capture_t>( new nginx_capture_t() );
+        res->limit = cache.get_object(); req->capture = res;
+
+        if( !pass ){ auto vary = cache.vary( cli ); f = cache.lead( key ); req->flight = f;
+            f->shared = [=](){ if( cache.shareable( cli, res->status, res->head, vary ) ){ return true; }
+                               cache.pass( key ); return false; };
+        }
+
+        nginx::pool::exchange( pool, cli, uri, req, [=]( uint code, bool sent ){ report( code );
+            if( f != nullptr ){ if( !f->open ){ f->fail = 1; } cache.land( key, f ); }
+            if( code > 0 ){ cache.put( cli, res ); }
+            if( code == 0 && !sent ){ _nginx_::fail( cli, "503 Service Unavailable", "upstream unavailable" ); return; }
+            if( !sent ){ _nginx_::fail( cli, "502 Bad Gateway", "bad gateway" ); return; }
+            cli.close();
+        }); cli.done();
+    }
+
+    /* looks `cli` up, see answer(); a lookup that goes to disk finishes
+       later, on the loop thread. */
+    template< class S, class T >
+    void serve( nginx_cache_t cache, nginx_pool_t<S>& pool, const T& cli, url_t uri, string_t pth, header_t hdr,
+                ulong tmo, function_t<void,uint> report, function_t<void,uint> release ) {
+        if( !cache.usable( cli ) ){ nginx::pool::forward( pool, cli, uri, pth, hdr, tmo, report ); return; }
+        auto pl = &pool; cache.get( cli, [=]( ptr_t<nginx_entry_t> y ){
+            if( !cli.is_available() ){ release( 499 ); return; }
+            answer( cache, *pl, cli, uri, pth, hdr, tmo, report, release, y );
+        }); cli.done();
+    }
+
+}}}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#endif
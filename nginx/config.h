@@ -0,0 +1,238 @@
+/*
+ * Copyright 2023 The Nodepp Project Authors. All Rights Reserved.
+ *
+ * Licensed under the MIT (the "License").  You may not use
+ * this file except in compliance with the License.  You can obtain a copy
+ * in the file LICENSE in the source distribution or at
+ * https://github.com/NodeppOficial/nodepp/blob/main/LICENSE
+ */
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#ifndef NODEPP_NGINX_CONFIG
+#define NODEPP_NGINX_CONFIG
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#include <nodepp/nodepp.h>
+#include <nodepp/timer.h>
+#include <nodepp/json.h>
+#include <nodepp/url.h>
+#include <nginx/balance.h>
+#include <nginx/cache.h>
+#include <nginx/retry.h>
+
+#include <sys/stat.h>
+#include <csignal>
+#include <utility>
+#include <fcntl.h>
+#include <unistd.h>
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+namespace nodepp { namespace nginx { namespace config {
+    enum TYPE { UNKNOWN = 0, STATIC = 1, PIPE = 2, MOVE = 3 };
+}}}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+/* one file, pipe or move entry with everything a request needs worked out
+   when the entry is added: the method pattern compiled, the timeout read,
+   the upstream parsed and its balancer, cache and retry policy built. */
+
+namespace nodepp { struct nginx_rule_t {
+    uint             type    = nginx::config::UNKNOWN;
+    ptr_t<regex_t>   method;            // nullptr matches every method
+    uint             timeout = 0;       // ms, 0 leaves it to the socket
+    string_t         root    = "./";    // file: directory served
+    string_t         href;              // pipe: upstream, move: target
+    url_t            uri;               // pipe: href, parsed
+    bool             pool    = 1;
+    nginx_balancer_t bal;
+    nginx_cache_t    cch;
+    nginx_retry_t    retry;
+    object_t         args;
+};}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+namespace nodepp { namespace _nginx_ {
+
+    inline volatile sig_atomic_t& hups() {
+        static volatile sig_atomic_t out = 0; return out;
+    }
+
+    inline void on_hup( int ){ hups() = hups() + 1; }
+
+    /* installed once, every loader polls the same counter */
+    inline void hangup() {
+        static bool done = false; if( done ){ return; } done = true;
+        hups(); ::signal( SIGHUP, &on_hup );
+    }
+
+    inline bool slurp( const string_t& path, string_t& out ) {
+        int fd = ::open( path.get(), O_RDONLY ); if( fd < 0 ){ return false; }
+        struct stat st; if( ::fstat( fd, &st ) != 0 ){ ::close( fd ); return false; }
+
+        ulong len = st.st_size, pos = 0; ptr_t<char> buf ( len + 1, '\0' );
+        while( pos < len ){
+            auto c = ::read( fd, buf.get() + pos, len - pos );
+            if ( c < 0 && errno == EINTR ){ continue; } if( c <= 0 ){ break; } pos += c;
+        }   ::close( fd ); if( pos < len ){ return false; }
+        out = string_t( buf.get(), len ); return true;
+    }
+
+}}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+namespace nodepp { namespace nginx { namespace config {
+
+    inline uint type( string_t cmd ) {
+        cmd = cmd.to_lower_case();
+          if( cmd == "file" ){ return STATIC; }
+        elif( cmd == "pipe" ){ return PIPE;   }
+        elif( cmd == "move" ){ return MOVE;   }
+        return UNKNOWN;
+    }
+
+    inline ptr_t<nginx_rule_t> compile( string_t cmd, object_t args ) {
+        auto y = ptr_t<nginx_rule_t>( new nginx_rule_t() ); y->type = type( cmd ); y->args = args;
+        if( args["method"] .has_value() ){ y->method  = ptr_t<regex_t>( new regex_t( args["method"].as<string_t>() ) ); }
+        if( args["timeout"].has_value() ){ y->timeout = args["timeout"].as<uint>(); }
+        if( args["path"]   .has_value() ){ y->root    = args["path"].as<string_t>(); }
+        if( args["href"]   .has_value() ){ y->href    = args["href"].as<string_t>(); }
+        if( args["pool"]   .has_value() ){ y->pool    = args["pool"].as<bool>(); }
+        if( y->type == PIPE ){
+            if( !y->href.empty() ){ y->uri = url::parse( y->href ); }
+            y->bal = nginx::balance::parse( args ); y->cch = nginx::cache::parse( args );
+            y->retry = nginx::retry::parse( args );
+        }   return y;
+    }
+
+    /* an entry no table uses anymore: its probes stop and its cache is
+       emptied, requests still holding it finish as usual */
+    inline void release( ptr_t<nginx_rule_t> rule ) {
+        rule->bal.stop(); rule->cch.clear();
+    }
+
+}}}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+/* entries read from a JSON file instead of add() calls:
+
+       { "routes": [
+           { "type": "pipe", "route": "/api", "href": "http://10.0.0.2:8000", "timeout": 5000 },
+           { "type": "file", "route": "/",    "path": "./www", "method": "GET|HEAD" }
+       ]}
+
+   T is the nginx router type, V the request it hands out. Each load builds
+   a whole new route table and only then swaps it in, so a file that fails
+   to read or parse leaves the running table alone. Entries whose JSON did
+   not change are carried over as they are, with their probes, peer state
+   and cached responses; the ones dropped are released. Requests already
+   dispatched keep the entries they matched, a reload never cuts them.
+   The file is reloaded on SIGHUP and when its size, inode or mtime
+   changes. */
+
+namespace nodepp { template< class T, class V > class nginx_config_t {
+protected:
+
+    struct NODE {
+        T        front;
+        T        table;
+        map_t<string_t,ptr_t<nginx_rule_t>> rules; // entry JSON -> compiled entry
+        string_t path;
+        string_t error;
+        ulong    stamp = 0;             // mtime, ns
+        ulong    size  = 0;
+        ulong    inode = 0;
+        ulong    seen  = 0;             // SIGHUPs handled
+        ulong    loads = 0;
+        ulong    fails = 0;
+        ptr_t<int> timer;
+    };  ptr_t<NODE> obj;
+
+    bool changed() const noexcept {
+        struct stat st; if( ::stat( obj->path.get(), &st ) != 0 ){ return false; }
+        auto stamp = (ulong) st.st_mtim.tv_sec * 1000000000UL + st.st_mtim.tv_nsec;
+        if( stamp == obj->stamp && (ulong) st.st_size == obj->size && (ulong) st.st_ino == obj->inode ){ return false; }
+        obj->stamp = stamp; obj->size = st.st_size; obj->inode = st.st_ino; return true;
+    }
+
+    bool fail( string_t msg ) const noexcept { obj->error = msg; obj->fails++; return false; }
+
+    /* releases the entries of `list` that `keep` does not share */
+    void drop( map_t<string_t,ptr_t<nginx_rule_t>>& list, map_t<string_t,ptr_t<nginx_rule_t>>& keep ) const noexcept {
+        forEach( item, list.data() ){ if( !keep.has( item.first ) ){ nginx::config::release( item.second ); } }
+    }
+
+    void check() const noexcept {
+        if( (ulong) _nginx_::hups() != obj->seen ){ obj->seen = _nginx_::hups(); changed(); reload(); return; }
+        if( changed() ){ reload(); }
+    }
+
+public:
+
+    nginx_config_t( T front, string_t path, ulong ms=1000 ) noexcept : obj( new NODE() ) {
+        auto self = type::bind( this ); obj->front = front; obj->path = path;
+        obj->front.USE( function_t<void,V&,function_t<void>>([=]( V& cli, function_t<void> next ){
+            T table = self->obj->table; table.dispatch( cli );
+            if( !cli.is_express_closed() ){ next(); }
+        }));
+        changed(); reload(); watch( ms );
+    }
+
+    /*.........................................................................*/
+
+    /* how often the file is looked at; SIGHUP is noticed on the same tick */
+    void watch( ulong ms ) const noexcept {
+        _nginx_::hangup(); obj->seen = _nginx_::hups(); auto self = type::bind( this );
+        if( obj->timer != nullptr ){ timer::clear( obj->timer ); }
+        obj->timer = timer::interval([=](){ self->check(); }, max( ms, 100UL ) );
+    }
+
+    void stop() const noexcept {
+        if( obj->timer != nullptr ){ timer::clear( obj->timer ); obj->timer = nullptr; }
+    }
+
+    /* false, with get_error() set, when the running table was kept */
+    bool reload() const noexcept {
+        string_t data; if( !_nginx_::slurp( obj->path, data ) ){ return fail( "cannot read " + obj->path ); }
+        T table; map_t<string_t,ptr_t<nginx_rule_t>> rules; try {
+            auto cfg = json::parse( data ); if( !cfg["routes"].has_value() ){ return fail( "no routes" ); }
+            forEach( item, cfg["routes"].as<array_t<object_t>>() ){
+                auto cmd = item["type"].has_value() ? item["type"].as<string_t>() : string_t();
+                if( nginx::config::type( cmd ) == nginx::config::UNKNOWN ){
+                    drop( rules, obj->rules ); return fail( "unknown type \"" + cmd + "\"" );
+                }   auto key = json::stringify( item );
+                if( !rules.has( key ) ){
+                    rules[key] = obj->rules.has( key ) ? obj->rules[key] : nginx::config::compile( cmd, item );
+                }   table.add( item["route"].has_value() ? item["route"].as<string_t>() : string_t(), rules[key] );
+            }
+        } catch(...) { drop( rules, obj->rules ); return fail( "cannot parse " + obj->path ); }
+        drop( obj->rules, rules ); obj->rules = rules;
+        obj->table = table; obj->error = nullptr; obj->loads++; return true;
+    }
+
+    /*.........................................................................*/
+
+    string_t get_error() const noexcept { return obj->error; }
+    ulong    get_loads() const noexcept { return obj->loads; }
+    ulong    get_fails() const noexcept { return obj->fails; }
+    T        get_table() const noexcept { return obj->table; }
+    T       get_router() const noexcept { return obj->front; }
+
+    /*.........................................................................*/
+
+    template< class... A >
+    auto listen( const A&... args ) const noexcept -> decltype( std::declval<T>().listen( args... ) ) {
+        return obj->front.listen( args... );
+    }
+
+};}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#endif
@@ -16,6 +16,12 @@
 
 #include <nodepp/nodepp.h>
 #include <express/https.h>
+#include <express/vhost.h>
+#include <nginx/balance.h>
+#include <nginx/cache.h>
+#include <nginx/config.h>
+#include <nginx/pool.h>
+#include <nginx/retry.h>
 #include <nodepp/https.h>
 #include <nodepp/path.h>
 #include <nodepp/json.h>
@@ -25,13 +31,12 @@
 namespace nodepp { class nginx_https_t : public express_tls_t {
 protected:
 
-    void file( express_https_t& cli, string_t cmd, string_t path, object_t args ) const noexcept {
+    void file( express_https_t& cli, string_t path, ptr_t<nginx_rule_t> rule ) const noexcept {
 
         auto pth = regex::replace( cli.path, path, "/" );
              pth = regex::replace_all( pth, "\\.[.]+/", "" );
 
-        auto bsd =!args["path"].has_value() ? "./" :
-                   args["path"].as<string_t>() ;
+        auto bsd = rule->root;
 
         auto dir = pth.empty() ? path::join( bsd, "" ) :
                                  path::join( bsd,pth ) ;
@@ -49,7 +54,7 @@ protected:
             return;
         }}
 
-        if( !cli.headers.has("Range") ){
+        if( cli.get_header( express_https_t::RANGE ).empty() ){
 
             if( regex::test(path::mimetype(dir),"audio|video",true) ){ cli.send(); return; }
             if( regex::test(path::mimetype(dir),"html",true) ){ cli.render(dir); } else {
@@ -57,19 +62,23 @@ protected:
 			    cli.sendFile( dir );
             }
 
-        } else { auto str = fs::readable( dir );
+        } else { auto str = express::fd::cache().get( dir );
+            if( str == nullptr ){ cli.status(404).send("not_found"); return; }
 
-            array_t<string_t> range = regex::match_all(cli.headers["Range"],"\\d+",true);
+            array_t<string_t> range = regex::match_all(cli.get_header( express_https_t::RANGE ),"\\d+",true);
+            if( range.empty() || string::to_ulong( range[0] ) >= str->size ){
+                cli.header( "Content-Range", string::format( "bytes */%lu", str->size ) );
+                cli.status(416).send( "range not satisfiable" ); return;
+            }
              ulong rang[3]; rang[0] = string::to_ulong( range[0] );
-                   rang[1] =min(rang[0]+CHUNK_MB(10),str.size()-1);
-                   rang[2] =min(rang[0]+CHUNK_MB(10),str.size()  );
+                   rang[1] =min(rang[0]+CHUNK_MB(10),str->size-1);
+                   rang[2] =min(rang[0]+CHUNK_MB(10),str->size  );
 
-            cli.header( "Content-Range", string::format("bytes %lu-%lu/%lu",rang[0],rang[1],str.size()) );
+            cli.header( "Content-Range", string::format("bytes %lu-%lu/%lu",rang[0],rang[1],str->size) );
             cli.header( "Content-Type",  path::mimetype(dir) ); cli.header( "Accept-Range", "bytes" );
             cli.header( "Cache-Control", "public, max-age=604800" );
 
-            str.set_range( rang[0], rang[2] );
-            cli.status(206).sendStream( str );
+            cli.status(206).sendFd( str, rang[0], rang[2] );
 
         }
 
@@ -77,31 +86,52 @@ protected:
 
     /*.........................................................................*/
 
-    void pipe( express_https_t& cli, string_t cmd, string_t path, object_t args ) const noexcept {
-        if( !args["href"].has_value() ){ cli.status(503).send("url not found"); return; }
-
-        auto uri = url::parse( args["href"].as<string_t>() );
-        auto pth = regex::replace( cli.path, path, "/" );
-             pth = path::join( uri.path, pth );
-             pth+= cli.search;
-        auto slf = type::bind( cli );
-        auto hdr = cli.headers;
+    void pipe( express_https_t& cli, string_t path, ptr_t<nginx_rule_t> rule ) const noexcept {
+        auto bal = rule->bal; auto cch = rule->cch;
+        if( rule->href.empty() && bal.empty() ){ cli.status(503).send("url not found"); return; }
+
+        int  peer = bal.pick_for( cli ); // -1 when the entry has a single href
+        auto uri  = peer < 0 ? rule->uri : bal.get_peer( peer )->uri;
+        auto pth  = regex::replace( cli.path, path, "/" );
+             pth  = path::join( uri.path, pth );
+             pth += cli.search;
+        auto slf  = type::bind( cli );
+        auto hdr  = cli.headers;
+        auto tmo  = rule->timeout;
+        function_t<void,uint> report = [=]( uint status ){ bal.report( peer, status ); slf->account( status ? status : 503 ); };
+        function_t<void,uint> release = [=]( uint status ){ bal.release( peer ); slf->account( status ); };
 
         hdr["Params"] = query::format( cli.params );
         hdr["Real-Ip"]= cli.get_peername();
         hdr["Host"]   = uri.hostname;
 
+        if( nginx::pool::poolable( cli ) && rule->pool && !cch.is_enabled() && rule->retry.eligible( cli ) ){
+            auto sub = regex::replace( cli.path, path, "/" ); // peers may differ in base path
+            function_t<void,uint> account = [=]( uint status ){ slf->account( status ); };
+              if( uri.protocol.to_lower_case() == "https" )
+                 { nginx::retry::forward( rule->retry, bal, nginx::pool::https(), cli, peer, uri, rule->uri, sub, hdr, tmo, account ); }
+            else { nginx::retry::forward( rule->retry, bal, nginx::pool::http() , cli, peer, uri, rule->uri, sub, hdr, tmo, account ); }
+            return;
+        }
+
+        if( nginx::pool::poolable( cli ) && rule->pool ){
+              if( uri.protocol.to_lower_case() == "https" )
+                 { nginx::cache::serve( cch, nginx::pool::https(), cli, uri, pth, hdr, tmo, report, release ); }
+            else { nginx::cache::serve( cch, nginx::pool::http() , cli, uri, pth, hdr, tmo, report, release ); }
+            return;
+        }
+
         if( uri.protocol.to_lower_case() == "https" ){
 
             ssl_t ssl; tls_t tmp ([=]( https_t dpx ){
-                dpx.write_header( slf->method, pth, slf->get_version(), hdr );
-                dpx .set_timeout( args["timeout"].as<uint>() );
-                slf->set_timeout( args["timeout"].as<uint>() );
+                dpx.write_header( slf->method, pth, slf->get_version(), hdr ); report( 101 );
+                dpx.set_timeout( 0 ); slf->set_timeout( 0 );
+                if( tmo > 0 ){ express::wheel::idle( dpx, (const https_t&)(*slf), tmo ); }
                 stream::duplex( *slf,dpx );
             }, &ssl );
 
             tmp.onError([=]( except_t err ){
-                slf->status(503).send( err.what() );
+                report( 0 ); _nginx_::fail( *slf, "503 Service Unavailable", err.what() );
             });
 
             tmp.connect( uri.hostname, uri.port ); slf->done();
@@ -109,17 +139,20 @@ protected:
         } else {
 
             tcp_t tmp ([=]( http_t dpx ){
-                dpx.write_header( slf->method, pth, slf->get_version(), hdr );
-                dpx .set_timeout( args["timeout"].as<uint>() );
-                slf->set_timeout( args["timeout"].as<uint>() );
+                dpx.write_header( slf->method, pth, slf->get_version(), hdr ); report( 101 );
+                dpx.set_timeout( 0 ); slf->set_timeout( 0 );
+                if( tmo > 0 ){ express::wheel::idle( dpx, (const https_t&)(*slf), tmo ); }
                 stream::duplex( *slf,dpx );
             });
 
             tmp.onError([=]( except_t err ){
-                slf->status(503).send( err.what() );
+                report( 0 ); _nginx_::fail( *slf, "503 Service Unavailable", err.what() );
             });
 
-            tmp.connect( uri.hostname, uri.port ); slf->done();
+            express::dns::lookup( uri.hostname, [=]( string_t ip ){
+                if( ip.empty() ){ report( 0 ); _nginx_::fail( *slf, "503 Service Unavailable", "dns couldn't get ip" ); return; }
+                tmp.connect( ip, uri.port );
+            }); slf->done();
 
         }
 
@@ -127,21 +160,19 @@ protected:
 
     /*.........................................................................*/
 
-    void append( string_t cmd, string_t path, object_t* args ) const noexcept {
-        auto n = args==nullptr ? object_t() : *args; auto self = type::bind( this );
-        this->ALL( path, [=]( express_https_t& cli ){
+    void append( string_t path, ptr_t<nginx_rule_t> rule ) const noexcept {
+        auto self = type::bind( this ); if( rule->type == nginx::config::UNKNOWN ){ return; }
+        this->ALL( path, [=]( express_https_t& cli ){ cli.set_timeout( 0 );
 
-            if(!n["timeout"].has_value() ){ n["timeout"] = 0; }
-            if( n["timeout"].has_value() ){ cli.set_timeout(n["timeout"].as<uint>()); }
-            if( n["method"] .has_value() && !regex::test( cli.method, n["method"].as<string_t>() ) )
+            if( rule->method != nullptr && !rule->method->test( cli.method ) )
               { return; }
+            if( rule->timeout > 0 && rule->type != nginx::config::PIPE ) // pipe times both ends itself
+              { express::wheel::idle( (const https_t&) cli, rule->timeout ); }
 
-              if( cmd.to_lower_case() == "file" ){ self->file( cli, cmd, path, n ); }
-            elif( cmd.to_lower_case() == "pipe" ){ self->pipe( cli, cmd, path, n ); }
-            elif( cmd.to_lower_case() == "move" ){
-                auto href =!n["href"].has_value() ? "./" :
-                            n["href"].as<string_t>();
-                cli.redirect( href );
+            switch( rule->type ){
+                case nginx::config::STATIC: self->file( cli, path, rule ); break;
+                case nginx::config::PIPE  : self->pipe( cli, path, rule ); break;
+                case nginx::config::MOVE  : cli.redirect( rule->href.empty() ? string_t( "./" ) : rule->href ); break;
             }
 
         });
@@ -153,11 +184,17 @@ public:
     nginx_https_t( const T&... args ) noexcept : express_tls_t( args... ) {}
 
     void add( string_t cmd, string_t path, object_t args ) const noexcept {
-        append( cmd, path, &args );
+        append( path, nginx::config::compile( cmd, args ) ); // resolved once per entry
     }
 
     void add( string_t cmd, string_t path ) const noexcept {
-        append( cmd, path, nullptr );
+        append( path, nginx::config::compile( cmd, object_t() ) );
+    }
+
+    /* an entry compiled beforehand, nginx_config_t hands the unchanged
+       ones of a reload back in so their balancer and cache carry over */
+    void add( string_t path, ptr_t<nginx_rule_t> rule ) const noexcept {
+        append( path, rule );
     }
 
 };}
@@ -170,6 +207,18 @@ namespace nodepp { namespace nginx { namespace https {
         return nginx_https_t( args... );
     }
 
+    /* entries come from the JSON file at `path` and are reloaded when it
+       changes or on SIGHUP, see nginx/config.h */
+    template< class... T > nginx_config_t<nginx_https_t,express_https_t> load( string_t path, T... args ) {
+        return nginx_config_t<nginx_https_t,express_https_t>( nginx_https_t( args... ), path );
+    }
+
+    /* nginx_https_t only adds entries to its route table, so each domain's
+       instance can be handed to host() as is. */
+    template< class... T > express_vhost_t<express_tls_t,express_https_t> vhost( T... args ) {
+        return express::https::vhost( args... );
+    }
+
 }}}
 
 /*────────────────────────────────────────────────────────────────────────────*/
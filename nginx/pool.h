@@ -0,0 +1,596 @@
+/*
+ * Copyright 2023 The Nodepp Project Authors. All Rights Reserved.
+ *
+ * Licensed under the MIT (the "License").  You may not use
+ * this file except in compliance with the License.  You can obtain a copy
+ * in the file LICENSE in the source distribution or at
+ * https://github.com/NodeppOficial/nodepp/blob/main/LICENSE
+ */
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#ifndef NODEPP_NGINX_POOL
+#define NODEPP_NGINX_POOL
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#include <nodepp/nodepp.h>
+#include <nodepp/timer.h>
+#include <nodepp/https.h>
+#include <nodepp/http.h>
+#include <nodepp/url.h>
+#include <express/wheel.h>
+#include <express/dns.h>
+#include <nginx/splice.h>
+#include <sys/socket.h>
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+namespace nodepp { namespace _nginx_ {
+
+    /* plain upstreams are dialed by address from express::dns; TLS ones
+       keep the name, tls_t takes SNI and the certificate check from it */
+    inline void connect( http_t*, string_t name, uint port, function_t<void,http_t> cb, function_t<void,except_t> err ) {
+        express::dns::lookup( name, [=]( string_t ip ){
+            if( ip.empty() ){ err( except_t( "dns couldn't get ip" ) ); return; }
+            tcp_t tmp ([=]( http_t fd ){ cb( fd ); });
+            tmp.onError([=]( except_t e ){ err( e ); });
+            tmp.connect( ip, port );
+        });
+    }
+
+    inline void connect( https_t*, string_t name, uint port, function_t<void,https_t> cb, function_t<void,except_t> err ) {
+        ssl_t ssl; tls_t tmp ([=]( https_t fd ){ cb( fd ); }, &ssl );
+        tmp.onError([=]( except_t e ){ err( e ); });
+        tmp.connect( name, port );
+    }
+
+    /* an idle keep-alive socket must have nothing to read: EOF means the
+       upstream closed it, stray bytes mean it is out of sync. */
+    template< class S > bool healthy( const S& fd ) {
+        if( !fd.is_available() ){ return false; } char c;
+        auto r = ::recv( fd.get_fd(), &c, 1, MSG_PEEK | MSG_DONTWAIT );
+        return r < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK );
+    }
+
+    /* "Name: value\r\n" -> lower case name, trimmed value */
+    inline bool field( const string_t& line, string_t& name, string_t& value ) {
+        ulong x = 0; while( x<line.size() && line[x]!=':' ){ x++; }
+        if( x == 0 || x >= line.size() ){ return false; }
+        ulong b = x+1, e = line.size();
+        while( b<e && ( line[b]==' ' || line[b]=='\t' ) ){ b++; }
+        while( e>b && ( line[e-1]=='\r' || line[e-1]=='\n' || line[e-1]==' ' ) ){ e--; }
+        name = line.slice( 0, x ).to_lower_case(); value = line.slice( b, e ); return true;
+    }
+
+    /* FNV-1a */
+    inline ulong hash( const string_t& data ) {
+        ulong out = 1469598103934665603UL;
+        for( ulong x=0; x<data.size(); x++ ){ out ^= (uchar) data[x]; out *= 1099511628211UL; }
+        return out;
+    }
+
+    inline ulong hex( const string_t& line ) {
+        ulong out = 0; for( ulong x=0; x<line.size(); x++ ){ char c = line[x];
+              if( c>='0' && c<='9' ){ out = out*16 + ( c-'0' );    }
+            elif( c>='a' && c<='f' ){ out = out*16 + ( c-'a'+10 ); }
+            elif( c>='A' && c<='F' ){ out = out*16 + ( c-'A'+10 ); }
+            else { break; }
+        }   return out;
+    }
+
+    /* the express state is already marked done, so errors are written raw */
+    template< class T > void fail( const T& cli, string_t status, string_t msg ) {
+        if( !cli.is_available() ){ return; }
+        cli.write( "HTTP/1.1 " + status + "\r\nContent-Length: " + string::to_string( msg.size() ) +
+                   "\r\nConnection: close\r\n\r\n" + msg ); cli.close();
+    }
+
+}}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+namespace nodepp { struct nginx_capture_t {
+    string_t status;                // status line
+    string_t head;                  // header lines, framing and hop-by-hop ones removed
+    string_t body;                  // payload, de-chunked
+    ulong    limit = CHUNK_MB(1);
+    bool     full  = 0;             // the body outgrew `limit` and was dropped
+    bool     done  = 0;             // the whole response was read
+    string_t method;                // sent upstream, when not the client's
+};}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+/* one upstream response shared while it streams in: requests for the same
+   resource follow it instead of opening their own upstream requests. */
+
+namespace nodepp { struct nginx_flight_t {
+    string_t buff;                  // relayed bytes from `base` on
+    ulong    base = 0;
+    ulong    since= 0;              // started at, ms
+    uint     code = 0;
+    bool     open = 0;              // the head went out, followers may stream
+    bool     done = 0;
+    bool     fail = 0;              // followers must fetch for themselves
+    bool     join = 1;              // the start of the response is still here
+    array_t<ptr_t<ulong>> reader;   // follower positions, ~0 once gone
+    function_t<bool> shared;        // asked once the head is known
+
+    void push( const string_t& data ) { buff += data; trim(); }
+
+    /* drops what every follower has written; from then on the start is
+       gone and nobody else can join. */
+    void trim() {
+        ulong low = base + buff.size(); forEach( y, reader ){ low = min( low, *y ); }
+        if( low - base < CHUNK_SIZE * 4 ){ return; }
+        buff = buff.slice( low - base ); base = low; join = 0;
+    }
+};}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+/* the attempts of one request, retries and hedges, racing for its client:
+   the first status `accept` takes is relayed, every other response is
+   dropped before any of it reaches the client. Once the race is over,
+   `cut` closes the upstream sockets of the attempts still running. */
+
+namespace nodepp { struct nginx_race_t {
+    bool won = 0;
+    function_t<bool,uint> accept;   // asked with each status until one is taken
+    array_t<function_t<void>> cut;  // one per attempt that holds a socket
+};}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+namespace nodepp { struct nginx_relay_t {
+    string_t head;                  // request line and headers, ready to write
+    ulong    length = 0;            // request body bytes to forward
+    bool     nobody = 0;            // HEAD: the response has no body
+    bool     quiet  = 0;            // read the response without relaying it
+    ulong    timeout= 0;            // idle ms, 0 = none
+    ptr_t<nginx_capture_t> capture; // keeps a copy of the response
+    ptr_t<nginx_flight_t>  flight;  // streams the response to followers
+    ptr_t<nginx_race_t>    race;    // shared with the other attempts of the request
+    bool     lead   = 0;            // this attempt won its race
+    bool     cut    = 0;            // closed because another attempt won
+    bool     ended  = 0;            // done() ran, the socket went back
+    ptr_t<express_timer_t> timer;
+    function_t<void,bool,bool,uint> done; // ( reusable, response started, status )
+};}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#ifndef NODEPP_NGINX_GENERATOR
+#define NODEPP_NGINX_GENERATOR
+namespace nodepp { namespace _nginx_ {
+
+/* one request/response exchange over a kept-alive upstream socket. The
+   response is framed (Content-Length or chunked) so the socket can be
+   handed back once the last byte is relayed; anything else is read until
+   the upstream closes and the socket is not reused. */
+
+GENERATOR( relay ){
+protected:
+
+    _file_::write wrt; _file_::read rd; _file_::line line;
+    string_t head, name, value; ulong left=0, size=0, pay=0; uint code=0;
+    int  body=0;        // 0 none, 1 length, 2 chunked, 3 until close
+    bool keep=0, sent=0, chunked=0, length=0;
+    nginx_splice_t spl; long step=0;
+
+    void touch( const ptr_t<nginx_relay_t>& ctx ) {
+        express::wheel::engine().touch( ctx->timer, ctx->timeout );
+    }
+
+    void store( const ptr_t<nginx_relay_t>& ctx, const string_t& data, ulong len ) {
+        auto& y = ctx->capture; if( y == nullptr || y->full || len == 0 ){ return; }
+        if( y->body.size() + len > y->limit ){ y->full = 1; y->body = nullptr; return; }
+        y->body += data.slice( 0, len );
+    }
+
+    void tee( const ptr_t<nginx_relay_t>& ctx, const string_t& data ) {
+        if( ctx->flight != nullptr ){ ctx->flight->push( data ); }
+    }
+
+    void open( ptr_t<nginx_relay_t>& ctx ) {
+        auto f = ctx->flight; if( f == nullptr ){ return; }
+        if( !f->shared() ){ f->fail = 1; ctx->flight = nullptr; return; }
+        f->code = code; f->open = 1; f->push( head );
+    }
+
+    /* a raced attempt only relays the status its race takes */
+    bool claim( ptr_t<nginx_relay_t>& ctx ) {
+        auto r = ctx->race; if( r == nullptr ){ return true; }
+        if( r->won ){ return false; } ctx->lead = 1; // accept() cuts the others
+        if( !r->accept( code ) ){ ctx->lead = 0; return false; }
+        r->won = 1; return true;
+    }
+
+    /* bodies nobody keeps or tees can skip the user space copy */
+    template< class T, class S >
+    bool zero( const T& cli, const S& dpx, const ptr_t<nginx_relay_t>& ctx ) {
+        if( ctx->quiet || ctx->capture != nullptr || ctx->flight != nullptr ){ return false; }
+        if( !nginx::splice::usable( cli, dpx ) ){ return false; } return spl.open();
+    }
+
+    /* a flight that never opened is settled by its owner, this attempt
+       may still be retried */
+    void finish( ptr_t<nginx_relay_t>& ctx, bool ok ) {
+        auto f = ctx->flight; if( f != nullptr && f->open ){ if( ok ){ f->done = 1; } else { f->fail = 1; } }
+        express::wheel::engine().cancel( ctx->timer );
+    }
+
+public:
+
+    template< class T, class S >
+    coEmit( const T& cli, const S& dpx, ptr_t<nginx_relay_t> ctx ){
+    gnStart
+
+        coWait( wrt( &dpx, ctx->head )==1 );
+        if( wrt.state<=0 ){ coGoto(9); } left = ctx->length;
+
+        while( left > 0 ){
+            coWait( rd( &cli, min( left, (ulong) CHUNK_SIZE ) )==1 );
+            if( rd.state<=0 ){ coGoto(9); } left -= min( left, rd.data.size() ); touch( ctx );
+            coWait( wrt( &dpx, rd.data )==1 );
+            if( wrt.state<=0 ){ coGoto(9); }
+        }
+
+        coYield(1); // status line; interim 1xx answers are skipped
+        coWait( line( &dpx )==1 );
+        if( line.state<=0 ){ coGoto(9); } touch( ctx ); head = line.data;
+        keep = regex::test( head, "^HTTP/1\\.1 " ); chunked = 0; length = 0;
+        code = string::to_ulong( head.slice( 9, 12 ) );
+        body = ( ctx->nobody || code/100 == 1 || code == 204 || code == 304 ) ? 0 : 3;
+        if( ctx->capture != nullptr ){ ctx->capture->status = head; ctx->capture->head = nullptr; }
+
+        while( true ){
+            coWait( line( &dpx )==1 );
+            if( line.state<=0 ){ coGoto(9); }
+            if( line.data=="\r\n" || line.data=="\n" ){ break; }
+            if( !_nginx_::field( line.data, name, value ) ){ continue; }
+              if( name == "connection" ){ if( regex::test( value, "close", true ) ){ keep = 0; } continue; }
+            elif( name == "keep-alive" || name == "proxy-connection" ){ continue; }
+            elif( name == "transfer-encoding" ){ chunked = regex::test( value, "chunked", true ); }
+            elif( name == "content-length" ){ length = 1; left = string::to_ulong( value ); }
+            elif( ctx->capture != nullptr ){ ctx->capture->head += line.data; }
+            head += line.data;
+        }
+
+        if( code/100 == 1 ){ coGoto(1); }
+        if( body != 0 ){ body = chunked ? 2 : length ? 1 : 3; }
+        if( body == 3 ){ keep = 0; } if( body != 1 ){ left = 0; }
+
+        if( !claim( ctx ) ){ coGoto(9); }
+        head += "Connection: close\r\n\r\n"; open( ctx ); if( !ctx->quiet ){
+            coWait( wrt( &cli, head )==1 );
+            if( wrt.state<=0 ){ coGoto(9); } sent = 1;
+        }
+
+        if( body == 0 ){ coGoto(8); }
+        if( body != 2 && zero( cli, dpx, ctx ) ){ // read-ahead first, then splice(2)
+            head = dpx.get_borrow(); dpx.del_borrow(); if( body == 1 ){ head = head.slice( 0, left ); left -= head.size(); }
+            if( !head.empty() ){
+            coWait( wrt( &cli, head )==1 );
+            if( wrt.state<=0 ){ coGoto(9); } }
+
+            while( body == 3 || left > 0 ){
+                coWait( ( step = spl.next( _nginx_::raw( dpx ), _nginx_::raw( cli ), body == 1 ? left : CHUNK_MB(1) ) )==0 );
+                if( step == -1 && body == 3 ){ coGoto(8); } if( step < 0 ){ coGoto(9); }
+                touch( ctx ); if( body == 1 ){ left -= step; }
+            }   coGoto(8);
+        }
+
+        if( body == 3 ){ while( true ){
+            coWait( rd( &dpx )==1 );
+            if( rd.state<=0 ){ coGoto(8); } touch( ctx ); store( ctx, rd.data, rd.data.size() ); tee( ctx, rd.data );
+            if( !ctx->quiet ){
+            coWait( wrt( &cli, rd.data )==1 );
+            if( wrt.state<=0 ){ coGoto(9); } }
+        }}
+
+        if( body == 2 ){ coYield(2); // chunk size line, then size+2 bytes
+            coWait( line( &dpx )==1 );
+            if( line.state<=0 ){ coGoto(9); } touch( ctx );
+            size = _nginx_::hex( line.data ); left = size ? size + 2 : 0; tee( ctx, line.data );
+            if( !ctx->quiet ){
+            coWait( wrt( &cli, line.data )==1 );
+            if( wrt.state<=0 ){ coGoto(9); } }
+        }
+
+        while( left > 0 ){
+            coWait( rd( &dpx, min( left, (ulong) CHUNK_SIZE ) )==1 );
+            if( rd.state<=0 ){ coGoto(9); } touch( ctx );
+            pay  = body == 2 ? ( left > 2 ? left - 2 : 0 ) : left; // chunks end in CRLF
+            store( ctx, rd.data, min( pay, rd.data.size() ) ); left -= min( left, rd.data.size() ); tee( ctx, rd.data );
+            if( !ctx->quiet ){
+            coWait( wrt( &cli, rd.data )==1 );
+            if( wrt.state<=0 ){ coGoto(9); } }
+        }
+
+        if( body == 2 && size > 0 ){ coGoto(2); }
+        if( body == 2 ){ while( true ){ // trailers
+            coWait( line( &dpx )==1 );
+            if( line.state<=0 ){ coGoto(9); } tee( ctx, line.data );
+            if( !ctx->quiet ){
+            coWait( wrt( &cli, line.data )==1 );
+            if( wrt.state<=0 ){ coGoto(9); } }
+            if( line.data=="\r\n" || line.data=="\n" ){ break; }
+        }}
+
+        coYield(8); if( ctx->capture != nullptr ){ ctx->capture->done = 1; }
+        finish( ctx, true  ); ctx->done( keep, sent, code ); coEnd;
+
+        coYield(9);
+        finish( ctx, false ); ctx->done( false, sent, code );
+
+    gnStop }
+
+};
+
+}}
+#endif
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+/* keyed by scheme, host and port. Each key keeps up to `max_idle` sockets
+   waiting for reuse and opens at most `max_total` at once; requests over
+   that wait for the next release, for at most `wait` ms. Idle sockets are
+   probed before they are handed out and closed after `timeout` ms without
+   use. */
+
+namespace nodepp { template< class S > class nginx_pool_t {
+protected:
+
+    struct IDLE {
+        S     fd;
+        ulong since = 0;
+    };
+
+    struct WAIT {
+        function_t<void,S,bool>   cb;
+        function_t<void,except_t> err;
+        ptr_t<express_timer_t>    timer;
+        ptr_t<bool>               over;     // gave up, skipped when its turn comes
+    };
+
+    struct HOST {
+        queue_t<IDLE> idle;
+        queue_t<WAIT> wait;
+        string_t      name;
+        uint          port = 0;
+        ulong         total= 0;     // open sockets, idle or busy
+    };
+
+    struct NODE {
+        map_t<string_t,ptr_t<HOST>> host;
+        ulong max_idle = 16;
+        ulong max_total= 256;
+        ulong timeout  = 30000;
+        ulong wait     = 10000;
+        ulong hits  = 0;
+        ulong miss  = 0;
+        ulong stale = 0;            // failed the checkout probe
+        ulong expired= 0;           // closed by the idle timeout
+        ulong starved= 0;           // waiters that gave up
+        ptr_t<int> timer;
+    };  ptr_t<NODE> obj;
+
+    /*.........................................................................*/
+
+    ptr_t<HOST> get( const string_t& key, const string_t& name, uint port ) const noexcept {
+        if( obj->host.has( key ) ){ return obj->host[key]; }
+        auto h = ptr_t<HOST>( new HOST() ); h->name = name; h->port = port;
+        obj->host[key] = h; return h;
+    }
+
+    void open( ptr_t<HOST> h, function_t<void,S,bool> cb, function_t<void,except_t> err ) const noexcept {
+        h->total++; obj->miss++; auto self = type::bind( this );
+        _nginx_::connect( (S*) nullptr, h->name, h->port,
+            [=]( S fd ){ fd.set_timeout( 0 ); cb( fd, false ); },
+            [=]( except_t e ){ h->total--; self->kick( h ); err( e ); }
+        );
+    }
+
+    /* the oldest waiter that still waits, false when there is none */
+    bool next( ptr_t<HOST> h, WAIT& w ) const noexcept {
+        while( !h->wait.empty() ){
+            w = h->wait.first()->data; h->wait.shift(); if( *w.over ){ continue; }
+            express::wheel::engine().cancel( w.timer ); return true;
+        }   return false;
+    }
+
+    /* a slot freed up: the oldest waiter gets a fresh socket */
+    void kick( ptr_t<HOST> h ) const noexcept {
+        WAIT w; if( h->total >= obj->max_total || !next( h, w ) ){ return; }
+        open( h, w.cb, w.err );
+    }
+
+    void sweep() const noexcept { auto now = process::now(); ulong left = 0;
+        forEach( item, obj->host.data() ){ auto h = item.second;
+        for( ulong x=h->idle.size(); x-->0; ){
+             auto y = h->idle.first()->data; h->idle.shift();
+             if( now - y.since < obj->timeout && _nginx_::healthy( y.fd ) ){ h->idle.push( y ); continue; }
+             y.fd.close(); h->total--; obj->expired++; kick( h );
+        }    left += h->idle.size(); }
+        if( left == 0 ){ stop(); }
+    }
+
+    void start() const noexcept {
+        if( obj->timer != nullptr ){ return; } auto self = type::bind( this );
+        obj->timer = timer::interval([=](){ self->sweep(); }, max( obj->timeout / 4, 100UL ) );
+    }
+
+    void stop() const noexcept {
+        if( obj->timer == nullptr ){ return; }
+        timer::clear( obj->timer ); obj->timer = nullptr;
+    }
+
+public:
+
+    nginx_pool_t() noexcept : obj( new NODE() ) {}
+
+    /*.........................................................................*/
+
+    void set_max_idle ( ulong size ) const noexcept { obj->max_idle = size; }
+    void set_max_total( ulong size ) const noexcept { obj->max_total= max( size, 1UL ); }
+    void set_timeout  ( ulong ms )   const noexcept { obj->timeout  = max( ms, 1UL ); }
+    void set_max_wait ( ulong ms )   const noexcept { obj->wait     = max( ms, 1UL ); }
+
+    /*.........................................................................*/
+
+    ulong get_hits()    const noexcept { return obj->hits;    }
+    ulong get_miss()    const noexcept { return obj->miss;    }
+    ulong get_stale()   const noexcept { return obj->stale;   }
+    ulong get_expired() const noexcept { return obj->expired; }
+    ulong get_starved() const noexcept { return obj->starved; }
+
+    float get_rate() const noexcept { auto all = obj->hits + obj->miss;
+        return all==0 ? 0.0f : (float) obj->hits / all;
+    }
+
+    ulong get_idle() const noexcept { ulong out = 0;
+        forEach( item, obj->host.data() ){ out += item.second->idle.size(); } return out;
+    }
+
+    ulong get_open() const noexcept { ulong out = 0;
+        forEach( item, obj->host.data() ){ out += item.second->total; } return out;
+    }
+
+    /*.........................................................................*/
+
+    /* hands a connected socket to `cb`, which must release() it exactly
+       once; the flag tells whether it was reused. `fresh` skips the idle
+       list, e.g. to retry after a reused socket turned out dead. With every
+       socket busy for longer than the max wait, `err` is called instead. */
+    void checkout( string_t key, string_t name, uint port, function_t<void,S,bool> cb,
+                   function_t<void,except_t> err, bool fresh=false ) const noexcept {
+        auto h = get( key, name, port );
+
+        while( !fresh && !h->idle.empty() ){
+            auto y = h->idle.first()->data; h->idle.shift();
+            if( _nginx_::healthy( y.fd ) ){ obj->hits++; cb( y.fd, true ); return; }
+            y.fd.close(); h->total--; obj->stale++;
+        }
+
+        if( h->total < obj->max_total ){ open( h, cb, err ); return; }
+        WAIT w; w.cb = cb; w.err = err; w.over = ptr_t<bool>( new bool(0) );
+        auto over = w.over; auto self = type::bind( this );
+        w.timer = express::wheel::engine().add( obj->wait, [=](){
+            *over = 1; self->obj->starved++; err( except_t( "no upstream socket freed up in time" ) );
+        }); h->wait.push( w );
+    }
+
+    void release( string_t key, S fd, bool keep ) const noexcept {
+        if( !obj->host.has( key ) ){ fd.close(); return; } auto h = obj->host[key];
+        keep = keep && fd.is_available();
+
+        WAIT w; if( keep && next( h, w ) ){
+            obj->hits++; w.cb( fd, true ); return;
+        }
+
+        if( keep && h->idle.size() < obj->max_idle ){
+            IDLE y; y.fd = fd; y.since = process::now();
+            h->idle.push( y ); start(); return;
+        }
+
+        fd.close(); h->total--; kick( h );
+    }
+
+};}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+namespace nodepp { namespace nginx { namespace pool {
+
+    inline nginx_pool_t<http_t>& http() {
+        static nginx_pool_t<http_t> out; return out;
+    }
+
+    inline nginx_pool_t<https_t>& https() {
+        static nginx_pool_t<https_t> out; return out;
+    }
+
+    /*.........................................................................*/
+
+    /* upgrades and chunked uploads keep the plain duplex relay */
+    template< class T > bool poolable( const T& cli ) {
+        if( cli.headers.has( "Upgrade" ) ){ return false; }
+        return !cli.headers.has( "Transfer-Encoding" ) ||
+               !regex::test( cli.headers["Transfer-Encoding"], "chunked", true );
+    }
+
+    inline string_t key( const url_t& uri ) {
+        return uri.protocol.to_lower_case() + "://" + uri.hostname + ":" + string::to_string( uri.port );
+    }
+
+    /*.........................................................................*/
+
+    /* request line and headers for `cli` as sent upstream */
+    template< class T >
+    ptr_t<nginx_relay_t> prepare( const T& cli, string_t pth, header_t hdr, ulong tmo ) {
+        auto ctx = ptr_t<nginx_relay_t>( new nginx_relay_t() ); hdr["Connection"] = "keep-alive";
+        ctx->length = string::to_ulong( cli.get_header( T::CONTENT_LENGTH ) );
+        ctx->nobody = cli.method == "HEAD"; ctx->timeout = tmo;
+        ctx->head   = cli.method + " " + pth + " HTTP/1.1\r\n";
+        forEach( item, hdr.data() ){ ctx->head += item.first + ": " + item.second + "\r\n"; }
+        ctx->head  += "\r\n"; return ctx;
+    }
+
+    /* runs one exchange over a pooled socket and calls `cb( status, sent )`
+       once it is over: status 0 means the upstream could not be reached,
+       499 that the client left before a socket was free, `sent` that part
+       of the response already went to the client. The
+       client is left open either way. A reused socket that dies before
+       answering a bodyless request is retried once on a fresh one. A raced
+       attempt that lost is closed and flagged `cut` on `req`. */
+    template< class S, class T >
+    void exchange( nginx_pool_t<S>& pool, const T& cli, url_t uri, ptr_t<nginx_relay_t> req,
+                   function_t<void,uint,bool> cb, bool fresh=false ) {
+        auto pl = &pool; auto id = key( uri );
+
+        pool.checkout( id, uri.hostname, uri.port, [=]( S dpx, bool reused ){
+            if( !req->quiet && !cli.is_available() ){ pl->release( id, dpx, true ); cb( 499, false ); return; }
+            if( req->race != nullptr && req->race->won ){ req->cut = 1; pl->release( id, dpx, true ); cb( 0, false ); return; }
+            auto ctx = ptr_t<nginx_relay_t>( new nginx_relay_t( *req ) ); // one per attempt
+            if( ctx->race != nullptr ){ ctx->race->cut.push([=](){
+                if( ctx->lead || ctx->ended ){ return; } req->cut = 1; dpx.close();
+            }); }
+            if( ctx->capture != nullptr ){ ctx->capture->full = 0; ctx->capture->body = nullptr; }
+            if( ctx->timeout > 0 ){ ctx->timer = express::wheel::engine().add( ctx->timeout, [=](){
+                dpx.close(); if( !req->quiet && ( ctx->race == nullptr || ctx->lead ) ){ cli.close(); }
+            }); }
+
+            ctx->done = [=]( bool keep, bool sent, uint code ){ ctx->ended = 1; pl->release( id, dpx, keep );
+                if( !keep && !sent && reused && !req->cut && req->length == 0 && code == 0 && ( req->quiet || cli.is_available() ) )
+                  { exchange( *pl, cli, uri, req, cb, true ); return; }
+                cb( code, sent );
+            };
+
+            process::poll::add( _nginx_::relay(), cli, dpx, ctx );
+        }, [=]( except_t ){ cb( 0, false ); }, fresh );
+    }
+
+    /* sends the request held by `cli` to `uri` and relays the response;
+       `report` gets the upstream status, 0 when it could not be reached. */
+    template< class S, class T >
+    void forward( nginx_pool_t<S>& pool, const T& cli, url_t uri, string_t pth, header_t hdr, ulong tmo,
+                  function_t<void,uint> report ) {
+        exchange( pool, cli, uri, prepare( cli, pth, hdr, tmo ), [=]( uint code, bool sent ){ report( code );
+            if( code == 0 && !sent ){ _nginx_::fail( cli, "503 Service Unavailable", "upstream unavailable" ); return; }
+            if( !sent ){ _nginx_::fail( cli, "502 Bad Gateway", "bad gateway" ); return; }
+            cli.close();
+        }); cli.done();
+    }
+
+    template< class S, class T >
+    void forward( nginx_pool_t<S>& pool, const T& cli, url_t uri, string_t pth, header_t hdr, ulong tmo ) {
+        forward( pool, cli, uri, pth, hdr, tmo, [=]( uint ){} );
+    }
+
+}}}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#endif
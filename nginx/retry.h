@@ -0,0 +1,291 @@
+/*
+ * Copyright 2023 The Nodepp Project Authors. All Rights Reserved.
+ *
+ * Licensed under the MIT (the "License").  You may not use
+ * this file except in compliance with the License.  You can obtain a copy
+ * in the file LICENSE in the source distribution or at
+ * https://github.com/NodeppOficial/nodepp/blob/main/LICENSE
+ */
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#ifndef NODEPP_NGINX_RETRY
+#define NODEPP_NGINX_RETRY
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#include <nodepp/nodepp.h>
+#include <nodepp/path.h>
+#include <nodepp/json.h>
+#include <nodepp/url.h>
+#include <express/wheel.h>
+#include <nginx/balance.h>
+#include <nginx/pool.h>
+
+#include <algorithm>
+#include <vector>
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+/* retry and hedging policy of a pipe entry. A bodyless request with an
+   idempotent method that fails to connect or gets one of `status` back is
+   sent again to another upstream, up to `tries` attempts in all. With
+   hedging on, a request still without an answer after the `percentile`
+   of recent response times gets a second attempt on another upstream and
+   whichever answers first is relayed. Both draw on one budget: every
+   request adds `ratio` tokens, each extra attempt takes one, and `reserve`
+   tokens a second are always there, so an outage is not multiplied by
+   the retries it provokes. */
+
+namespace nodepp { class nginx_retry_t {
+protected:
+
+    struct NODE {
+        uint          tries   = 1;          // attempts per request, 1 = no retries
+        bool          connect = 1;          // retry when the upstream cannot be reached
+        array_t<uint> status;               // answers worth another try
+
+        float         percentile= 0;        // hedge after this share of answers, 0 = off
+        ulong         floor     = 10;       // never hedge sooner, ms
+        ulong         delay     = 0;        // current hedge delay, ms
+        std::vector<ulong> sample;          // recent times to the status line, ms
+        ulong         seen      = 0;
+
+        float         ratio   = 0.1f;
+        float         reserve = 3;
+        float         tokens  = 3;
+        float         cap     = 100;
+        ulong         refill  = 0;          // last reserve top-up, ms
+
+        ulong requests = 0;
+        ulong retries  = 0;
+        ulong hedges   = 0;
+        ulong wins     = 0;                 // hedges answered first
+        ulong exhausted= 0;                 // extra attempts the budget refused
+    };  ptr_t<NODE> obj;
+
+    void top_up() const noexcept { auto now = process::now();
+        if( now - obj->refill < 1000 ){ return; } obj->refill = now;
+        obj->tokens = max( obj->tokens, obj->reserve );
+    }
+
+    bool spend() const noexcept {
+        top_up(); if( obj->tokens < 1 ){ obj->exhausted++; return false; }
+        obj->tokens -= 1; return true;
+    }
+
+public:
+
+    nginx_retry_t() noexcept : obj( new NODE() ) {
+        obj->status.push( 502 ); obj->status.push( 503 ); obj->sample.reserve( 256 );
+    }
+
+    /*.........................................................................*/
+
+    void set_retry( uint tries, bool connect, array_t<uint> status ) const noexcept {
+         obj->tries = max( tries, 1u ); obj->connect = connect; obj->status = status;
+    }
+
+    /* `percentile` in (0,100), 0 turns hedging off */
+    void set_hedge( float percentile, ulong floor=10 ) const noexcept {
+         obj->percentile = min( max( percentile, 0.0f ), 99.9f ); obj->floor = floor;
+    }
+
+    void set_budget( float ratio, float reserve ) const noexcept {
+         obj->ratio = max( ratio, 0.0f ); obj->reserve = max( reserve, 0.0f );
+         obj->tokens = obj->reserve; obj->cap = max( obj->reserve, 100.0f );
+    }
+
+    /*.........................................................................*/
+
+    bool  is_enabled()    const noexcept { return obj->tries > 1 || obj->percentile > 0; }
+    uint  get_tries()     const noexcept { return obj->tries;     }
+    ulong get_delay()     const noexcept { return obj->delay;     }
+    ulong get_requests()  const noexcept { return obj->requests;  }
+    ulong get_retries()   const noexcept { return obj->retries;   }
+    ulong get_hedges()    const noexcept { return obj->hedges;    }
+    ulong get_wins()      const noexcept { return obj->wins;      }
+    ulong get_exhausted() const noexcept { return obj->exhausted; }
+
+    /*.........................................................................*/
+
+    /* only requests that can be sent twice without harm: no body to
+       replay and a method that does not change anything twice */
+    template< class T > bool eligible( const T& cli ) const noexcept {
+        if( !is_enabled() ){ return false; }
+        if( string::to_ulong( cli.get_header( T::CONTENT_LENGTH ) ) > 0 ){ return false; }
+        return regex::test( cli.method, "^(GET|HEAD|OPTIONS|TRACE|PUT|DELETE)$" );
+    }
+
+    /* `code` 0: the upstream could not be reached */
+    bool retriable( uint code ) const noexcept {
+        if( code == 0 ){ return obj->connect; }
+        forEach( y, obj->status ){ if( y == code ){ return true; } } return false;
+    }
+
+    /* one request, one deposit into the budget */
+    void open() const noexcept {
+        obj->requests++; obj->tokens = min( obj->tokens + obj->ratio, obj->cap );
+    }
+
+    bool affordable() const noexcept { top_up(); return obj->tokens >= 1; }
+
+    bool retry() const noexcept { if( !spend() ){ return false; } obj->retries++; return true; }
+    bool hedge() const noexcept { if( !spend() ){ return false; } obj->hedges++;  return true; }
+    void count_win() const noexcept { obj->wins++; }
+
+    /*.........................................................................*/
+
+    /* ms before a hedge goes out, -1 while hedging is off or there are
+       too few answers to tell what is slow */
+    long hedge_after() const noexcept {
+        if( obj->percentile <= 0 || obj->seen < 32 ){ return -1; }
+        return max( obj->delay, obj->floor );
+    }
+
+    /* the delay is worked out again every 32 answers */
+    void record( ulong ms ) const noexcept {
+        if( obj->percentile <= 0 ){ return; } auto& y = obj->sample;
+        if( y.size() < 256 ){ y.push_back( ms ); } else { y[ obj->seen % 256 ] = ms; }
+        if( ++obj->seen % 32 != 0 ){ return; }
+
+        std::vector<ulong> tmp( y ); auto n = (ulong)( tmp.size() * obj->percentile / 100 );
+        n = min( n, (ulong) tmp.size() - 1 ); std::nth_element( tmp.begin(), tmp.begin() + n, tmp.end() );
+        obj->delay = tmp[n];
+    }
+
+};}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+namespace nodepp { namespace _nginx_ {
+
+    /* what the attempts of one request share */
+    template< class S, class T > struct tries_t {
+        nginx_retry_t          policy;
+        nginx_balancer_t       bal;
+        nginx_pool_t<S>*       pool = nullptr;
+        T                      cli;
+        url_t                  base;        // the entry's href
+        string_t               sub;         // path below the entry
+        header_t               hdr;
+        ulong                  tmo  = 0;
+        ulong                  since= 0;
+        uint                   tries= 0;    // attempts started
+        uint                   live = 0;    // attempts still running
+        bool                   over = 0;
+        array_t<int>           used;
+        ptr_t<nginx_race_t>    race;
+        ptr_t<express_timer_t> hedge;
+        function_t<void,uint>  account;
+    };
+
+    /* the race is over: the hedge is called off and every attempt but the
+       one relayed is closed */
+    template< class S, class T > void settle( ptr_t<tries_t<S,T>> st ) {
+        if( st->over ){ return; } st->over = 1; st->race->won = 1;
+        st->race->accept = nullptr; express::wheel::engine().cancel( st->hedge );
+        auto cut = st->race->cut; st->race->cut.clear(); forEach( y, cut ){ y(); }
+    }
+
+    template< class S, class T > void attempt( ptr_t<tries_t<S,T>> st, bool hedged );
+
+    /* nobody took the client: answer for the last attempt */
+    template< class S, class T > void give_up( ptr_t<tries_t<S,T>> st, uint code ) {
+        settle( st ); if( code == 0 || code == 503 ){
+            st->account( 503 ); fail( st->cli, "503 Service Unavailable", "upstream unavailable" ); return;
+        }   st->account( 502 ); fail( st->cli, "502 Bad Gateway", "bad gateway" );
+    }
+
+    template< class S, class T >
+    void launch( ptr_t<tries_t<S,T>> st, int peer, url_t uri, bool hedged ) {
+        auto hdr = st->hdr; hdr["Host"] = uri.hostname;
+        auto pth = path::join( uri.path, st->sub ) + st->cli.search;
+        auto req = nginx::pool::prepare( st->cli, pth, hdr, st->tmo ); req->race = st->race;
+        st->tries++; st->live++; if( peer >= 0 ){ st->used.push( peer ); }
+
+        nginx::pool::exchange( *st->pool, st->cli, uri, req, [=]( uint code, bool sent ){
+            st->live--; if( req->cut ){ st->bal.release( peer ); return; } // lost, not the peer's fault
+            st->bal.report( peer, code );
+            if( sent ){ if( hedged ){ st->policy.count_win(); } st->cli.close(); return; }
+            if( st->over ){ return; }
+            if( !st->cli.is_available() ){ if( st->live == 0 ){ settle( st ); } return; }
+            if( st->policy.retriable( code ) && st->tries < st->policy.get_tries() && st->policy.retry() )
+              { attempt( st, false ); return; }
+            if( st->live == 0 ){ give_up( st, code ); }
+        });
+    }
+
+    /* another upstream when there is one; a single href is dialed again,
+       express::dns hands out its addresses in turn */
+    template< class S, class T > void attempt( ptr_t<tries_t<S,T>> st, bool hedged ) {
+        int peer = -1; if( !st->bal.empty() ){
+            peer = st->bal.pick_other( st->used );
+            if( peer < 0 ){ peer = st->bal.pick( nullptr ); }
+        }   launch( st, peer, peer < 0 ? st->base : st->bal.get_peer( peer )->uri, hedged );
+    }
+
+}}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+namespace nodepp { namespace nginx { namespace retry {
+
+    /* "retry": { "tries": 2, "connect": true, "status": [ 502, 503 ],
+                  "hedge": 95, "floor": 10, "budget": 0.1, "reserve": 3 }
+       an entry without "retry" sends every request once. */
+    inline nginx_retry_t parse( object_t args ) {
+        nginx_retry_t out; if( !args["retry"].has_value() ){ return out; } auto y = args["retry"];
+
+        array_t<uint> status; if( y["status"].has_value() ){
+            forEach( item, y["status"].as<array_t<object_t>>() ){ status.push( item.as<uint>() ); }
+        } else { status.push( 502 ); status.push( 503 ); }
+        out.set_retry( y["tries"]  .has_value() ? y["tries"]  .as<uint>() : 2,
+                       y["connect"].has_value() ? y["connect"].as<bool>() : true, status );
+
+        out.set_hedge ( y["hedge"]  .has_value() ? y["hedge"]  .as<float>() : 0.0f,
+                        y["floor"]  .has_value() ? y["floor"]  .as<ulong>() : 10 );
+        out.set_budget( y["budget"] .has_value() ? y["budget"] .as<float>() : 0.1f,
+                        y["reserve"].has_value() ? y["reserve"].as<float>() : 3.0f );
+        return out;
+    }
+
+    /*.........................................................................*/
+
+    /* forward() for requests the policy may send more than once. `peer` is
+       the balancer's first pick (-1 for a single href), `sub` the path
+       below the entry; every attempt is reported to `bal`, and `account`
+       gets the status the client ends up with. */
+    template< class S, class T >
+    void forward( nginx_retry_t policy, nginx_balancer_t bal, nginx_pool_t<S>& pool, const T& cli, int peer, url_t uri,
+                  url_t base, string_t sub, header_t hdr, ulong tmo, function_t<void,uint> account ) {
+        auto st = ptr_t<_nginx_::tries_t<S,T>>( new _nginx_::tries_t<S,T>() );
+        st->policy = policy; st->bal = bal; st->pool = &pool; st->cli = cli; st->base = base;
+        st->sub = sub; st->hdr = hdr; st->tmo = tmo; st->since = process::now(); st->account = account;
+        st->race = ptr_t<nginx_race_t>( new nginx_race_t() ); policy.open();
+
+        /* an error status is held back while another attempt may still
+           beat it; the one that ends up relayed sets the hedge delay */
+        st->race->accept = [=]( uint code ){
+            if( st->policy.retriable( code ) ){
+                if( st->live > 1 ){ return false; }
+                if( st->tries < st->policy.get_tries() && st->policy.affordable() && st->cli.is_available() ){ return false; }
+            }   st->policy.record( process::now() - st->since ); st->account( code ); _nginx_::settle( st ); return true;
+        };
+
+        cli.onClose.once([=](){ _nginx_::settle( st ); });
+        _nginx_::launch( st, peer, uri, false );
+
+        auto ms = policy.hedge_after(); if( ms >= 0 && !st->over ){
+            st->hedge = express::wheel::engine().add( ms, [=](){
+                if( st->over || st->live == 0 || !st->cli.is_available() ){ return; }
+                if( st->policy.hedge() ){ _nginx_::attempt( st, true ); }
+            });
+        }   cli.done();
+    }
+
+}}}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#endif
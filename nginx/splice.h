@@ -0,0 +1,200 @@
+/*
+ * Copyright 2023 The Nodepp Project Authors. All Rights Reserved.
+ *
+ * Licensed under the MIT (the "License").  You may not use
+ * this file except in compliance with the License.  You can obtain a copy
+ * in the file LICENSE in the source distribution or at
+ * https://github.com/NodeppOficial/nodepp/blob/main/LICENSE
+ */
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#ifndef NODEPP_NGINX_SPLICE
+#define NODEPP_NGINX_SPLICE
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#include <nodepp/nodepp.h>
+#include <nodepp/stream.h>
+#include <nodepp/https.h>
+#include <nodepp/http.h>
+#include <express/wheel.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+namespace nodepp { namespace _nginx_ {
+
+    /* the descriptor a splice may use: plain, non-blocking sockets only,
+       TLS ends have to go through the user space copy. */
+    inline int raw( const socket_t& fd ) {
+#if defined(__linux__)
+        if( !fd.is_available() ){ return -1; } int y = fd.get_fd();
+        auto flags = ::fcntl( y, F_GETFL ); return flags >= 0 && ( flags & O_NONBLOCK ) ? y : -1;
+#else
+        return -1;
+#endif
+    }
+
+    inline int raw( const ssocket_t& ){ return -1; }
+
+}}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+/* process wide switch and counters for the zero-copy path; turning it off
+   sends every relay through the string copy again, which is also how the
+   two paths are compared on a running proxy. */
+
+namespace nodepp { class nginx_zero_t {
+protected:
+
+    struct NODE {
+        bool  enabled = 1;
+        ulong pipe    = CHUNK_MB(1);    // F_SETPIPE_SZ, best effort
+        ulong flows   = 0;
+        ulong bytes   = 0;
+        ulong copied  = 0;              // relays that fell back
+    };  ptr_t<NODE> obj;
+
+public:
+
+    nginx_zero_t() noexcept : obj( new NODE() ) {}
+
+    void set_enabled( bool value ) const noexcept { obj->enabled = value; }
+    void set_pipe( ulong bytes )   const noexcept { obj->pipe = bytes;    }
+
+    bool  is_enabled() const noexcept { return obj->enabled; }
+    ulong get_pipe()   const noexcept { return obj->pipe;    }
+    ulong get_flows()  const noexcept { return obj->flows;   }
+    ulong get_bytes()  const noexcept { return obj->bytes;   }
+    ulong get_copied() const noexcept { return obj->copied;  }
+
+    void count_flow()            const noexcept { obj->flows++;       }
+    void count_bytes( ulong n )  const noexcept { obj->bytes += n;    }
+    void count_copy()            const noexcept { obj->copied++;      }
+
+};}
+
+namespace nodepp { namespace nginx { namespace splice {
+
+    inline nginx_zero_t& engine() {
+        static nginx_zero_t out; return out;
+    }
+
+}}}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+/* one direction of a relay through a kernel pipe: bytes go socket -> pipe
+   -> socket with splice(2) and never reach user space. The pipe is opened
+   on demand and closed with the last copy of the object. */
+
+namespace nodepp { class nginx_splice_t {
+protected:
+
+    struct NODE {
+        int   fd[2] = { -1, -1 };
+        ulong pend  = 0;                // bytes sitting in the pipe
+        ulong moved = 0;
+       ~NODE() noexcept {
+            if( fd[0] >= 0 ){ ::close( fd[0] ); }
+            if( fd[1] >= 0 ){ ::close( fd[1] ); }
+        }
+    };  ptr_t<NODE> obj;
+
+public:
+
+    nginx_splice_t() noexcept : obj( new NODE() ) {}
+
+    /*.........................................................................*/
+
+    bool open() const noexcept {
+#if defined(__linux__)
+        if( obj->fd[0] >= 0 ){ return true; }
+        if( !nginx::splice::engine().is_enabled() ){ return false; }
+        if( ::pipe2( obj->fd, O_NONBLOCK | O_CLOEXEC ) != 0 ){ obj->fd[0] = obj->fd[1] = -1; return false; }
+        ::fcntl( obj->fd[1], F_SETPIPE_SZ, (int) nginx::splice::engine().get_pipe() );
+        nginx::splice::engine().count_flow(); return true;
+#else
+        return false;
+#endif
+    }
+
+    ulong get_moved() const noexcept { return obj->moved; }
+    ulong get_pend()  const noexcept { return obj->pend;  }
+
+    /* one step: bytes handed to `dst` (>0), 0 when either side would block,
+       -1 once `src` ended and the pipe is empty, -2 on error. The pipe is
+       only refilled once drained, so no more than `max` bytes are taken
+       from `src` per step. */
+    long next( int src, int dst, ulong max ) const noexcept {
+#if defined(__linux__)
+        if( !open() ){ return -2; }
+
+        if( obj->pend == 0 && max > 0 ){
+            auto c = ::splice( src, nullptr, obj->fd[1], nullptr, max, SPLICE_F_MOVE | SPLICE_F_NONBLOCK );
+            if ( c == 0 ){ return -1; }
+            if ( c <  0 ){ return errno == EAGAIN || errno == EINTR ? 0 : -2; }
+            obj->pend = c;
+        }   if( obj->pend == 0 ){ return 0; }
+
+        auto c = ::splice( obj->fd[0], nullptr, dst, nullptr, obj->pend, SPLICE_F_MOVE | SPLICE_F_NONBLOCK );
+        if ( c <  0 ){ return errno == EAGAIN || errno == EINTR ? 0 : -2; }
+        obj->pend -= c; obj->moved += c; nginx::splice::engine().count_bytes( c ); return c;
+#else
+        return -2;
+#endif
+    }
+
+};}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+namespace nodepp { namespace nginx { namespace splice {
+
+    /* true when `a` and `b` can be spliced into each other */
+    template< class T, class V > bool usable( const T& a, const V& b ) {
+        return engine().is_enabled() && _nginx_::raw( a ) >= 0 && _nginx_::raw( b ) >= 0;
+    }
+
+    /*.........................................................................*/
+
+    /* src -> dst until either end closes; bytes src had already read ahead
+       go first. Each moved chunk touches the shared idle timer `t`. */
+    template< class T, class V >
+    void half( const T& src, const V& dst, nginx_splice_t spl, ptr_t<express_timer_t> t, ulong ms ) {
+        auto wrt  = type::bind( _file_::write() );
+        auto data = type::bind( string_t( src.get_borrow() ) ); src.del_borrow();
+
+        process::poll::add([=](){
+            if( !src.is_available() || !dst.is_available() ){ src.close(); dst.close(); return -1; }
+            if( !data->empty() ){
+                if((*wrt)( &dst, *data )==1 ){ return 1; }
+                if(  wrt->state <= 0 ){ src.close(); dst.close(); return -1; }
+                *data = nullptr; return 1;
+            }
+
+            auto c = spl.next( _nginx_::raw( src ), _nginx_::raw( dst ), CHUNK_MB(1) );
+            if ( c == 0 ){ return 1; } if( c < 0 ){ src.close(); dst.close(); return -1; }
+            express::wheel::engine().touch( t, ms ); return 1;
+        });
+    }
+
+    /* stream::duplex() without the user space copy when both ends are
+       plain sockets; anything else takes stream::duplex() as before. */
+    template< class T, class V >
+    void duplex( const T& a, const V& b, ptr_t<express_timer_t> t=nullptr, ulong ms=0 ) {
+        nginx_splice_t up, down;
+        if( !usable( a, b ) || !up.open() || !down.open() )
+          { engine().count_copy(); stream::duplex( a, b ); return; }
+        half( a, b, up, t, ms ); half( b, a, down, t, ms );
+    }
+
+}}}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#endif
@@ -0,0 +1,304 @@
+/*
+ * Copyright 2023 The Nodepp Project Authors. All Rights Reserved.
+ *
+ * Licensed under the MIT (the "License").  You may not use
+ * this file except in compliance with the License.  You can obtain a copy
+ * in the file LICENSE in the source distribution or at
+ * https://github.com/NodeppOficial/nodepp/blob/main/LICENSE
+ */
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#ifndef NODEPP_NGINX_STREAM
+#define NODEPP_NGINX_STREAM
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#include <nodepp/nodepp.h>
+#include <nodepp/json.h>
+#include <nodepp/tcp.h>
+#include <nodepp/tls.h>
+#include <nodepp/url.h>
+#include <express/wheel.h>
+#include <express/dns.h>
+#include <nginx/balance.h>
+#include <nginx/splice.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+/* one proxied connection; live ones are listed by get_live(), finished
+   ones handed to onEnd(). */
+
+namespace nodepp { struct nginx_flow_t {
+    ulong    id    = 0;
+    string_t client;                // remote address of the client
+    string_t upstream;              // href of the peer it was sent to
+    int      peer  =-1;             // balancer index once connected
+    ulong    since = 0;             // accepted at, ms
+    ulong    ended = 0;             // closed at, ms, 0 while open
+    ulong    sent  = 0;             // client -> upstream bytes
+    ulong    recv  = 0;             // upstream -> client bytes
+    bool     zero  = 0;             // relayed with splice(2)
+};}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+namespace nodepp { namespace _nginx_ {
+
+    /* upstreams are "tcp://host:port", or "tls://host:port" to encrypt the
+       way out again; plain ones are dialed by address from express::dns */
+    inline void dial( socket_t*, string_t name, uint port, function_t<void,socket_t> cb, function_t<void,except_t> err ) {
+        express::dns::lookup( name, [=]( string_t ip ){
+            if( ip.empty() ){ err( except_t( "dns couldn't get ip" ) ); return; }
+            tcp_t tmp ([=]( socket_t fd ){ cb( fd ); });
+            tmp.onError([=]( except_t e ){ err( e ); });
+            tmp.connect( ip, port );
+        });
+    }
+
+    inline void dial( ssocket_t*, string_t name, uint port, function_t<void,ssocket_t> cb, function_t<void,except_t> err ) {
+        ssl_t ssl; tls_t tmp ([=]( ssocket_t fd ){ cb( fd ); }, &ssl );
+        tmp.onError([=]( except_t e ){ err( e ); });
+        tmp.connect( name, port );
+    }
+
+    /* PROXY protocol v2 header for the connection accepted on `fd`: the
+       client as source, the address it reached as destination. Anything
+       other than TCP over IPv4 or IPv6 is sent as LOCAL. */
+    inline string_t proxy_v2( int fd ) {
+        string_t out( "\r\n\r\n\0\r\nQUIT\n", 12 );
+        struct sockaddr_storage src, dst; socklen_t a = sizeof(src), b = sizeof(dst);
+
+        if( fd < 0 || ::getpeername( fd, (struct sockaddr*) &src, &a ) != 0 ||
+                      ::getsockname( fd, (struct sockaddr*) &dst, &b ) != 0 || src.ss_family != dst.ss_family )
+          { out += string_t( "\x20\x00\x00\x00", 4 ); return out; }
+
+        if( src.ss_family == AF_INET ){
+            auto s = (struct sockaddr_in*) &src, d = (struct sockaddr_in*) &dst;
+            out += string_t( "\x21\x11\x00\x0C", 4 );
+            out += string_t( (char*) &s->sin_addr, 4 ); out += string_t( (char*) &d->sin_addr, 4 );
+            out += string_t( (char*) &s->sin_port, 2 ); out += string_t( (char*) &d->sin_port, 2 ); return out;
+        }
+
+        if( src.ss_family == AF_INET6 ){
+            auto s = (struct sockaddr_in6*) &src, d = (struct sockaddr_in6*) &dst;
+            out += string_t( "\x21\x21\x00\x24", 4 );
+            out += string_t( (char*) &s->sin6_addr, 16 ); out += string_t( (char*) &d->sin6_addr, 16 );
+            out += string_t( (char*) &s->sin6_port, 2  ); out += string_t( (char*) &d->sin6_port, 2  ); return out;
+        }
+
+        out += string_t( "\x20\x00\x00\x00", 4 ); return out;
+    }
+
+    /* src -> dst until either end closes, counting what went through.
+       `first` and the bytes src had read ahead go out before anything
+       else; after that it is splice(2) when `zero`, a copy otherwise. */
+    template< class T, class V >
+    void pump( const T& src, const V& dst, nginx_splice_t spl, bool zero, string_t first,
+               ptr_t<express_timer_t> t, ulong ms, ptr_t<nginx_flow_t> flow, bool out ) {
+        auto rd   = type::bind( _file_::read()  );
+        auto wrt  = type::bind( _file_::write() );
+        auto data = type::bind( first + src.get_borrow() ); src.del_borrow();
+        auto add  = [=]( ulong n ){ if( out ){ flow->sent += n; } else { flow->recv += n; } };
+
+        process::poll::add([=](){
+            if( !src.is_available() || !dst.is_available() ){ src.close(); dst.close(); return -1; }
+            if( !data->empty() ){
+                if((*wrt)( &dst, *data )==1 ){ return 1; }
+                if(  wrt->state <= 0 ){ src.close(); dst.close(); return -1; }
+                add( data->size() ); *data = nullptr; express::wheel::engine().touch( t, ms ); return 1;
+            }
+
+            if( zero ){
+                auto c = spl.next( raw( src ), raw( dst ), CHUNK_MB(1) );
+                if ( c == 0 ){ return 1; } if( c < 0 ){ src.close(); dst.close(); return -1; }
+                add( c ); express::wheel::engine().touch( t, ms ); return 1;
+            }
+
+            if((*rd)( &src )==1 ){ return 1; }
+            if(  rd->state <= 0 ){ src.close(); dst.close(); return -1; }
+            *data = rd->data; return 1;
+        });
+    }
+
+}}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+/* layer 4 proxy: every connection accepted is joined to an upstream picked
+   by the balancer and bytes are relayed both ways as they are, so any
+   protocol on top of TCP passes (redis, postgres, ...). With an ssl_t the
+   listener terminates TLS; plain on both ends the relay is splice(2). A
+   peer that cannot be reached is reported and the next one tried, up to
+   `tries` peers per connection. The HASH policy hashes on the client
+   address, which pins each client to one peer. */
+
+namespace nodepp { class nginx_stream_t {
+protected:
+
+    struct NODE {
+        nginx_balancer_t bal;
+        ssl_t*   ssl    = nullptr;      // terminates TLS when set
+        agent_t* agent  = nullptr;
+        bool     proxy  = 0;            // PROXY v2 header ahead of the client's bytes
+        ulong    timeout= 0;            // idle ms, 0 = none
+        ulong    tries  = 3;            // peers tried per connection
+        ulong    next   = 0;            // flow ids
+        map_t<ulong,ptr_t<nginx_flow_t>> live;
+        function_t<void,nginx_flow_t>    end;
+        bool     ending = 0;            // `end` is set
+        ulong    total  = 0;
+        ulong    fails  = 0;            // connections no peer took
+        ulong    sent   = 0;            // bytes of finished flows
+        ulong    recv   = 0;
+        tcp_t    fd;
+        tls_t    sfd;
+    };  ptr_t<NODE> obj;
+
+    /*.........................................................................*/
+
+    void close( ptr_t<nginx_flow_t> flow ) const noexcept {
+        if( flow->ended > 0 ){ return; } flow->ended = process::now(); obj->live.erase( flow->id );
+        obj->sent += flow->sent; obj->recv += flow->recv;
+        if( flow->peer >= 0 ){ obj->bal.report( flow->peer, 200 ); } // active until the flow ends
+        if( obj->ending ){ obj->end( *flow ); }
+    }
+
+    template< class T, class V >
+    void relay( const T& cli, const V& up, ptr_t<nginx_flow_t> flow ) const noexcept {
+        auto ms = obj->timeout; ptr_t<express_timer_t> t; up.set_timeout( 0 );
+        if( ms > 0 ){ t = express::wheel::engine().add( ms, [=](){ cli.close(); up.close(); });
+            cli.onClose.once([=](){ express::wheel::engine().cancel( t ); });
+            up .onClose.once([=](){ express::wheel::engine().cancel( t ); });
+        }
+
+        auto head = obj->proxy ? _nginx_::proxy_v2( cli.get_fd() ) : string_t();
+        nginx_splice_t a, b; flow->zero = nginx::splice::usable( cli, up ) && a.open() && b.open();
+        if( !flow->zero ){ nginx::splice::engine().count_copy(); }
+
+        _nginx_::pump( cli, up, a, flow->zero, head, t, ms, flow, true  );
+        _nginx_::pump( up, cli, b, flow->zero, nullptr, t, ms, flow, false );
+    }
+
+    template< class T, class V >
+    void joined( const T& cli, const V& up, ptr_t<nginx_flow_t> flow, int peer ) const noexcept {
+        if( !cli.is_available() ){ up.close(); obj->bal.report( peer, 200 ); return; }
+        flow->peer = peer; relay( cli, up, flow );
+    }
+
+    template< class T >
+    void dial( const T& cli, ptr_t<nginx_flow_t> flow, array_t<int> used ) const noexcept {
+        if( !cli.is_available() ){ return; } auto self = type::bind( this );
+        int peer = used.empty() ? obj->bal.pick( flow->client ) : obj->bal.pick_other( used );
+        if( peer < 0 ){ obj->fails++; cli.close(); return; } used.push( peer );
+
+        auto p = obj->bal.get_peer( peer ); flow->upstream = p->href;
+        function_t<void,except_t> err = [=]( except_t ){ self->obj->bal.report( peer, 0 );
+            if( used.size() < self->obj->tries ){ self->dial( cli, flow, used ); return; }
+            self->obj->fails++; cli.close();
+        };
+
+        if( p->uri.protocol.to_lower_case() == "tls" ){
+            _nginx_::dial( (ssocket_t*) nullptr, p->uri.hostname, p->uri.port,
+                [=]( ssocket_t up ){ self->joined( cli, up, flow, peer ); }, err );
+        } else {
+            _nginx_::dial( (socket_t*) nullptr, p->uri.hostname, p->uri.port,
+                [=]( socket_t  up ){ self->joined( cli, up, flow, peer ); }, err );
+        }
+    }
+
+    template< class T >
+    void accept( const T& cli ) const noexcept {
+        auto flow = ptr_t<nginx_flow_t>( new nginx_flow_t() ); auto self = type::bind( this );
+        flow->id = ++obj->next; flow->client = cli.get_peername(); flow->since = process::now();
+        obj->live[ flow->id ] = flow; obj->total++; cli.set_timeout( 0 );
+        cli.onClose.once([=](){ self->close( flow ); });
+        if( obj->bal.empty() ){ obj->fails++; cli.close(); return; }
+        dial( cli, flow, array_t<int>() );
+    }
+
+public:
+
+    nginx_stream_t( ssl_t* ssl=nullptr, agent_t* agent=nullptr ) noexcept : obj( new NODE() )
+                  { obj->ssl = ssl; obj->agent = agent; }
+
+    /*.........................................................................*/
+
+    const nginx_stream_t& add( string_t href, ulong weight=1 ) const noexcept {
+        obj->bal.add( href, weight ); return (*this);
+    }
+
+    void set_balancer( nginx_balancer_t bal ) const noexcept { obj->bal     = bal; }
+    void set_proxy   ( bool value )           const noexcept { obj->proxy   = value; }
+    void set_timeout ( ulong ms )             const noexcept { obj->timeout = ms; }
+    void set_tries   ( ulong size )           const noexcept { obj->tries   = max( size, 1UL ); }
+
+    /* called with the counters of every connection once it closed */
+    void onEnd( function_t<void,nginx_flow_t> cb ) const noexcept { obj->end = cb; obj->ending = 1; }
+
+    /*.........................................................................*/
+
+    nginx_balancer_t get_balancer() const noexcept { return obj->bal;         }
+    ulong            get_open()     const noexcept { return obj->live.size(); }
+    ulong            get_total()    const noexcept { return obj->total;       }
+    ulong            get_fails()    const noexcept { return obj->fails;       }
+
+    /* bytes both ways, finished flows and the ones still open */
+    ulong get_sent() const noexcept { ulong out = obj->sent;
+        forEach( item, obj->live.data() ){ out += item.second->sent; } return out;
+    }
+
+    ulong get_recv() const noexcept { ulong out = obj->recv;
+        forEach( item, obj->live.data() ){ out += item.second->recv; } return out;
+    }
+
+    array_t<nginx_flow_t> get_live() const noexcept { array_t<nginx_flow_t> out;
+        forEach( item, obj->live.data() ){ out.push( *item.second ); } return out;
+    }
+
+    /*.........................................................................*/
+
+    template< class... A >
+    const nginx_stream_t& listen( const A&... args ) const noexcept {
+        auto self = type::bind( this ); if( obj->ssl != nullptr ){
+            obj->sfd = tls_t([=]( ssocket_t cli ){ self->accept( cli ); }, obj->ssl, obj->agent );
+            obj->sfd.listen( args... ); return (*this);
+        }
+        obj->fd = tcp_t([=]( socket_t cli ){ self->accept( cli ); }, obj->agent );
+        obj->fd.listen( args... ); return (*this);
+    }
+
+    void close() const noexcept {
+        if( obj->ssl != nullptr ){ obj->sfd.close(); } else { obj->fd.close(); }
+    }
+
+};}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+namespace nodepp { namespace nginx { namespace stream {
+
+    template< class... T > nginx_stream_t add( T... args ) {
+        return nginx_stream_t( args... );
+    }
+
+    /* { "upstream": [ { "href": "tcp://10.0.0.1:6379" }, { "href": "tls://db:5432" } ],
+         "balance": ..., "health": ..., "passive": ...,     see nginx::balance::parse
+         "proxy_protocol": true, "timeout": 600000, "tries": 3 }
+       `ssl` set terminates TLS on the listener. */
+    inline nginx_stream_t parse( object_t args, ssl_t* ssl=nullptr, agent_t* agent=nullptr ) {
+        nginx_stream_t out( ssl, agent ); out.set_balancer( nginx::balance::parse( args ) );
+        if( args["proxy_protocol"].has_value() ){ out.set_proxy  ( args["proxy_protocol"].as<bool>() ); }
+        if( args["timeout"]       .has_value() ){ out.set_timeout( args["timeout"].as<ulong>() ); }
+        if( args["tries"]         .has_value() ){ out.set_tries  ( args["tries"].as<ulong>() ); }
+        return out;
+    }
+
+}}}
+
+/*────────────────────────────────────────────────────────────────────────────*/
+
+#endif
@@ -17,6 +17,7 @@
 #include <nodepp/nodepp.h>
 #include <nodepp/https.h>
 #include "tls.h"
+#include <express/wheel.h>
 
 /*────────────────────────────────────────────────────────────────────────────*/
 
@@ -47,7 +48,9 @@ namespace nodepp { namespace torify { namespace https {
         auto client = tls_torify_t ([=]( https_t cli ){ 
             cli.set_timeout( gfc->timeout ); cli.write_header( gfc, dir );
 
-            if( cli.read_header()==0 ){ res( cli ); return; } else { 
+            if( cli.read_header()==0 ){ if( gfc->timeout > 0 ){ // body phase runs on the wheel
+                cli.set_timeout( 0 ); express::wheel::idle( cli, gfc->timeout );
+            }   res( cli ); return; } else { 
                 rej(except_t("Could not connect to server")); 
                 cli.close(); 
             }
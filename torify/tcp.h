@@ -15,6 +15,7 @@
 /*────────────────────────────────────────────────────────────────────────────*/
 
 #include <nodepp/tcp.h>
+#include <express/dns.h>
 
 /*────────────────────────────────────────────────────────────────────────────*/
 
@@ -82,51 +83,52 @@ public: tcp_torify_t() noexcept : obj( new NODE() ) {}
     /*─······································································─*/
 
     void connect( const string_t& host, int port, decltype(NODE::func) cb ) const noexcept {
-        if( obj->state == 1 ){ return; } if( dns::lookup(obj->agent.proxy).empty() )
-          { _EERROR(onError,"dns couldn't get ip"); close(); return; }
-        
+        if( obj->state == 1 ){ return; }
         auto self = type::bind( this ); obj->state = 1;
 
-        socket_t sk;
-                 sk.SOCK    = SOCK_STREAM; 
-                 sk.IPPROTO = IPPROTO_TCP;
-                 sk.socket( dns::lookup(
-                       url::hostname( obj->agent.proxy ) 
-                    ), url::port ( obj->agent.proxy )
-                ); sk.set_sockopt( self->obj->agent );
+        /* the proxy name goes through express::dns, off the loop thread */
+        express::dns::lookup( url::hostname( obj->agent.proxy ), [=]( string_t dip ){
+            if( dip.empty() ){ self->obj->state = 0; _EERROR(self->onError,"dns couldn't get ip"); return; }
 
-        process::poll::add([=](){
-            if( self->is_closed() ){ return -1; }
-        coStart
+            socket_t sk;
+                     sk.SOCK    = SOCK_STREAM; 
+                     sk.IPPROTO = IPPROTO_TCP;
+                     sk.socket( dip, url::port ( self->obj->agent.proxy )
+                    ); sk.set_sockopt( self->obj->agent );
+
+            process::poll::add([=](){
+                if( self->is_closed() ){ return -1; }
+            coStart
 
-            while( sk._connect() == -2 ){ coNext; } 
-            if   ( sk._connect()  <  0 ){ 
-                _EERROR(self->onError,"Error while connecting TCP"); 
-            coEnd; }
+                while( sk._connect() == -2 ){ coNext; } 
+                if   ( sk._connect()  <  0 ){ 
+                    _EERROR(self->onError,"Error while connecting TCP"); 
+                coEnd; }
 
-            if( self->obj->poll.push_write(sk.get_fd())==0 )
-              { sk.free(); } while( self->obj->poll.emit()==0 ){ 
-            if( process::now() > sk.get_send_timeout() )
-              { coEnd; } coNext; }
+                if( self->obj->poll.push_write(sk.get_fd())==0 )
+                  { sk.free(); } while( self->obj->poll.emit()==0 ){ 
+                if( process::now() > sk.get_send_timeout() )
+                  { coEnd; } coNext; }
 
-            do { int len = type::cast<int>( host.size() );
+                do { int len = type::cast<int>( host.size() );
 
-                sk.write( ptr_t<char>({ 0x05, 0x01, 0x00, 0x00 }) );
-                if( sk.read(2)!=ptr_t<char>({ 0x05, 0x00, 0x00 }) ){ 
-                    _EERROR(self->onError,"Error while Handshaking Sock5"); 
-                coEnd; } 
+                    sk.write( ptr_t<char>({ 0x05, 0x01, 0x00, 0x00 }) );
+                    if( sk.read(2)!=ptr_t<char>({ 0x05, 0x00, 0x00 }) ){ 
+                        _EERROR(self->onError,"Error while Handshaking Sock5"); 
+                    coEnd; } 
 
-                sk.write( ptr_t<char>({ 0x05, 0x01, 0x00, 0x03, 0x00 }) );
-                sk.write( ptr_t<char>({ len, 0x00 }) ); sk.write( host );
-                sk.write( htons( port ) ); sk.read();
+                    sk.write( ptr_t<char>({ 0x05, 0x01, 0x00, 0x03, 0x00 }) );
+                    sk.write( ptr_t<char>({ len, 0x00 }) ); sk.write( host );
+                    sk.write( htons( port ) ); sk.read();
 
-            } while(0); cb( sk );
+                } while(0); cb( sk );
             
-            sk.onClose.once([=](){ self->close(); }); 
-            self->onSocket.emit(sk); sk.onOpen.emit(); 
-            self->onOpen.emit(sk); self->obj->func(sk);
+                sk.onClose.once([=](){ self->close(); }); 
+                self->onSocket.emit(sk); sk.onOpen.emit(); 
+                self->onOpen.emit(sk); self->obj->func(sk);
             
-        coStop
+            coStop
+            });
         });
 
     }
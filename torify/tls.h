@@ -15,6 +15,7 @@
 /*────────────────────────────────────────────────────────────────────────────*/
 
 #include <nodepp/tls.h>
+#include <express/dns.h>
 
 /*────────────────────────────────────────────────────────────────────────────*/
 
@@ -94,60 +95,61 @@ public: tls_torify_t() noexcept : obj( new NODE() ) {}
     void connect( const string_t& host, int port, decltype(NODE::func) cb  ) const noexcept {
         if( obj->state == 1 ){ return; } if( obj->ctx.create_client() == -1 )
           { _EERROR(onError,"Error Initializing SSL context"); close(); return; }
-        if( dns::lookup(obj->agent.proxy).empty() )
-          { _EERROR(onError,"dns couldn't get ip"); close(); return; }
 
         auto self = type::bind( this ); obj->state = 1;
 
-        ssocket_t sk; 
-                  sk.SOCK    = SOCK_STREAM;
-                  sk.IPPROTO = IPPROTO_TCP;
-                  sk.socket( dns::lookup(
-                       url::hostname( obj->agent.proxy ) 
-                    ), url::port ( obj->agent.proxy )
-                ); sk.set_sockopt( self->obj->agent );
+        /* the proxy name goes through express::dns, off the loop thread */
+        express::dns::lookup( url::hostname( obj->agent.proxy ), [=]( string_t dip ){
+            if( dip.empty() ){ self->obj->state = 0; _EERROR(self->onError,"dns couldn't get ip"); return; }
 
-        sk.ssl = new ssl_t( obj->ctx, sk.get_fd() ); 
-        sk.ssl->set_hostname( host );
+            ssocket_t sk; 
+                      sk.SOCK    = SOCK_STREAM;
+                      sk.IPPROTO = IPPROTO_TCP;
+                      sk.socket( dip, url::port ( self->obj->agent.proxy )
+                    ); sk.set_sockopt( self->obj->agent );
 
-        process::poll::add([=](){
-            if( self->is_closed() ){ return -1; }
-        coStart
+            sk.ssl = new ssl_t( self->obj->ctx, sk.get_fd() ); 
+            sk.ssl->set_hostname( host );
+
+            process::poll::add([=](){
+                if( self->is_closed() ){ return -1; }
+            coStart
 
-            while( sk._connect() == -2 ){ coNext; } 
-            if   ( sk._connect()  <  0 ){ 
-                _EERROR(self->onError,"Error while connecting TLS"); 
-            coEnd; }
+                while( sk._connect() == -2 ){ coNext; } 
+                if   ( sk._connect()  <  0 ){ 
+                    _EERROR(self->onError,"Error while connecting TLS"); 
+                coEnd; }
 
-            if( self->obj->poll.push_write(sk.get_fd())==0 )
-              { sk.free(); } while( self->obj->poll.emit()==0 ){ 
-            if( process::now() > sk.get_send_timeout() )
-              { coEnd; } coNext; }
+                if( self->obj->poll.push_write(sk.get_fd())==0 )
+                  { sk.free(); } while( self->obj->poll.emit()==0 ){ 
+                if( process::now() > sk.get_send_timeout() )
+                  { coEnd; } coNext; }
 
-            do { int  len = type::cast<int>( host.size() );
-                 auto sok = (socket_t)sk;
+                do { int  len = type::cast<int>( host.size() );
+                     auto sok = (socket_t)sk;
 
-                sok.write( ptr_t<char>({ 0x05, 0x01, 0x00, 0x00 }) );
-                if( sok.read(2)!=ptr_t<char>({ 0x05, 0x00, 0x00 }) ){ 
-                    _EERROR(self->onError,"Error while Handshaking Sock5"); 
-                coEnd; } 
+                    sok.write( ptr_t<char>({ 0x05, 0x01, 0x00, 0x00 }) );
+                    if( sok.read(2)!=ptr_t<char>({ 0x05, 0x00, 0x00 }) ){ 
+                        _EERROR(self->onError,"Error while Handshaking Sock5"); 
+                    coEnd; } 
 
-                sok.write( ptr_t<char>({ 0x05, 0x01, 0x00, 0x03, 0x00 }) );
-                sok.write( ptr_t<char>({ len, 0x00 }) ); sok.write( host );
-                sok.write( htons( port ) ); sok.read();
+                    sok.write( ptr_t<char>({ 0x05, 0x01, 0x00, 0x03, 0x00 }) );
+                    sok.write( ptr_t<char>({ len, 0x00 }) ); sok.write( host );
+                    sok.write( htons( port ) ); sok.read();
 
-            } while(0);
+                } while(0);
 
-            while( sk.ssl->_connect() == -2 ){ coNext; }
-            if   ( sk.ssl->_connect() <=  0 ){ 
-                _EERROR(self->onError,"Error while handshaking TLS");
-            coEnd; } cb( sk );
+                while( sk.ssl->_connect() == -2 ){ coNext; }
+                if   ( sk.ssl->_connect() <=  0 ){ 
+                    _EERROR(self->onError,"Error while handshaking TLS");
+                coEnd; } cb( sk );
             
-            sk.onClose.once([=](){ self->close(); }); 
-            self->onSocket.emit(sk); sk.onOpen.emit(); 
-            self->onOpen.emit(sk); self->obj->func(sk);
+                sk.onClose.once([=](){ self->close(); }); 
+                self->onSocket.emit(sk); sk.onOpen.emit(); 
+                self->onOpen.emit(sk); self->obj->func(sk);
 
-        coStop
+            coStop
+            });
         });
 
     }